@@ -14,6 +14,7 @@
 
 #include "util.h"
 #include "draw.h"
+#include "lut.h"
 
 /*------------------------------------------------------------------------------*/
 #define COLOR_WHITE 255
@@ -49,8 +50,12 @@ typedef struct bitmap_info_header {
 /*------------------------------------------------------------------------------*/
 image_t* bmp_load(const char *);
 int bmp_save(const char *, image_t);
+uint32_t bmp_stride(image_t);
+void bmp_draw_format(image_t, draw_format_t *);
 image_t* bmp_convert_to_intensity(image_t);
 image_t* bmp_convert_from_intensity(image_t);
+image_t* bmp_convert_to_intensity_lut(image_t, const lut_t *);
+image_t* bmp_convert_from_intensity_lut(image_t, const lut_t *);
 image_t* bmp_crop_image(image_t, rectangle_t);
 image_t* bmp_convert_to_rgb(image_t);
 image_t* bmp_convert_from_rgb(image_t);
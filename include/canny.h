@@ -0,0 +1,17 @@
+/**
+ * \file
+ *	Canny edge detector
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef CANNY_H_
+#define CANNY_H_
+
+#include "util.h"
+
+/*------------------------------------------------------------------------------*/
+image_t* canny_detect(image_t, double, double);
+
+#endif /* CANNY_H_ */
@@ -18,11 +18,20 @@ int cv_convert_grayscale(const char *, const char *);
 int cv_draw(const char *, const char *, const char *);
 int cv_crop_image(const char *, const char *, rectangle_t);
 int cv_apply_mask(const char *, const char *, const char *);
+int cv_mask_bench(const char *);
+int cv_apply_chain(const char *, const char *, const char *);
+int cv_gradient(const char *, const char *, const char *);
+int cv_canny(const char *, const char *);
+int cv_point_operation(const char *, const char *, const char *);
+int cv_pipeline(const char *, const char *);
 int cv_apply_morphology(const char *, const char *, const char *);
 int cv_identify_regions(const char *, const char *);
 int cv_feature_extraction_single(const char *, const char *);
 int cv_feature_extraction_multi(const char *, const char *);
+int cv_feature_extraction_update(const char *, const char *);
 int cv_feature_extraction_test(const char *, const char *, const char *);
+int cv_feature_extraction_convert(const char *, const char *);
+int cv_feature_extraction_bench(const char *, const char *);
 int cv_feature_extraction(const char *, const char *, const char *, const char *);
 
 #endif /* COMPUTER_VISION_H_ */
@@ -38,12 +38,56 @@ typedef struct {
     int32_t b;
 } ellipse_t;
 
+typedef enum {
+    DRAW_PLUS = 0,
+    DRAW_RECT,
+    DRAW_FILLED_RECT,
+    DRAW_CIRCLE,
+    DRAW_FILLED_CIRCLE,
+    DRAW_ELLIPSE,
+    DRAW_FILLED_ELLIPSE,
+} draw_shape_t;
+
+/* Queued shape, see draw_list_render */
+typedef struct {
+    uint8_t shape;	    /* draw_shape_t */
+    uint8_t color;
+    uint8_t orig_center;    /* rectangles only, see draw_rect */
+    union {
+	plus_t plus;
+	rectangle_t rect;
+	circle_t circle;
+	ellipse_t ellipse;
+    };
+} draw_cmd_t;
+
+typedef struct {
+    draw_cmd_t *cmds;
+    uint32_t noe;
+    uint32_t capacity;
+} draw_list_t;
+
+/* Pixel layout of the buffer drawn into, NULL is top-down packed RGB rows */
+typedef struct {
+    uint32_t stride;	    /* bytes between rows, 0 for width * cb */
+    uint8_t bottom_up;	    /* first row in the buffer is the last image row */
+    uint8_t bgr;	    /* colour bytes are blue, green, red */
+} draw_format_t;
+
 /*------------------------------------------------------------------------------*/
 void draw_plus(image_t, plus_t, uint8_t);
 void draw_rect(image_t, rectangle_t, uint8_t, uint8_t);
 void draw_filled_rect(image_t, rectangle_t, uint8_t, uint8_t);
 void draw_circle(image_t, circle_t, uint8_t);
+void draw_filled_circle(image_t, circle_t, uint8_t);
 void draw_ellipse(image_t, ellipse_t, uint8_t);
-int draw_multi_shapes(image_t, const char *, uint8_t);
+void draw_filled_ellipse(image_t, ellipse_t, uint8_t);
+int draw_multi_shapes(image_t, const draw_format_t *, const char *, uint8_t);
+
+/*------------------------------------------------------------------------------*/
+int draw_list_add(draw_list_t *, const draw_cmd_t *);
+int draw_list_load(draw_list_t *, const char *, uint8_t);
+int draw_list_render(image_t, const draw_format_t *, const draw_list_t *);
+void draw_list_free(draw_list_t *);
 
 #endif /* DRAW_H_ */
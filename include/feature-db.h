@@ -0,0 +1,75 @@
+/**
+ * \file
+ *	Binary feature database functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef FEATURE_DB_H_
+#define FEATURE_DB_H_
+
+#include <stdint.h>
+
+#include "feature-extraction.h"
+
+/*------------------------------------------------------------------------------*/
+#define FDB_MAGIC	    "FEATDB\r\n"    /* catches text mode transfers */
+#define FDB_MAGIC_LEN	    8
+#define FDB_VERSION	    5
+#define FDB_BYTE_ORDER	    0x01020304	    /* as written by the host */
+#define FDB_EXTENSION	    ".fdb"
+
+/*------------------------------------------------------------------------------*/
+/*
+ * File starts with this header, every section starts on a FMAT_ALIGN boundary
+ * so the matrices are used in place from the mapping.
+ */
+typedef struct {
+    char magic[FDB_MAGIC_LEN];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t value_size;	/* sizeof(fmat_val_t) of the writer */
+    uint32_t classes;
+    uint32_t cols;
+    uint32_t stride;
+    uint32_t samples;
+    uint32_t files;
+    uint32_t quant_bits;	/* sample code width, zero if the codes are not kept */
+    uint32_t quant_stride;	/* codes in a row */
+    uint64_t set_offset;	/* cols null terminated feature names */
+    uint64_t set_size;
+    uint64_t names_offset;	/* classes null terminated names */
+    uint64_t names_size;
+    uint64_t total_offset;	/* classes uint32_t region counts */
+    uint64_t features_offset;	/* classes x stride values */
+    uint64_t labels_offset;	/* samples uint32_t class indexes */
+    uint64_t samples_offset;	/* samples x stride values, read for the re-ranked ones */
+    uint64_t quant_offset;	/* quant_stride double offsets, then quant_stride scales */
+    uint64_t codes_offset;	/* samples x quant_stride codes, see qmat_t */
+    uint64_t files_offset;	/* files fdb_file_t learned files */
+    uint64_t paths_offset;	/* null terminated learned file paths */
+    uint64_t paths_size;
+    uint64_t size;		/* whole file */
+} fdb_header_t;
+
+/* Learned image file record, see learned_file_t */
+typedef struct {
+    uint64_t path_offset;	/* in the paths table */
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    uint32_t index;
+    uint32_t regions;
+    uint32_t sample;
+    uint32_t samples;
+    double sum[FE_CONF_MAX_FEATURES];
+} fdb_file_t;
+
+/*------------------------------------------------------------------------------*/
+uint8_t fdb_is_binary(const char *);
+uint8_t fdb_is_binary_filename(const char *);
+classes_t* fdb_load(const char *);
+int fdb_save(const char *, classes_t *);
+
+#endif /* FEATURE_DB_H_ */
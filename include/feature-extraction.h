@@ -13,41 +13,100 @@
 
 #include "util.h"
 #include "draw.h"
-
-/*------------------------------------------------------------------------------*/
-typedef struct {
-    uint32_t total_noe;	/* how many regions contain that we calculated the avg */
-    uint8_t noe;	/* feature array noe */
-    double *feature;
-} features_t;
-
-#define sfree_features(_features) do {	\
-	if (_features) {		\
-	    sfree(_features->feature);	\
-	    sfree(_features);		\
-	}				\
-    } while (0)
+#include "feature-matrix.h"
+#include "match.h"
+#include "feature-registry.h"
 
 /*------------------------------------------------------------------------------*/
 struct _class {
-    uint8_t index;	    /* used for holding index */
+    uint32_t index;	    /* row in the classes feature matrix */
     char *name;		    /* uniqe class identifier */
     str_node_t *files;	    /* input image file names */
-    features_t *features;   /* calculated features */
+    str_node_t *files_tail; /* last file name, appends are O(1) */
+    uint8_t mapped;	    /* node is in the classes pool, name in the db mapping */
     struct _class *next;    /* next class pointer */
 };
 typedef struct _class class_t;
 
-class_t* fe_classes_insert(class_t **, char *, features_t *);
-int fe_classes_update(class_t *, image_t, regions_t);
-void fe_classes_free(class_t **);
+/*------------------------------------------------------------------------------*/
+/* Learned image file, kept to skip the unchanged files while updating */
+typedef struct {
+    char *path;		    /* as given in the class image list */
+    uint32_t index;	    /* class the file is learned into */
+    uint32_t regions;	    /* regions folded into the class */
+    uint64_t size;	    /* file state at learning */
+    int64_t mtime;	    /* nanoseconds */
+    uint64_t hash;	    /* FNV-1a of the content */
+    uint8_t mapped;	    /* path is in the db mapping */
+    uint8_t seen;	    /* listed in this update, not saved */
+    uint32_t sample;	    /* first of its sample rows */
+    uint32_t samples;	    /* sample rows, zero if its samples are not kept */
+    double sum[FE_CONF_MAX_FEATURES]; /* feature sum of the regions */
+} learned_file_t;
+
+typedef struct {
+    const char *path;
+    uint32_t index;	    /* in the learned files */
+} learned_key_t;
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    uint32_t noe;	    /* number of classes */
+    uint32_t capacity;	    /* allocated total_noe entries */
+    class_t *head;	    /* classes in insertion order */
+    class_t *tail;	    /* last class, appends are O(1) */
+    class_t **table;	    /* open addressed name hash, NULL is an empty slot */
+    uint32_t table_size;    /* slots, a power of two at least twice noe */
+    freg_set_t set;	    /* features of the db, a column each */
+    uint32_t *total_noe;    /* how many regions averaged into each class */
+    fmat_t *features;	    /* noe x set.noe class averages */
+    match_index_t *index;   /* built over features when loaded for matching */
+    fmat_t *samples;	    /* every training region, only if samples are kept */
+    uint32_t *labels;	    /* class index of each sample row */
+    kdtree_t *samples_tree; /* built over samples when loaded for matching */
+    qmat_t *qsamples;	    /* quantized samples, knn scans them instead of the tree */
+    uint8_t quant_bits;	    /* code bits binary dbs keep the samples with, zero if none */
+    learned_file_t *learned; /* files folded into the classes */
+    uint32_t learned_noe;
+    uint32_t learned_capacity;
+    learned_key_t *keys;    /* learned paths, the first keys_noe sorted for lookup */
+    uint32_t keys_noe;
+    class_t *pool;	    /* class nodes of a binary db, allocated at once */
+    void *map;		    /* binary db mapping, features and samples point in */
+    size_t map_size;
+} classes_t;
+
+/* Features evaluated by the cascade matching */
+typedef struct {
+    uint32_t regions;
+    uint32_t evaluated;	    /* over all regions */
+    uint32_t histogram[FE_CONF_MAX_FEATURES + 1]; /* regions by evaluated features */
+} fe_cascade_stats_t;
+
+/*------------------------------------------------------------------------------*/
+int fe_features_selected(freg_set_t *);
+classes_t* fe_classes_alloc(const freg_set_t *);
+int fe_classes_link(classes_t *, class_t *);
+class_t* fe_classes_insert(classes_t *, char *, const fmat_val_t *, uint32_t);
+class_t* fe_classes_find(classes_t *, const char *);
+learned_file_t* fe_classes_learned_append(classes_t *, const char *);
+uint8_t fe_classes_learned_unchanged(classes_t *, const class_t *, const char *);
+uint32_t fe_classes_learned_prune(classes_t *);
+int fe_learned_state(const char *, learned_file_t *);
+int fe_classes_fold(classes_t *, class_t *, const learned_file_t *, const fmat_t *);
+int fe_classes_update(classes_t *, class_t *, const char *, image_t, regions_t);
+int fe_classes_index(classes_t *);
+void fe_classes_free(classes_t **);
 
 /*------------------------------------------------------------------------------*/
-features_t* fe_get_avg(image_t, regions_t);
-int fe_test(image_t, regions_t, class_t, image_t);
-int fe_save(const char *, features_t);
-class_t* fe_load_classes_with_features(const char *);
-class_t* fe_load_classes(const char *);
-int fe_save_classes(const char *, class_t *);
+fmat_t* fe_get_all(image_t, regions_t, const freg_set_t *);
+fmat_t* fe_avg(const fmat_t *);
+fmat_t* fe_get_avg(image_t, regions_t, const freg_set_t *);
+int fe_test(image_t, regions_t, classes_t, image_t, const draw_format_t *,
+	fe_cascade_stats_t *);
+int fe_save(const char *, fmat_t);
+classes_t* fe_load_classes_with_features(const char *);
+classes_t* fe_load_classes(const char *);
+int fe_save_classes(const char *, classes_t *);
 
 #endif /* FEATURE_EXT_H_ */
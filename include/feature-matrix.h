@@ -0,0 +1,60 @@
+/**
+ * \file
+ *	Feature matrix functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef FEATURE_MATRIX_H_
+#define FEATURE_MATRIX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util.h"
+#include "project-conf.h"
+
+/*------------------------------------------------------------------------------*/
+#if FE_CONF_FLOAT32
+typedef float fmat_val_t;
+#define FMAT_VAL_SF "%f"	/* SF: Scanf Format */
+#else /* FE_CONF_FLOAT32 */
+typedef double fmat_val_t;
+#define FMAT_VAL_SF "%lf"
+#endif /* FE_CONF_FLOAT32 */
+
+/* Rows start on this boundary so SIMD loads never split a cache line */
+#define FMAT_ALIGN 64
+/* Values in a 256 bit register */
+#define FMAT_LANES (32 / sizeof(fmat_val_t))
+
+/*------------------------------------------------------------------------------*/
+/* Row major, rows padded with zeros up to FMAT_ALIGN bytes */
+typedef struct {
+    uint32_t rows;	/* number of rows in use */
+    uint32_t cols;	/* number of values in a row */
+    uint32_t stride;	/* distance between rows in values */
+    uint32_t capacity;	/* allocated rows */
+    uint8_t mapped;	/* data is borrowed from a file mapping, never freed */
+    fmat_val_t *data;	/* FMAT_ALIGN aligned values */
+} fmat_t;
+
+#define fmat_row(_m, _i) (&(_m)->data[(size_t)(_i) * (_m)->stride])
+
+#define sfree_fmat(_fmat) do {				\
+	if (_fmat) {					\
+	    if (!_fmat->mapped) sfree(_fmat->data);	\
+	    sfree(_fmat);				\
+	}						\
+    } while (0)
+
+/*------------------------------------------------------------------------------*/
+fmat_t* fmat_alloc(uint32_t, uint32_t);
+int fmat_reserve(fmat_t *, uint32_t);
+int fmat_map(fmat_t *, void *, uint32_t);
+int32_t fmat_append(fmat_t *, const fmat_val_t *);
+void fmat_remove(fmat_t *, uint32_t, uint32_t);
+fmat_val_t fmat_distance(const fmat_val_t *, const fmat_val_t *, uint32_t);
+
+#endif /* FEATURE_MATRIX_H_ */
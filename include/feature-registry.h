@@ -0,0 +1,65 @@
+/**
+ * \file
+ *	Feature extractor registry
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef FEATURE_REGISTRY_H_
+#define FEATURE_REGISTRY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "draw.h"
+#include "morphology.h"
+#include "moment.h"
+#include "feature-matrix.h"
+
+/*------------------------------------------------------------------------------*/
+/* Intermediates of a region, features declare the ones they need */
+#define FREG_NEED_RAW		(0x01 << 0) /* area and centroid */
+#define FREG_NEED_CENTRAL2	(0x01 << 1) /* second order central moments */
+#define FREG_NEED_CENTRAL3	(0x01 << 2) /* third order central moments */
+#define FREG_NEED_CONTOUR	(0x01 << 3) /* boundary pixel count */
+
+#define FREG_NAME_LEN		16
+
+/*------------------------------------------------------------------------------*/
+/* A region and its intermediates, each is calculated once on first need */
+typedef struct {
+    image_t image;
+    region_t region;
+    uint8_t ready;	/* FREG_NEED_* flags calculated */
+    moment_t moment;
+    uint32_t perimeter;	/* region pixels with a 4-neighbour out of the region */
+} freg_region_t;
+
+typedef fmat_val_t (*freg_get_fn_t)(const freg_region_t *);
+
+typedef struct {
+    const char *name;
+    uint8_t needs;	/* FREG_NEED_* flags */
+    uint8_t cost;	/* region passes from scratch, cascade evaluates cheaper first */
+    freg_get_fn_t get;
+} freg_feature_t;
+
+/* Selected features, column j of the feature rows is registry entry ids[j] */
+typedef struct {
+    uint32_t noe;
+    uint8_t ids[FE_CONF_MAX_FEATURES];
+} freg_set_t;
+
+/*------------------------------------------------------------------------------*/
+const char* freg_name(const freg_set_t *, uint32_t);
+void freg_print(FILE *);
+int freg_set_add(freg_set_t *, const char *);
+int freg_set_parse(freg_set_t *, const char *);
+uint8_t freg_set_equal(const freg_set_t *, const freg_set_t *);
+void freg_set_order(const freg_set_t *, uint32_t *);
+void freg_region_init(freg_region_t *, image_t, region_t);
+fmat_val_t freg_feature(freg_region_t *, const freg_set_t *, uint32_t);
+
+#endif /* FEATURE_REGISTRY_H_ */
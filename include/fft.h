@@ -0,0 +1,49 @@
+/**
+ * \file
+ *	Fast Fourier transform functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef FFT_H_
+#define FFT_H_
+
+#include <stdint.h>
+#include <complex.h>
+
+/*------------------------------------------------------------------------------*/
+/* Spectrum columns of a real row of n values */
+#define FFT_BINS(_n)	((_n) / 2 + 1)
+
+/*------------------------------------------------------------------------------*/
+/* Radix-2 complex transform of n (a power of two) values */
+typedef struct {
+    uint32_t n;
+    uint32_t *reverse;		/* bit reversed indexes */
+    double complex *twiddles;	/* n / 2 roots, e^(-2 pi i k / n) */
+} fft_t;
+
+/*
+ * Transform of real size x size tiles, rows are real transforms done with a
+ * half size complex one, the spectrum is size x FFT_BINS(size).
+ */
+typedef struct {
+    uint32_t size;
+    fft_t *half;		/* rows */
+    fft_t *full;		/* columns */
+    double complex *twiddles;	/* FFT_BINS(size) roots, e^(-2 pi i k / size) */
+    double complex *scratch;	/* size values */
+} fft2_t;
+
+/*------------------------------------------------------------------------------*/
+fft_t* fft_plan(uint32_t);
+void fft_free(fft_t **);
+void fft_run(const fft_t *, double complex *, uint8_t);
+
+fft2_t* fft2_plan(uint32_t);
+void fft2_free(fft2_t **);
+void fft2_forward(fft2_t *, const double *, double complex *);
+void fft2_inverse(fft2_t *, double complex *, double *);
+
+#endif /* FFT_H_ */
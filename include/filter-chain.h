@@ -0,0 +1,41 @@
+/**
+ * \file
+ *	Filter chain functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef FILTER_CHAIN_H_
+#define FILTER_CHAIN_H_
+
+#include <stdint.h>
+
+#include "util.h"
+#include "mask.h"
+#include "morphology.h"
+
+/*------------------------------------------------------------------------------*/
+typedef enum {
+    FCHAIN_MASK = 0,
+    FCHAIN_MORP,
+} fchain_type_t;
+
+typedef struct {
+    fchain_type_t type;
+    mask_t *mask;	/* FCHAIN_MASK stages */
+    morp_op_t op;	/* FCHAIN_MORP stages */
+} fchain_stage_t;
+
+/* Stages run in order, every one gets the output of the previous one */
+typedef struct {
+    uint32_t noe;
+    fchain_stage_t *stage;
+} fchain_t;
+
+/*------------------------------------------------------------------------------*/
+fchain_t* fchain_parse(const char *);
+void fchain_free(fchain_t **);
+int fchain_apply(const fchain_t *, image_t);
+
+#endif /* FILTER_CHAIN_H_ */
@@ -0,0 +1,54 @@
+/**
+ * \file
+ *	Sobel gradient functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef GRADIENT_H_
+#define GRADIENT_H_
+
+#include <stdint.h>
+
+#include "util.h"
+
+/*------------------------------------------------------------------------------*/
+typedef enum {
+    GRAD_NORM_L1 = 0,	/* |gx| + |gy| */
+    GRAD_NORM_L2,	/* sqrt(gx^2 + gy^2) rounded */
+} grad_norm_t;
+
+/*
+ * Gradient directions in image coordinates (x right, y down), each one
+ * covers 45 degrees around it and its opposite.
+ */
+typedef enum {
+    GRAD_DIR_0 = 0,	/* along x */
+    GRAD_DIR_45,	/* along x = y */
+    GRAD_DIR_90,	/* along y */
+    GRAD_DIR_135,	/* along x = -y */
+} grad_dir_t;
+
+/*
+ * Sobel derivatives of a gray image, their magnitude and their direction.
+ * Planes are width x height, the image border is zero.
+ */
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    grad_norm_t norm;
+    int16_t *gx;	/* -1020..1020 */
+    int16_t *gy;	/* -1020..1020 */
+    int16_t *magnitude;	/* 0..2040 with L1, 0..1443 with L2 */
+    uint8_t *direction;	/* grad_dir_t */
+} gradient_t;
+
+/*------------------------------------------------------------------------------*/
+gradient_t* grad_new(uint32_t, uint32_t, grad_norm_t);
+void grad_free(gradient_t **);
+void grad_rows(gradient_t *, image_t, uint32_t, uint32_t);
+gradient_t* grad_build(image_t, grad_norm_t);
+int grad_parse_norm(const char *, grad_norm_t *);
+
+#endif /* GRADIENT_H_ */
@@ -0,0 +1,36 @@
+/**
+ * \file
+ *	Histogram functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util.h"
+
+/*------------------------------------------------------------------------------*/
+/* Bins of an 8 bit image */
+#define HIST_U8_BINS	256
+
+/* Value v is counted in bins[v], values out of range in the first or last bin */
+typedef struct {
+    uint32_t noe;	/* number of bins */
+    uint32_t *bins;
+    uint64_t total;	/* values counted */
+} hist_t;
+
+/*------------------------------------------------------------------------------*/
+hist_t* hist_new(uint32_t);
+void hist_free(hist_t **);
+void hist_add_u8(hist_t *, const uint8_t *, size_t);
+void hist_add_i16(hist_t *, const int16_t *, size_t);
+hist_t* hist_build(image_t);
+uint32_t hist_percentile(const hist_t *, uint32_t, double);
+
+#endif /* HISTOGRAM_H_ */
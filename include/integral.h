@@ -0,0 +1,39 @@
+/**
+ * \file
+ *	Integral image (summed-area table) functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef INTEGRAL_H_
+#define INTEGRAL_H_
+
+#include <stdint.h>
+
+#include "util.h"
+#include "draw.h"
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Entry (i, j) holds the sum of the pixels above and left of pixel (i, j), the
+ * first row and column are zero. Sums are kept modulo 2^32, differences of
+ * them are exact for rectangles of less than 2^24 pixels.
+ */
+typedef struct {
+    uint32_t width;	/* of the image */
+    uint32_t height;	/* of the image */
+    uint32_t stride;	/* width + 1 */
+    uint32_t *sum;	/* (height + 1) x stride pixel sums */
+    uint64_t *squares;	/* (height + 1) x stride squared pixel sums, NULL if not built */
+} integral_t;
+
+/*------------------------------------------------------------------------------*/
+integral_t* integral_build(image_t, uint8_t);
+void integral_free(integral_t **);
+uint32_t integral_sum(const integral_t *, rectangle_t);
+uint64_t integral_squares(const integral_t *, rectangle_t);
+double integral_mean(const integral_t *, rectangle_t);
+double integral_variance(const integral_t *, rectangle_t);
+
+#endif /* INTEGRAL_H_ */
@@ -11,6 +11,6 @@
 
 #include <stdint.h>
 
-int kmeans_get_thold(uint8_t n, image_t image);
+int kmeans_get_thold(uint8_t n, image_t image, unsigned int seed);
 
 #endif /* K_MEANS_H_ */
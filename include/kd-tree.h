@@ -0,0 +1,39 @@
+/**
+ * \file
+ *	K-d tree for nearest neighbor search over feature vectors
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef KD_TREE_H_
+#define KD_TREE_H_
+
+#include <stdint.h>
+
+#include "feature-matrix.h"
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    uint32_t begin;	/* first point in tree order */
+    uint32_t end;	/* one past the last point */
+    uint32_t left;	/* child nodes, both zero for leaves */
+    uint32_t right;
+    uint32_t dim;	/* split dimension */
+    fmat_val_t split;	/* left points <= split <= right points */
+} kdtree_node_t;
+
+typedef struct {
+    uint32_t noe;	    /* number of nodes */
+    kdtree_node_t *nodes;   /* nodes[0] is the root */
+    fmat_t *points;	    /* copy of the indexed rows in tree order */
+    uint32_t *index;	    /* original row of each point */
+} kdtree_t;
+
+/*------------------------------------------------------------------------------*/
+kdtree_t* kdtree_build(const fmat_t *);
+int32_t kdtree_nearest(const kdtree_t *, const fmat_val_t *, double, fmat_val_t *);
+uint32_t kdtree_knn(const kdtree_t *, const fmat_val_t *, uint32_t, int32_t *, fmat_val_t *);
+void kdtree_free(kdtree_t **);
+
+#endif /* KD_TREE_H_ */
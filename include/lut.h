@@ -0,0 +1,39 @@
+/**
+ * \file
+ *	Lookup table point operations
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef LUT_H_
+#define LUT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util.h"
+#include "histogram.h"
+
+/*------------------------------------------------------------------------------*/
+#define LUT_SIZE	256
+
+/* Pixel value v becomes map[v] */
+typedef struct {
+    uint8_t map[LUT_SIZE];
+} lut_t;
+
+/*------------------------------------------------------------------------------*/
+void lut_identity(lut_t *);
+void lut_threshold(lut_t *, uint8_t, uint8_t, uint8_t);
+void lut_multiply(lut_t *, uint32_t);
+void lut_invert(lut_t *);
+int lut_gamma(lut_t *, double);
+void lut_equalize(lut_t *, const hist_t *);
+void lut_stretch(lut_t *, const hist_t *, double);
+void lut_compose(lut_t *, const lut_t *);
+int lut_parse(lut_t *, const char *, const hist_t *);
+void lut_apply(const lut_t *, uint8_t *, const uint8_t *, size_t);
+void lut_apply_image(const lut_t *, image_t);
+
+#endif /* LUT_H_ */
@@ -14,21 +14,46 @@
 #include "util.h"
 
 /*------------------------------------------------------------------------------*/
+/*
+ * A rank-1 mask is also kept as its factors, buf[i * width + j] is
+ * column[i] * row[j]. mask_apply runs them as two 1-D passes.
+ */
 typedef struct {
     int16_t *buf;
     uint32_t width;
     uint32_t height;
+    int16_t *row;	/* width values, NULL if the mask is not separable */
+    int16_t *column;	/* height values, NULL if the mask is not separable */
 } mask_t;
 
-#define sfree_mask(_mask) do {	\
-	if (_mask) {		\
-	    sfree(_mask->buf);	\
-	    sfree(_mask);	\
-	}			\
+#define sfree_mask(_mask) do {	    \
+	if (_mask) {		    \
+	    sfree(_mask->buf);	    \
+	    sfree(_mask->row);	    \
+	    sfree(_mask->column);   \
+	    sfree(_mask);	    \
+	}			    \
     } while (0)
 
+typedef enum {
+    MASK_PATH_AUTO = 0,	/* picked by the mask */
+    MASK_PATH_DIRECT,	/* separable or full kernels */
+    MASK_PATH_FFT,	/* overlap-add FFT tiles */
+} mask_path_t;
+
+/* Biggest mask_median radius, window counts fit in 16 bit bins */
+#define MASK_MEDIAN_MAX_RADIUS	127
+
+/* Row at a time masking, see mask_stream_row */
+typedef struct mask_stream mask_stream_t;
+
 /*------------------------------------------------------------------------------*/
 mask_t* mask_read_from_file(const char *);
 int mask_apply(image_t, mask_t);
+int mask_apply_path(image_t, mask_t, mask_path_t);
+mask_stream_t* mask_stream_new(const mask_t *, uint32_t, uint32_t);
+void mask_stream_free(mask_stream_t **);
+void mask_stream_row(mask_stream_t *, const uint8_t * const *, uint32_t, uint8_t *);
+int mask_median(image_t, uint32_t);
 
 #endif /* MASK_H_ */
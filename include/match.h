@@ -0,0 +1,58 @@
+/**
+ * \file
+ *	Region to class matching functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef MATCH_H_
+#define MATCH_H_
+
+#include <stdint.h>
+
+#include "feature-matrix.h"
+#include "kd-tree.h"
+#include "quantize.h"
+
+/*------------------------------------------------------------------------------*/
+typedef enum {
+    MATCH_MODE_VOTE = 0,    /* each feature votes for its nearest class */
+    MATCH_MODE_DISTANCE,    /* nearest class by full feature vector distance */
+    MATCH_MODE_APPROX,	    /* distance mode with approximate index search */
+    MATCH_MODE_KNN,	    /* vote of the nearest training samples */
+    MATCH_MODE_CASCADE,	    /* vote mode, stops once the winner is decided */
+} match_mode_t;
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    int32_t index;	    /* matched class index, -1 if not identified */
+    double score;	    /* votes in vote and knn modes, distance otherwise */
+} match_t;
+
+/* Returns feature j of the region being matched, see match_cascade */
+typedef fmat_val_t (*match_feature_fn_t)(void *, uint32_t);
+
+/*------------------------------------------------------------------------------*/
+/* Built once over the class matrix, queries are sublinear in the class count */
+typedef struct {
+    uint32_t noe;	    /* indexed classes */
+    uint32_t cols;	    /* features */
+    fmat_val_t *sorted;	    /* cols x noe, every feature sorted ascending */
+    uint32_t *order;	    /* cols x noe, class of each sorted value */
+    kdtree_t *tree;	    /* whole feature vector index */
+} match_index_t;
+
+/*------------------------------------------------------------------------------*/
+int match_mode_from_str(const char *, match_mode_t *);
+match_index_t* match_index_build(const fmat_t *);
+void match_index_free(match_index_t **);
+int match_regions(const fmat_t *, const fmat_t *, const match_index_t *, match_mode_t,
+	double, match_t *);
+int match_knn(const fmat_t *, const kdtree_t *, const uint32_t *, uint32_t, double, match_t *);
+int match_cascade(const match_index_t *, const uint32_t *, match_feature_fn_t, void *, double,
+	match_t *, uint32_t *);
+int match_knn_quant(const fmat_t *, const qmat_t *, const fmat_t *, const uint32_t *, uint32_t,
+	double, match_t *);
+
+#endif /* MATCH_H_ */
@@ -14,7 +14,21 @@
 #include "util.h"
 #include "draw.h"
 
+/*------------------------------------------------------------------------------*/
+#define MOMENT_MAX_ORDER    3
+
+/*------------------------------------------------------------------------------*/
+/* Moments of a region, each pass fills the ones it calculates */
+typedef struct {
+    double m00, m10, m01;   /* raw moments, m00 is the area */
+    double mu[MOMENT_MAX_ORDER + 1][MOMENT_MAX_ORDER + 1]; /* central, p + q <= order */
+    uint8_t order;	    /* highest central order calculated */
+} moment_t;
+
 /*------------------------------------------------------------------------------*/
 double moment_normalized_central(image_t, region_t, uint8_t, uint8_t);
+void moment_raw(image_t, region_t, moment_t *);
+void moment_central(image_t, region_t, uint8_t, moment_t *);
+double moment_normalized(const moment_t *, uint8_t, uint8_t);
 
 #endif /* MOMENT_H_ */
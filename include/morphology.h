@@ -26,6 +26,16 @@ typedef struct {
 } regions_t;
 
 /*------------------------------------------------------------------------------*/
+/* Input rows below an output row that morp_row reads */
+#define MORP_ROWS_BELOW	2
+
+typedef enum {
+    MORP_DILATION = 0,
+    MORP_EROSION,
+} morp_op_t;
+
+/*------------------------------------------------------------------------------*/
+void morp_row(morp_op_t, const uint8_t * const *, uint32_t, uint32_t, uint32_t, uint8_t *);
 int morp_apply_dilation(image_t);
 int morp_apply_erosion(image_t);
 int morp_apply_open(image_t);
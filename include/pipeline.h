@@ -0,0 +1,65 @@
+/**
+ * \file
+ *	In memory image pipelines
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdint.h>
+
+#include "util.h"
+#include "morphology.h"
+#include "feature-matrix.h"
+
+/*------------------------------------------------------------------------------*/
+#define PIPE_NAME_LEN	32
+#define PIPE_MAX_INPUTS	2
+
+typedef enum {
+    PIPE_LOAD = 0,
+    PIPE_INTENSITY,
+    PIPE_THRESHOLD,
+    PIPE_MORPH,
+    PIPE_MEDIAN,
+    PIPE_MASK,
+    PIPE_LABEL,
+    PIPE_FEATURES,
+    PIPE_CLASSIFY,
+    PIPE_DRAW,
+    PIPE_SAVE,
+} pipe_op_t;
+
+/*
+ * A node reads the values of earlier nodes, so the nodes in file order are a
+ * topological order of the graph. The value lives from the run of the node to
+ * the run of its last user.
+ */
+typedef struct {
+    pipe_op_t op;
+    char name[PIPE_NAME_LEN];	/* empty for save */
+    uint32_t input[PIPE_MAX_INPUTS]; /* earlier nodes */
+    char *arg;			/* file, operation or number */
+    uint32_t users;		/* nodes reading the value */
+    uint32_t pending;		/* users left to run */
+    image_t *image;		/* bmp, gray or labelled image */
+    regions_t regions;		/* of the labelled image */
+    fmat_t *features;		/* a row per region */
+} pipe_node_t;
+
+typedef struct {
+    uint32_t noe;
+    uint32_t capacity;
+    pipe_node_t *node;
+    const char *input;		/* image loaded by 'load <name> -' while running */
+} pipeline_t;
+
+/*------------------------------------------------------------------------------*/
+pipeline_t* pipe_load(const char *);
+int pipe_run(pipeline_t *, const char *);
+void pipe_free(pipeline_t **);
+
+#endif /* PIPELINE_H_ */
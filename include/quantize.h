@@ -0,0 +1,47 @@
+/**
+ * \file
+ *	Quantized feature matrix functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef QUANTIZE_H_
+#define QUANTIZE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "feature-matrix.h"
+
+/*------------------------------------------------------------------------------*/
+/* Codes in a kernel chunk, rows are padded up to a multiple of it */
+#define QMAT_CHUNK	8
+/* Widest supported row, queries are converted on the stack */
+#define QMAT_MAX_COLS	64
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Every value is stored as an 8 or 16 bit code of its column range:
+ *   value ~= offset[j] + code * scale[j]
+ */
+typedef struct {
+    uint32_t rows;	/* number of rows */
+    uint32_t cols;	/* number of values in a row */
+    uint32_t stride;	/* distance between rows in codes */
+    uint8_t bits;	/* 8 or 16 */
+    uint8_t mapped;	/* codes, offsets and scales are in a db mapping, never freed */
+    void *data;		/* rows x stride uint8_t or uint16_t codes */
+    double *offset;	/* stride values, column minimums */
+    double *scale;	/* stride values, column range per code step */
+    float *weight;	/* stride values, scale used by the kernels, zero on padding */
+} qmat_t;
+
+/*------------------------------------------------------------------------------*/
+qmat_t* qmat_build(const fmat_t *, uint8_t);
+qmat_t* qmat_map(void *, double *, double *, uint32_t, uint32_t, uint8_t);
+void qmat_free(qmat_t **);
+size_t qmat_size(const qmat_t *);
+uint32_t qmat_knn(const qmat_t *, const fmat_val_t *, uint32_t, int32_t *, float *);
+
+#endif /* QUANTIZE_H_ */
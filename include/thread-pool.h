@@ -0,0 +1,23 @@
+/**
+ * \file
+ *	Thread pool with work stealing
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <stdint.h>
+
+/*------------------------------------------------------------------------------*/
+/* Job callback, called once for each index in [0, noe). Returns zero on success. */
+typedef int (*tpool_job_t)(void *, uint32_t);
+
+/*------------------------------------------------------------------------------*/
+uint32_t tpool_get_threads(void);
+uint8_t tpool_in_worker(void);
+int tpool_run(uint32_t, const uint64_t *, tpool_job_t, void *);
+
+#endif /* THREAD_POOL_H_ */
@@ -10,6 +10,7 @@
 #define UTIL_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
 /*------------------------------------------------------------------------------*/
 #define sfree(_p) do {	    \
@@ -69,9 +70,15 @@ struct str_node {
 };
 typedef struct str_node str_node_t;
 
-str_node_t* util_sl_insert(str_node_t **, char *);
+str_node_t* util_sl_insert(str_node_t **, str_node_t **, char *);
 void util_sl_free(str_node_t **);
 
+/*------------------------------------------------------------------------------*/
+#define UTIL_FNV1A_INIT	    0xcbf29ce484222325ULL
+#define UTIL_FNV1A_PRIME    0x100000001b3ULL
+
+uint64_t util_fnv1a(const void *, size_t, uint64_t);
+
 /*------------------------------------------------------------------------------*/
 int plot_histogram(const uint32_t* const);
 
@@ -7,12 +7,27 @@
 
 /*------------------------------------------------------------------------------*/
 #define NBR_CONF_HFL		4 /* Check nbr_hfl in morphology.c for more detail */
+#define CV_CONF_MEDIAN_RADIUS	0 /* Region denoise median radius, 0 applies open instead */
 
 /*------------------------------------------------------------------------------*/
 #define FE_MATCH_EPSILON	0.001
+#define FE_CONF_KNN_K		5 /* Neighbor count of the knn matching */
+#define MATCH_CONF_RERANK	4 /* Quantized knn re-ranks this many candidates per neighbor */
 
 /*------------------------------------------------------------------------------*/
-#define SUPPORTED_FEATURES_NOE	7 /* In any changes, update _fe_get function too. */
+#define TPOOL_CONF_THREADS	0 /* Worker threads, 0 uses the online cpu count */
+#define CV_CONF_LEARN_BATCH	256 /* Images in flight while learning, bounds memory */
+#define CV_CONF_BENCH_RUNS	100 /* Matching runs timed by '-f bench' */
+#define CV_CONF_MASK_BENCH_RUNS	3 /* Runs of a mask timed by -B, the fastest counts */
+#define DRAW_CONF_TILE_ROWS	64 /* Image rows of a display list tile */
+#define CANNY_CONF_HIGH_PERCENTILE 0.8 /* Thinned edge magnitudes below the high threshold */
+#define CANNY_CONF_LOW_RATIO	0.4 /* Low threshold over the high one */
+#define MASK_CONF_FFT_MIN_AREA	169 /* Non-separable masks run on FFT tiles from 13x13, see -B */
+
+/*------------------------------------------------------------------------------*/
+#define FE_CONF_MAX_FEATURES	16 /* Widest feature set, see feature-registry.c */
+#define FE_CONF_FEATURES	"hu1,hu2,hu3,hu4,hu5,hu6,hu7" /* Default '-F' selection */
+#define FE_CONF_FLOAT32		0 /* Store features as float instead of double */
 
 /*------------------------------------------------------------------------------*/
 #define BINARY_SCALE_IMAGE_PATH	    "images/binary.bmp"
@@ -21,6 +36,10 @@
 #define CROP_IMAGE_PATH		    "images/cropped.bmp"
 #define MASK_IMAGE_PATH		    "images/mask.bmp"
 #define MORP_TESTS_IMAGE_PATH	    "images/morphology.bmp"
+#define CHAIN_IMAGE_PATH	    "images/chain.bmp"
+#define GRADIENT_IMAGE_PATH	    "images/gradient.bmp"
+#define CANNY_IMAGE_PATH	    "images/canny.bmp"
+#define POINT_IMAGE_PATH	    "images/point.bmp"
 #define REGIONS_IMAGE_PATH	    "images/regions.bmp"
 
 #define FE_SINGLE_RESULT_PATH	    "db/single-result.txt"
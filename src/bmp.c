@@ -104,7 +104,8 @@ int bmp_save(const char *filename, image_t image)
     /* initialize */
     memset(&bmp_file_header, 0, sizeof(bitmap_file_header_t));
     memset(&bmp_info_header, 0, sizeof(bitmap_info_header_t));
-    size = image.width * image.height * image.cb;
+    /* Rows keep their padding */
+    size = bmp_stride(image) * image.height;
 
     /* fill headers */
     bmp_file_header.type = BITMAP_FILE_TYPE;
@@ -142,8 +143,40 @@ success:
     return ret;
 }
 
+/*------------------------------------------------------------------------------*/
+/*
+ * Bytes between two rows of the bmp data, rows are padded to 4 bytes.
+ */
+uint32_t bmp_stride(image_t image)
+{
+    return (image.width * image.cb + sizeof(uint32_t) - 1) / sizeof(uint32_t) *
+	sizeof(uint32_t);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Layout of the bmp data for the draw functions, they can draw into it
+ * without converting to rgb and back.
+ */
+void bmp_draw_format(image_t image, draw_format_t *format)
+{
+    format->stride = bmp_stride(image);
+    format->bottom_up = 1;
+    format->bgr = 1;
+}
+
 /*------------------------------------------------------------------------------*/
 image_t* bmp_convert_to_intensity(image_t image)
+{
+    return bmp_convert_to_intensity_lut(image, NULL);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Converts to intensity and maps every row through lut while it is still in
+ * the cache, lut may be NULL.
+ */
+image_t* bmp_convert_to_intensity_lut(image_t image, const lut_t *lut)
 {
     uint32_t row = 0, column = 0, padded_width = 0, buf_pos = 0, new_pos = 0;
     image_t *new_image = NULL;
@@ -175,6 +208,10 @@ image_t* bmp_convert_to_intensity(image_t image)
 	    new_image->buf[new_pos] = (uint8_t)((image.buf[buf_pos + 2] +
 			image.buf[buf_pos + 1] + image.buf[buf_pos]) / 3);
 	}
+	if (lut) {
+	    new_pos = row * image.width;
+	    lut_apply(lut, &new_image->buf[new_pos], &new_image->buf[new_pos], image.width);
+	}
     }
 
     new_image->width = image.width;
@@ -192,7 +229,19 @@ success:
 /*------------------------------------------------------------------------------*/
 image_t* bmp_convert_from_intensity(image_t image)
 {
-    uint32_t row = 0, column = 0, padded_width = 0, buf_pos = 0, new_pos = 0;
+    return bmp_convert_from_intensity_lut(image, NULL);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Converts from intensity, every row is mapped through lut into a line buffer
+ * before it is spread to the channels, lut may be NULL.
+ */
+image_t* bmp_convert_from_intensity_lut(image_t image, const lut_t *lut)
+{
+    uint32_t row = 0, column = 0, padded_width = 0, new_pos = 0;
+    uint8_t *line = NULL;
+    const uint8_t *src = NULL;
     image_t* new_image = NULL;
 
     LOG_DBG("image:%p\n", &image);
@@ -212,18 +261,25 @@ image_t* bmp_convert_from_intensity(image_t image)
     util_fite(((new_image->buf = (uint8_t *)malloc((new_image->size) *
 	    sizeof(uint8_t))) == NULL), LOG_ERR("Image data allocation failed\n"));
     new_image->cb = 3;
+    if (lut) {
+	util_fite(((line = (uint8_t *)malloc(image.width * sizeof(uint8_t))) == NULL),
+		LOG_ERR("Line buffer allocation failed\n"));
+    }
 
     // 8-bit to 24-bit, set RGB with same value
     for (row = 0; row < image.height; row++) {
+	src = &image.buf[row * image.width];
+	if (lut) {
+	    lut_apply(lut, line, src, image.width);
+	    src = line;
+	}
 	for (column = 0; column < image.width; column++) {
-	    /* position in original buffer */
-	    buf_pos = row * image.width + column;
 	    /* position in padded buffer */
 	    new_pos = (image.height - row - 1) * padded_width + column * new_image->cb;
 
-	    new_image->buf[new_pos] = image.buf[buf_pos];	/* blue */
-	    new_image->buf[new_pos + 1] = image.buf[buf_pos];	/* green */
-	    new_image->buf[new_pos + 2] = image.buf[buf_pos];	/* red */
+	    new_image->buf[new_pos] = src[column];	/* blue */
+	    new_image->buf[new_pos + 1] = src[column];	/* green */
+	    new_image->buf[new_pos + 2] = src[column];	/* red */
 	}
     }
 
@@ -235,6 +291,7 @@ fail:
     sfree_image(new_image);
 
 success:
+    sfree(line);
     return new_image;
 }
 
@@ -341,40 +398,40 @@ success:
 /*     ^
  *  x,height  <- y,width ->
  *     v
+ * Crops the bmp data directly, the result is bmp data too.
  */
 image_t* bmp_crop_image(image_t image, rectangle_t rect)
 {
     image_t *cropped_image = NULL;
-    int32_t i = 0, j = 0, k = 0;
-    uint32_t buf_pos = 0, new_pos = 0;
+    int32_t i = 0;
+    uint32_t stride = bmp_stride(image), cropped_stride = 0;
 
     LOG_DBG("image:%p rect:%p\n", &image, &rect);
 
-    if (rect.x + rect.height >= image.height || rect.y + rect.width >= image.width) {
+    if (rect.x < 0 || rect.y < 0 || rect.width <= 0 || rect.height <= 0 ||
+	    rect.x + rect.height >= image.height || rect.y + rect.width >= image.width) {
 	LOG_ERR("Parameters are not valid for this image! [w:%u, h:%u]\n", image.width, image.height);
 	goto fail;
     }
     util_fite(((cropped_image = (image_t *)calloc(1, sizeof(image_t))) == NULL),
 	    LOG_ERR("Image allocation failed\n"));
 
-    cropped_image->size = rect.width * rect.height * image.cb;
-    util_fite(((cropped_image->buf = (uint8_t *)malloc((cropped_image->size) *
+    cropped_image->cb = image.cb;
+    cropped_image->width = rect.width;
+    cropped_image->height = rect.height;
+    cropped_stride = bmp_stride(*cropped_image);
+    cropped_image->size = rect.height * cropped_stride;
+    /* Padding bytes stay zero */
+    util_fite(((cropped_image->buf = (uint8_t *)calloc(cropped_image->size,
 		sizeof(uint8_t))) == NULL), LOG_ERR("Image data allocation failed\n"));
 
+    /* Rows are upside down in both */
     for (i = 0; i < rect.height; i++) {
-	for (j = 0; j < rect.width; j++) {
-	    buf_pos = (i + rect.x) * image.width * image.cb + (j + rect.y) * image.cb;
-	    new_pos = i * rect.width * image.cb + j * image.cb;
-
-	    for (k = 0; k < image.cb; k++) {
-		cropped_image->buf[new_pos + k] = image.buf[buf_pos + k];
-	    }
-	}
+	memcpy(&cropped_image->buf[(rect.height - i - 1) * cropped_stride],
+		&image.buf[(image.height - (rect.x + i) - 1) * stride + rect.y * image.cb],
+		rect.width * image.cb);
     }
 
-    cropped_image->cb = image.cb;
-    cropped_image->width = rect.width;
-    cropped_image->height = rect.height;
     goto success;
 
 fail:
@@ -383,4 +440,3 @@ fail:
 success:
     return cropped_image;
 }
-
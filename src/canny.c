@@ -0,0 +1,272 @@
+/**
+ * \file
+ *	Canny edge detector
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+#include "bmp.h"
+#include "mask.h"
+#include "gradient.h"
+#include "histogram.h"
+#include "thread-pool.h"
+#include "canny.h"
+
+#ifndef LOG_LEVEL_CONF_CANNY
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_CANNY */
+#define LOG_LEVEL LOG_LEVEL_CONF_CANNY
+#endif /* LOG_LEVEL_CONF_CANNY */
+
+/*------------------------------------------------------------------------------*/
+/* Image rows of a band, a band is smoothed, derived and thinned in cache */
+#define CANNY_BAND_ROWS	    32
+/* Magnitude bins, L2 magnitudes are at most 1443 */
+#define CANNY_BINS	    2048
+/* 5x5 binomial smoothing */
+#define CANNY_GAUSS_SIZE    5
+
+static const int16_t canny_gauss[CANNY_GAUSS_SIZE] = { 1, 4, 6, 4, 1 };
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    image_t image;		/* input */
+    const uint8_t **rows;	/* input rows */
+    const mask_t *gauss;
+    int16_t *thin;		/* magnitudes of the local maximums, zero elsewhere */
+} canny_job_t;
+
+/* Stack of pixels whose neighbors are to be checked */
+typedef struct {
+    uint32_t noe;
+    uint32_t capacity;
+    uint32_t *at;
+} canny_stack_t;
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Keeps the magnitudes of rows r0 to r1 (not included) that are not smaller
+ * than their two neighbors across the edge. mag is the band of rows from s0.
+ */
+static void _canny_thin(canny_job_t *job, const gradient_t *grad, uint32_t s0, uint32_t r0,
+	uint32_t r1)
+{
+    uint32_t r = 0, c = 0, width = job->image.width;
+    size_t at = 0;
+    int16_t m = 0, a = 0, b = 0;
+    const int16_t *mag = grad->magnitude;
+
+    r0 = (r0 < 1) ? 1 : r0;
+    r1 = (r1 > job->image.height - 1) ? job->image.height - 1 : r1;
+    for (r = r0; r < r1; r++) {
+	for (c = 1; c + 1 < width; c++) {
+	    at = (size_t)(r - s0) * width + c;
+	    if ((m = mag[at]) == 0) continue;
+	    switch (grad->direction[at]) {
+		case GRAD_DIR_0:
+		    a = mag[at - 1];
+		    b = mag[at + 1];
+		    break;
+		case GRAD_DIR_45:
+		    a = mag[at - width - 1];
+		    b = mag[at + width + 1];
+		    break;
+		case GRAD_DIR_90:
+		    a = mag[at - width];
+		    b = mag[at + width];
+		    break;
+		default:
+		    a = mag[at - width + 1];
+		    b = mag[at + width - 1];
+		    break;
+	    }
+	    /* Plateaus keep their last pixel */
+	    if (m > a && m >= b) job->thin[(size_t)r * width + c] = m;
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Smooths the rows the band gradient reads, derives and thins the band. The
+ * gradient of a row reads the smoothed rows next to it, its thinning the
+ * gradient rows next to it, so the band reads two more rows on both sides.
+ */
+static int _canny_band_job(void *arg, uint32_t band)
+{
+    int ret = 0;
+    canny_job_t *job = (canny_job_t *)arg;
+    uint32_t r = 0, width = job->image.width, height = job->image.height;
+    uint32_t r0 = band * CANNY_BAND_ROWS, r1 = 0, s0 = 0, s1 = 0;
+    image_t smooth = { .buf = NULL, .cb = 1, .width = width };
+    mask_stream_t *stream = NULL;
+    gradient_t *grad = NULL;
+
+    r1 = (r0 + CANNY_BAND_ROWS < height) ? r0 + CANNY_BAND_ROWS : height;
+    s0 = (r0 > 2) ? r0 - 2 : 0;
+    s1 = (r1 + 2 < height) ? r1 + 2 : height;
+    smooth.height = s1 - s0;
+    smooth.size = smooth.height * width;
+
+    util_fite(((smooth.buf = (uint8_t *)malloc(smooth.size)) == NULL),
+	    LOG_ERR("Smoothed band allocation failed!\n"));
+    util_fit(((stream = mask_stream_new(job->gauss, width, height)) == NULL));
+    util_fit(((grad = grad_new(width, smooth.height, GRAD_NORM_L2)) == NULL));
+
+    for (r = s0; r < s1; r++) {
+	mask_stream_row(stream, job->rows, r, &smooth.buf[(r - s0) * width]);
+    }
+    /* Band edge rows are not derived, they are image borders or not read */
+    grad_rows(grad, smooth, 0, smooth.height);
+    _canny_thin(job, grad, s0, r0, r1);
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    sfree(smooth.buf);
+    mask_stream_free(&stream);
+    grad_free(&grad);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _canny_push(canny_stack_t *stack, uint32_t at)
+{
+    int ret = 0;
+    uint32_t *grown = NULL;
+
+    if (stack->noe == stack->capacity) {
+	util_fite(((grown = (uint32_t *)realloc(stack->at,
+			    (stack->capacity * 2 + 1) * sizeof(uint32_t))) == NULL),
+		LOG_ERR("Edge stack allocation failed!\n"));
+	stack->at = grown;
+	stack->capacity = stack->capacity * 2 + 1;
+    }
+    stack->at[stack->noe++] = at;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Marks the thinned pixels from high up and the ones from low up connected to
+ * them. The pixels to follow are kept on a stack instead of recursing, so long
+ * edges do not grow the call stack.
+ */
+static int _canny_hysteresis(const int16_t *thin, image_t edges, int16_t low, int16_t high)
+{
+    int ret = 0;
+    uint32_t i = 0, at = 0, k = 0, width = edges.width;
+    const int32_t offsets[] = { -(int32_t)width - 1, -(int32_t)width, -(int32_t)width + 1,
+	-1, 1, width - 1, width, width + 1 };
+    canny_stack_t stack = { .noe = 0, .capacity = 0, .at = NULL };
+
+    memset(edges.buf, COLOR_BG, edges.size);
+    for (i = 0; i < edges.size; i++) {
+	if (thin[i] < high || edges.buf[i] == COLOR_FG) continue;
+	edges.buf[i] = COLOR_FG;
+	util_fit((_canny_push(&stack, i) != 0));
+
+	/* Thinned pixels are never on the border, their neighbors are in */
+	while (stack.noe) {
+	    at = stack.at[--stack.noe];
+	    for (k = 0; k < sizeof(offsets) / sizeof(offsets[0]); k++) {
+		if (thin[at + offsets[k]] < low || edges.buf[at + offsets[k]] == COLOR_FG) continue;
+		edges.buf[at + offsets[k]] = COLOR_FG;
+		util_fit((_canny_push(&stack, at + offsets[k]) != 0));
+	    }
+	}
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    sfree(stack.at);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Canny edges of a gray image as COLOR_FG pixels on COLOR_BG. Bands of rows
+ * are smoothed with a separable 5x5 binomial mask, derived and thinned on the
+ * thread pool. The high threshold is the high_percentile of the thinned
+ * magnitudes, the low one low_ratio of it.
+ */
+image_t* canny_detect(image_t image, double high_percentile, double low_ratio)
+{
+    uint32_t i = 0, j = 0, bands = (image.height + CANNY_BAND_ROWS - 1) / CANNY_BAND_ROWS;
+    int16_t buf[CANNY_GAUSS_SIZE * CANNY_GAUSS_SIZE], row[CANNY_GAUSS_SIZE],
+	    column[CANNY_GAUSS_SIZE];
+    int16_t low = 0, high = 0;
+    mask_t gauss = { .buf = buf, .width = CANNY_GAUSS_SIZE, .height = CANNY_GAUSS_SIZE,
+	.row = row, .column = column };
+    canny_job_t job = { .image = image, .rows = NULL, .gauss = &gauss, .thin = NULL };
+    hist_t *hist = NULL;
+    image_t *edges = NULL;
+
+    LOG_DBG("image:%ux%u high:%f low:%f\n", image.width, image.height, high_percentile,
+	    low_ratio);
+
+    util_fite((image.cb != 1), LOG_ERR("Canny needs a gray image!\n"));
+    for (i = 0; i < CANNY_GAUSS_SIZE; i++) {
+	row[i] = column[i] = canny_gauss[i];
+	for (j = 0; j < CANNY_GAUSS_SIZE; j++) {
+	    buf[i * CANNY_GAUSS_SIZE + j] = canny_gauss[i] * canny_gauss[j];
+	}
+    }
+
+    util_fite(((job.rows = (const uint8_t **)malloc(image.height * sizeof(uint8_t *))) == NULL),
+	    LOG_ERR("Canny rows allocation failed!\n"));
+    util_fite(((job.thin = (int16_t *)calloc(image.size, sizeof(int16_t))) == NULL),
+	    LOG_ERR("Canny magnitudes allocation failed!\n"));
+    util_fite(((edges = (image_t *)calloc(1, sizeof(image_t))) == NULL),
+	    LOG_ERR("Canny image allocation failed!\n"));
+    memcpy(edges, &image, sizeof(image_t));
+    util_fite(((edges->buf = (uint8_t *)malloc(image.size)) == NULL),
+	    LOG_ERR("Canny image buffer allocation failed!\n"));
+    for (i = 0; i < image.height; i++) {
+	job.rows[i] = &image.buf[i * image.width];
+    }
+
+    util_fit((tpool_run(bands, NULL, _canny_band_job, &job) != 0));
+
+    util_fit(((hist = hist_new(CANNY_BINS)) == NULL));
+    hist_add_i16(hist, job.thin, image.size);
+    high = hist_percentile(hist, 1, high_percentile);
+    low = high * low_ratio;
+    low = (low < 1) ? 1 : low;
+    LOG_DBG("thresholds low:%d high:%d\n", low, high);
+
+    util_fit((_canny_hysteresis(job.thin, *edges, low, high) != 0));
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    sfree_image(edges);
+
+success:
+    hist_free(&hist);
+    sfree(job.rows);
+    sfree(job.thin);
+    return edges;
+}
@@ -8,6 +8,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "computer-vision.h"
 #include "log.h"
@@ -15,7 +18,16 @@
 #include "k-means.h"
 #include "mask.h"
 #include "morphology.h"
+#include "filter-chain.h"
+#include "gradient.h"
+#include "canny.h"
+#include "histogram.h"
+#include "lut.h"
+#include "pipeline.h"
 #include "feature-extraction.h"
+#include "thread-pool.h"
+#include "match.h"
+#include "quantize.h"
 
 #ifndef LOG_LEVEL_CONF_CV
 #define LOG_LEVEL LOG_LEVEL_ERR
@@ -24,29 +36,32 @@
 #endif /* LOG_LEVEL_CONF_CV */
 
 /*------------------------------------------------------------------------------*/
-static image_t* _cv_get_binary_image(const char *filename)
+extern double fe_match_epsilon;	    /* defined in test.c */
+extern uint32_t fe_knn_k;	    /* defined in test.c */
+extern match_mode_t fe_match_mode;  /* defined in test.c */
+extern uint8_t cv_median_radius;   /* defined in test.c */
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Thresholds the image with k-means, initial centroids are drawn from seed.
+ */
+static image_t* _cv_get_binary_image(const char *filename, unsigned int seed)
 {
     int threshold = 0;
-    uint32_t i = 0;
     image_t *image = NULL, *intensity = NULL, *binary_image = NULL;
+    lut_t lut;
 
     LOG_DBG("filename:'%s'\n", filename);
 
     util_fit(((image = bmp_load(filename)) == NULL));
     util_fit(((intensity = bmp_convert_to_intensity(*image)) == NULL));
-    util_fit(((threshold = kmeans_get_thold(2, *intensity)) < 0));
-
-    /* Allocate image and copy size fields into it.
-     * Ignore the buf pointer we will set it before use */
-    util_fite(((binary_image = (image_t *)calloc(1, sizeof(image_t))) == NULL),
-	    LOG_ERR("BinaryImage allocation failed!\n"));
-    memcpy(binary_image, intensity, sizeof(image_t));
-
-    util_fite(((binary_image->buf = (uint8_t *)malloc(binary_image->size *
-	    sizeof(uint8_t))) == NULL), LOG_ERR("BinaryImage data allocation failed!\n"));
-    for (i = 0; i < binary_image->size; i++) {
-	binary_image->buf[i] = (intensity->buf[i] > threshold) ? COLOR_BG : COLOR_FG;
-    }
+    util_fit(((threshold = kmeans_get_thold(2, *intensity, seed)) < 0));
+
+    /* The intensity image is not needed anymore, threshold it in place */
+    lut_threshold(&lut, threshold, COLOR_FG, COLOR_BG);
+    lut_apply_image(&lut, *intensity);
+    binary_image = intensity;
+    intensity = NULL;
 
     goto success;
 
@@ -61,17 +76,22 @@ success:
 }
 
 /*------------------------------------------------------------------------------*/
-static image_t* _cv_get_regions(const char *input_filename, regions_t *regions)
+static image_t* _cv_get_regions(const char *input_filename, regions_t *regions,
+	unsigned int seed)
 {
     image_t *binary_image = NULL, *regions_image = NULL;
 
     LOG_DBG("input_filename:'%s' regions:%p\n",
 	    input_filename, regions);
 
-    util_fit(((binary_image = _cv_get_binary_image(input_filename)) == NULL));
+    util_fit(((binary_image = _cv_get_binary_image(input_filename, seed)) == NULL));
 
-    /* First apply open to eliminate noise */
-    util_fit((morp_apply(*binary_image, "open") != 0));
+    /* First eliminate noise, the median keeps the thin strokes open erodes */
+    if (cv_median_radius) {
+	util_fit((mask_median(*binary_image, cv_median_radius) != 0));
+    } else {
+	util_fit((morp_apply(*binary_image, "open") != 0));
+    }
     util_fit(((regions_image = morp_identify_regions(*binary_image, regions)) == NULL));
 
     goto success;
@@ -85,6 +105,131 @@ success:
     return regions_image;
 }
 
+/*------------------------------------------------------------------------------*/
+/* One image of the class image list to learn */
+typedef struct {
+    const char *filename;
+    class_t *_class;		/* class to fold the image into */
+    unsigned int seed;		/* k-means seed, drawn in list order */
+    uint64_t cost;		/* file size, larger images are started first */
+    const freg_set_t *set;	/* features to calculate, the ones of the classes */
+    fmat_t *features;		/* regions x set->noe, set by the job */
+    learned_file_t state;	/* file state at learning, set by the job */
+} cv_learn_job_t;
+
+typedef struct {
+    cv_learn_job_t *jobs;
+    uint32_t noe;
+    uint32_t capacity;
+} cv_learn_t;
+
+/*------------------------------------------------------------------------------*/
+static int _cv_learn_add(cv_learn_t *learn, const char *filename, class_t *_class)
+{
+    int ret = 0;
+    struct stat st;
+    cv_learn_job_t *jobs = NULL, *job = NULL;
+
+    if (learn->noe == learn->capacity) {
+	util_fite(((jobs = (cv_learn_job_t *)realloc(learn->jobs,
+			    (learn->capacity * 2 + 1) * sizeof(cv_learn_job_t))) == NULL),
+		LOG_ERR("Learn jobs allocation failed!\n"));
+	learn->jobs = jobs;
+	learn->capacity = learn->capacity * 2 + 1;
+    }
+
+    job = &learn->jobs[learn->noe++];
+    memset(job, 0, sizeof(cv_learn_job_t));
+    job->filename = filename;
+    job->_class = _class;
+    /* Seeds follow the list order, the thresholds do not depend on the threads */
+    job->seed = rand();
+    job->cost = (stat(filename, &st) == 0) ? st.st_size : 0;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _cv_learn_job(void *arg, uint32_t index)
+{
+    int ret = 0;
+    cv_learn_job_t *job = &((cv_learn_job_t *)arg)[index];
+    image_t *regions_image = NULL;
+    regions_t regions = { .noe = 0, .region = NULL };
+
+    util_fit(((regions_image = _cv_get_regions(job->filename, &regions, job->seed)) == NULL));
+    util_fit(((job->features = fe_get_all(*regions_image, regions, job->set)) == NULL));
+    util_fit((fe_learned_state(job->filename, &job->state) != 0));
+
+    goto success;
+
+fail:
+    LOG_ERR("'%s' could not be learned!\n", job->filename);
+    ret = -1;
+
+success:
+    sfree_image(regions_image);
+    sfree(regions.region);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Learns the images on the thread pool, at most CV_CONF_LEARN_BATCH of them are
+ * in flight. Features are folded into the classes in list order, so the db is
+ * the same for any thread count.
+ */
+static int _cv_learn(classes_t *classes, cv_learn_t *learn)
+{
+    int ret = 0;
+    uint32_t begin = 0, noe = 0, i = 0;
+    uint64_t *costs = NULL;
+    cv_learn_job_t *jobs = NULL;
+
+    util_sit((learn->noe == 0));
+    util_fite(((costs = (uint64_t *)malloc(CV_CONF_LEARN_BATCH * sizeof(uint64_t))) == NULL),
+	    LOG_ERR("Costs allocation failed!\n"));
+
+    for (begin = 0; begin < learn->noe; begin += noe) {
+	jobs = &learn->jobs[begin];
+	noe = learn->noe - begin;
+	if (noe > CV_CONF_LEARN_BATCH) noe = CV_CONF_LEARN_BATCH;
+
+	for (i = 0; i < noe; i++) {
+	    costs[i] = jobs[i].cost;
+	    jobs[i].set = &classes->set;
+	}
+	util_fit((tpool_run(noe, costs, _cv_learn_job, jobs) != 0));
+
+	for (i = 0; i < noe; i++) {
+	    util_fit((fe_classes_fold(classes, jobs[i]._class, &jobs[i].state,
+			    jobs[i].features) != 0));
+	    LOG_DBG("Class '%s' updated with '%s', %u regions\n", jobs[i]._class->name,
+		    jobs[i].filename, jobs[i].features->rows);
+	    sfree_fmat(jobs[i].features);
+	}
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+    for (i = 0; i < noe; i++) {
+	sfree_fmat(jobs[i].features);
+    }
+
+success:
+    sfree(costs);
+    return ret;
+}
+
 /*------------------------------------------------------------------------------*/
 int cv_test_bmp_file(const char *filename)
 {
@@ -117,7 +262,7 @@ int cv_convert_binary(const char *input_filename, const char *output_filename)
 
     LOG_DBG("input_filename:'%s' output_image:'%s'\n", input_filename, output_filename);
 
-    util_fit(((binary_image = _cv_get_binary_image(input_filename)) == NULL));
+    util_fit(((binary_image = _cv_get_binary_image(input_filename, rand())) == NULL));
     util_fit(((binary_image_bmp = bmp_convert_from_intensity(*binary_image)) == NULL));
     util_fit((bmp_save(output_filename, *binary_image_bmp) != 0));
 
@@ -170,20 +315,21 @@ int cv_draw(const char *input_filename, const char *output_filename,
 	const char *draw_filename)
 {
     int ret = 0;
-    image_t *image = NULL, *rgb_image = NULL, *drawed_image = NULL;
+    image_t *image = NULL;
+    draw_format_t format;
 
     output_filename = (output_filename != NULL) ? output_filename : DRAW_TEST_IMAGE_PATH;
 
     LOG_DBG("input_filename:'%s' output_image:'%s' draw_filename:'%s'\n",
 	    input_filename, output_filename, draw_filename);
 
+    /* Shapes are drawn into the bmp data as it is */
     util_fit(((image = bmp_load(input_filename)) == NULL));
-    util_fit(((rgb_image = bmp_convert_to_rgb(*image)) == NULL));
+    bmp_draw_format(*image, &format);
 
-    util_fit((draw_multi_shapes(*rgb_image, draw_filename, 0) != 0));
+    util_fit((draw_multi_shapes(*image, &format, draw_filename, 0) != 0));
 
-    util_fit(((drawed_image = bmp_convert_from_rgb(*rgb_image)) == NULL));
-    util_fit(((bmp_save(output_filename, *drawed_image)) != 0));
+    util_fit(((bmp_save(output_filename, *image)) != 0));
 
     LOG_INFO("'%s' succesfully saved!\n", output_filename);
     goto success;
@@ -194,8 +340,6 @@ fail:
 
 success:
     sfree_image(image);
-    sfree_image(rgb_image);
-    sfree_image(drawed_image);
     return ret;
 }
 
@@ -203,8 +347,7 @@ success:
 int cv_crop_image(const char *input_filename, const char *output_filename, rectangle_t rect)
 {
     int ret = 0;
-    image_t *image = NULL, *rgb_image = NULL, *cropped_image = NULL,
-	    *cropped_image_bmp = NULL;
+    image_t *image = NULL, *cropped_image = NULL;
 
     output_filename = (output_filename != NULL) ? output_filename : CROP_IMAGE_PATH;
 
@@ -212,12 +355,10 @@ int cv_crop_image(const char *input_filename, const char *output_filename, recta
 	    input_filename, output_filename, rect.x, rect.y, rect.width, rect.height);
 
     util_fit(((image = bmp_load(input_filename)) == NULL));
-    util_fit(((rgb_image = bmp_convert_to_rgb(*image)) == NULL));
 
-    util_fit(((cropped_image = bmp_crop_image(*rgb_image, rect)) == NULL));
+    util_fit(((cropped_image = bmp_crop_image(*image, rect)) == NULL));
 
-    util_fit(((cropped_image_bmp = bmp_convert_from_rgb(*cropped_image)) == NULL));
-    util_fit(((bmp_save(output_filename, *cropped_image_bmp)) != 0));
+    util_fit(((bmp_save(output_filename, *cropped_image)) != 0));
 
     LOG_INFO("'%s' succesfully saved!\n", output_filename);
     goto success;
@@ -228,9 +369,7 @@ fail:
 
 success:
     sfree_image(image);
-    sfree_image(rgb_image);
     sfree_image(cropped_image);
-    sfree_image(cropped_image_bmp);
     return ret;
 }
 
@@ -272,6 +411,198 @@ success:
     return ret;
 }
 
+/*------------------------------------------------------------------------------*/
+/*
+ * Runs the comma separated masks and morphology operations on the intensity
+ * of the input in one pass, see fchain_apply.
+ */
+int cv_apply_chain(const char *input_filename, const char *output_filename,
+	const char *chain_list)
+{
+    int ret = 0;
+    image_t *image = NULL, *intensity = NULL, *filtered_image = NULL;
+    fchain_t *chain = NULL;
+
+    output_filename = (output_filename != NULL) ? output_filename : CHAIN_IMAGE_PATH;
+
+    LOG_DBG("input_filename:'%s' output_filename:'%s' chain_list:'%s'\n",
+	    input_filename, output_filename, chain_list);
+
+    util_fit(((chain = fchain_parse(chain_list)) == NULL));
+    util_fit(((image = bmp_load(input_filename)) == NULL));
+    util_fit(((intensity = bmp_convert_to_intensity(*image)) == NULL));
+
+    util_fit((fchain_apply(chain, *intensity) != 0));
+
+    util_fit(((filtered_image = bmp_convert_from_intensity(*intensity)) == NULL));
+    util_fit(((bmp_save(output_filename, *filtered_image)) != 0));
+
+    LOG_INFO("'%s' succesfully saved!\n", output_filename);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    fchain_free(&chain);
+    sfree_image(image);
+    sfree_image(intensity);
+    sfree_image(filtered_image);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Saves the Sobel gradient magnitude of the input, stretched so that the
+ * strongest edge is white.
+ */
+int cv_gradient(const char *input_filename, const char *output_filename, const char *norm_name)
+{
+    int ret = 0;
+    uint32_t i = 0;
+    int16_t max = 0;
+    grad_norm_t norm = GRAD_NORM_L1;
+    image_t *image = NULL, *intensity = NULL, *gradient_image = NULL;
+    gradient_t *grad = NULL;
+
+    output_filename = (output_filename != NULL) ? output_filename : GRADIENT_IMAGE_PATH;
+
+    LOG_DBG("input_filename:'%s' output_filename:'%s' norm:'%s'\n",
+	    input_filename, output_filename, norm_name);
+
+    util_fit((grad_parse_norm(norm_name, &norm) != 0));
+    util_fit(((image = bmp_load(input_filename)) == NULL));
+    util_fit(((intensity = bmp_convert_to_intensity(*image)) == NULL));
+    util_fit(((grad = grad_build(*intensity, norm)) == NULL));
+
+    for (i = 0; i < intensity->size; i++) {
+	if (grad->magnitude[i] > max) max = grad->magnitude[i];
+    }
+    for (i = 0; i < intensity->size; i++) {
+	intensity->buf[i] = max ? grad->magnitude[i] * UINT8_MAX / max : 0;
+    }
+
+    util_fit(((gradient_image = bmp_convert_from_intensity(*intensity)) == NULL));
+    util_fit(((bmp_save(output_filename, *gradient_image)) != 0));
+
+    LOG_INFO("'%s' succesfully saved!\n", output_filename);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    grad_free(&grad);
+    sfree_image(image);
+    sfree_image(intensity);
+    sfree_image(gradient_image);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+int cv_canny(const char *input_filename, const char *output_filename)
+{
+    int ret = 0;
+    image_t *image = NULL, *intensity = NULL, *edges = NULL, *edges_image = NULL;
+
+    output_filename = (output_filename != NULL) ? output_filename : CANNY_IMAGE_PATH;
+
+    LOG_DBG("input_filename:'%s' output_filename:'%s'\n", input_filename, output_filename);
+
+    util_fit(((image = bmp_load(input_filename)) == NULL));
+    util_fit(((intensity = bmp_convert_to_intensity(*image)) == NULL));
+    util_fit(((edges = canny_detect(*intensity, CANNY_CONF_HIGH_PERCENTILE,
+			    CANNY_CONF_LOW_RATIO)) == NULL));
+
+    util_fit(((edges_image = bmp_convert_from_intensity(*edges)) == NULL));
+    util_fit(((bmp_save(output_filename, *edges_image)) != 0));
+
+    LOG_INFO("'%s' succesfully saved!\n", output_filename);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree_image(image);
+    sfree_image(intensity);
+    sfree_image(edges);
+    sfree_image(edges_image);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Collapses the point operation list into one lut, it is applied while the
+ * gray scale image is converted back. The histogram operations cost one
+ * histogram of the input.
+ */
+int cv_point_operation(const char *input_filename, const char *output_filename,
+	const char *list)
+{
+    int ret = 0;
+    image_t *image = NULL, *intensity = NULL, *point_image = NULL;
+    hist_t *hist = NULL;
+    lut_t lut;
+
+    output_filename = (output_filename != NULL) ? output_filename : POINT_IMAGE_PATH;
+
+    LOG_DBG("input_filename:'%s' output_filename:'%s' list:'%s'\n",
+	    input_filename, output_filename, list);
+
+    util_fit(((image = bmp_load(input_filename)) == NULL));
+    util_fit(((intensity = bmp_convert_to_intensity(*image)) == NULL));
+    util_fit(((hist = hist_build(*intensity)) == NULL));
+    util_fit((lut_parse(&lut, list, hist) != 0));
+
+    util_fit(((point_image = bmp_convert_from_intensity_lut(*intensity, &lut)) == NULL));
+    util_fit(((bmp_save(output_filename, *point_image)) != 0));
+
+    LOG_INFO("'%s' succesfully saved!\n", output_filename);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    hist_free(&hist);
+    sfree_image(image);
+    sfree_image(intensity);
+    sfree_image(point_image);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Runs the pipeline file on the input image, the images are passed between
+ * the operations in memory and only its save operations write files.
+ */
+int cv_pipeline(const char *input_filename, const char *pipeline_filename)
+{
+    int ret = 0;
+    pipeline_t *pipe = NULL;
+
+    LOG_DBG("input_filename:'%s' pipeline_filename:'%s'\n", input_filename, pipeline_filename);
+
+    util_fit(((pipe = pipe_load(pipeline_filename)) == NULL));
+    util_fit((pipe_run(pipe, input_filename) != 0));
+
+    LOG_INFO("'%s' succesfully run!\n", pipeline_filename);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    pipe_free(&pipe);
+    return ret;
+}
+
 /*------------------------------------------------------------------------------*/
 int cv_apply_morphology(const char *input_filename, const char *output_filename,
 	const char *morp)
@@ -284,7 +615,7 @@ int cv_apply_morphology(const char *input_filename, const char *output_filename,
     LOG_DBG("input_filename:'%s' output_filename:'%s' morp:'%s'\n",
 	    input_filename, output_filename, morp);
 
-    util_fit(((binary_image = _cv_get_binary_image(input_filename)) == NULL));
+    util_fit(((binary_image = _cv_get_binary_image(input_filename, rand())) == NULL));
 
     util_fit((morp_apply(*binary_image, morp) != 0));
 
@@ -316,7 +647,7 @@ int cv_identify_regions(const char *input_filename, const char *output_filename)
     LOG_DBG("input_filename:'%s' output_filename:'%s'\n",
 	    input_filename, output_filename);
 
-    util_fit(((regions_image = _cv_get_regions(input_filename, &regions)) == NULL));
+    util_fit(((regions_image = _cv_get_regions(input_filename, &regions, rand())) == NULL));
     /* scale colors */
     morp_colorize_regions(*regions_image, regions.noe);
 
@@ -344,15 +675,17 @@ int cv_feature_extraction_single(const char *input_filename, const char *output_
     int ret = 0;
     image_t *regions_image = NULL;
     regions_t regions = { .noe = 0, .region = NULL };
-    features_t *features_avg = NULL;
+    fmat_t *features_avg = NULL;
+    freg_set_t set;
 
     output_filename = (output_filename != NULL) ? output_filename : FE_SINGLE_RESULT_PATH;
 
     LOG_DBG("input_filename:'%s' output_filename:'%s'\n",
 	    input_filename, output_filename);
 
-    util_fit(((regions_image = _cv_get_regions(input_filename, &regions)) == NULL));
-    util_fit(((features_avg = fe_get_avg(*regions_image, regions)) == NULL));
+    util_fit((fe_features_selected(&set) != 0));
+    util_fit(((regions_image = _cv_get_regions(input_filename, &regions, rand())) == NULL));
+    util_fit(((features_avg = fe_get_avg(*regions_image, regions, &set)) == NULL));
     util_fit((fe_save(output_filename, *features_avg) != 0));
 
     LOG_INFO("'%s' succesfully saved!\n", output_filename);
@@ -365,7 +698,7 @@ fail:
 success:
     sfree_image(regions_image);
     sfree(regions.region);
-    sfree_features(features_avg);
+    sfree_fmat(features_avg);
     return ret;
 }
 
@@ -373,10 +706,10 @@ success:
 int cv_feature_extraction_multi(const char *input_filename, const char *output_filename)
 {
     int ret = 0;
-    class_t *classes = NULL, *current_class = NULL;
+    classes_t *classes = NULL;
+    class_t *current_class = NULL;
     str_node_t *current_filename = NULL;
-    image_t *regions_image = NULL;
-    regions_t regions = { .noe = 0, .region = NULL };
+    cv_learn_t learn = { .jobs = NULL, .noe = 0, .capacity = 0 };
 
     output_filename = (output_filename != NULL) ? output_filename : FE_MULTI_RESULT_PATH;
 
@@ -387,22 +720,17 @@ int cv_feature_extraction_multi(const char *input_filename, const char *output_f
     util_fit(((classes = fe_load_classes(input_filename)) == NULL));
 
     /* Calculate each class */
-    current_class = classes;
+    current_class = classes->head;
     while (current_class != NULL) {
 	current_filename = current_class->files;
 	while (current_filename != NULL) {
-	    util_fit(((regions_image = _cv_get_regions(current_filename->str, &regions)) == NULL));
-
-	    /* update class features with regions */
-	    util_fit((fe_classes_update(current_class, *regions_image, regions) != 0));
-	    LOG_ERR("Class '%s' updated %p\n", current_class->name, current_class->features->feature);
-
-	    sfree_image(regions_image);
-	    sfree(regions.region);
+	    util_fit((_cv_learn_add(&learn, current_filename->str, current_class) != 0));
 	    current_filename = current_filename->next;
 	}
 	current_class = current_class->next;
     }
+    util_fit((_cv_learn(classes, &learn) != 0));
+
     /* Save calsses db to file */
     util_fit((fe_save_classes(output_filename, classes) != 0));
 
@@ -412,10 +740,86 @@ int cv_feature_extraction_multi(const char *input_filename, const char *output_f
 fail:
     LOG_ERR("%s failed!\n", __func__);
     ret = -1;
-    sfree_image(regions_image);
-    sfree(regions.region);
 
 success:
+    sfree(learn.jobs);
+    fe_classes_free(&classes);
+
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Learns the class image list into the existing db in output file, images that
+ * are learned and not changed since are skipped. Works like learn if the db
+ * does not exist yet.
+ */
+int cv_feature_extraction_update(const char *input_filename, const char *output_filename)
+{
+    int ret = 0;
+    uint32_t learned = 0, skipped = 0, forgotten = 0;
+    classes_t *list = NULL, *classes = NULL;
+    class_t *list_class = NULL, *current_class = NULL;
+    str_node_t *current_filename = NULL;
+    cv_learn_t learn = { .jobs = NULL, .noe = 0, .capacity = 0 };
+
+    output_filename = (output_filename != NULL) ? output_filename : FE_MULTI_RESULT_PATH;
+
+    LOG_DBG("input_filename:'%s' output_filename:'%s'\n",
+	    input_filename, output_filename);
+
+    /* Get class image info from formatted input file */
+    util_fit(((list = fe_load_classes(input_filename)) == NULL));
+
+    /* Db keeps the features it is learned with */
+    if (access(output_filename, F_OK) == 0) {
+	util_fit(((classes = fe_load_classes_with_features(output_filename)) == NULL));
+	if (!freg_set_equal(&classes->set, &list->set)) {
+	    LOG_WARN("'%s' is learned with other features, they are kept\n", output_filename);
+	}
+    } else {
+	LOG_INFO("'%s' does not exist, learning from scratch\n", output_filename);
+	util_fit(((classes = fe_classes_alloc(&list->set)) == NULL));
+    }
+
+    list_class = list->head;
+    while (list_class != NULL) {
+	if ((current_class = fe_classes_find(classes, list_class->name)) == NULL) {
+	    util_fit(((current_class = fe_classes_insert(classes, list_class->name, NULL, 0))
+			== NULL));
+	}
+
+	current_filename = list_class->files;
+	while (current_filename != NULL) {
+	    if (fe_classes_learned_unchanged(classes, current_class, current_filename->str)) {
+		skipped++;
+		current_filename = current_filename->next;
+		continue;
+	    }
+	    util_fit((_cv_learn_add(&learn, current_filename->str, current_class) != 0));
+	    learned++;
+	    current_filename = current_filename->next;
+	}
+	list_class = list_class->next;
+    }
+    util_fit((_cv_learn(classes, &learn) != 0));
+    /* Files learned before and not listed anymore */
+    forgotten = fe_classes_learned_prune(classes);
+
+    /* Save calsses db to file */
+    util_fit((fe_save_classes(output_filename, classes) != 0));
+
+    LOG_INFO("'%s' succesfully saved! %u files learned, %u unchanged files skipped, "
+	    "%u files forgotten\n", output_filename, learned, skipped, forgotten);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree(learn.jobs);
+    fe_classes_free(&list);
     fe_classes_free(&classes);
 
     return ret;
@@ -426,10 +830,12 @@ int cv_feature_extraction_test(const char *input_filename,
 	const char *test_image_filename, const char *output_filename)
 {
     int ret = 0;
-    class_t *classes = NULL;
-    image_t *regions_image = NULL, *drawed_image = NULL,
-	    *rgb_image = NULL, *final_image = NULL;
+    classes_t *classes = NULL;
+    image_t *regions_image = NULL, *final_image = NULL;
+    draw_format_t format;
     regions_t regions = { .noe = 0, .region = NULL };
+    fe_cascade_stats_t stats;
+    uint32_t i = 0;
 
     output_filename = (output_filename != NULL) ? output_filename : FE_TEST_RESULT_IMAGE_PATH;
 
@@ -438,20 +844,27 @@ int cv_feature_extraction_test(const char *input_filename,
 
     /* Get class features info from formatted input file */
     util_fit(((classes = fe_load_classes_with_features(input_filename)) == NULL));
+    util_fit((fe_classes_index(classes) != 0));
 
     /* Get regions */
-    util_fit(((regions_image = _cv_get_regions(test_image_filename, &regions)) == NULL));
+    util_fit(((regions_image = _cv_get_regions(test_image_filename, &regions, rand())) == NULL));
 
-    /* Load bmp data in rgb form */
+    /* Marks are drawn into the bmp data as it is */
     util_fit(((final_image = bmp_load(test_image_filename)) == NULL));
-    util_fit(((rgb_image = bmp_convert_to_rgb(*final_image)) == NULL));
+    bmp_draw_format(*final_image, &format);
 
     /* Find nearest and mark region with class color on orig image */
-    util_fit((fe_test(*regions_image, regions, *classes, *rgb_image) != 0));
+    util_fit((fe_test(*regions_image, regions, *classes, *final_image, &format, &stats) != 0));
+    if (fe_match_mode == MATCH_MODE_CASCADE && stats.regions > 0) {
+	LOG_INFO("Cascade evaluated %.2f of %u features per region\n",
+		(double)stats.evaluated / stats.regions, classes->set.noe);
+	for (i = 0; i <= classes->set.noe; i++) {
+	    if (stats.histogram[i]) LOG_INFO("\t%u features: %u regions\n", i, stats.histogram[i]);
+	}
+    }
 
     /* Save result image */
-    util_fit(((drawed_image = bmp_convert_from_rgb(*rgb_image)) == NULL));
-    util_fit((bmp_save(output_filename, *drawed_image) != 0));
+    util_fit((bmp_save(output_filename, *final_image) != 0));
 
     LOG_INFO("'%s' succesfully saved!\n", output_filename);
     goto success;
@@ -464,13 +877,221 @@ success:
     fe_classes_free(&classes);
     sfree(regions.region);
     sfree_image(regions_image);
-    sfree_image(drawed_image);
-    sfree_image(rgb_image);
     sfree_image(final_image);
 
     return ret;
 }
 
+/*------------------------------------------------------------------------------*/
+/*
+ * Converts a classes db between the text and the binary format, the format of
+ * the output is selected by its extension.
+ */
+int cv_feature_extraction_convert(const char *input_filename, const char *output_filename)
+{
+    int ret = 0;
+    classes_t *classes = NULL;
+
+    LOG_DBG("input_filename:'%s' output_filename:'%s'\n",
+	    input_filename, output_filename);
+
+    util_fite((output_filename == NULL),
+	    LOG_ERR("Feature extraction with 'convert' needs output file!\n"));
+
+    util_fit(((classes = fe_load_classes_with_features(input_filename)) == NULL));
+    util_fit((fe_save_classes(output_filename, classes) != 0));
+
+    LOG_INFO("'%s' succesfully saved!\n", output_filename);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    fe_classes_free(&classes);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static double _cv_elapsed_ms(const struct timespec *begin)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) * 1e3 + (end.tv_nsec - begin->tv_nsec) / 1e6;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Matches the regions of the test image with the exact and the quantized knn
+ * and reports the scanned sample bytes, the time per run and how many of the
+ * quantized decisions are the same as the exact ones.
+ */
+int cv_feature_extraction_bench(const char *input_filename, const char *test_image_filename)
+{
+    int ret = 0;
+    uint32_t i = 0, b = 0, run = 0, agree = 0;
+    const uint8_t bits[] = { 16, 8 };
+    size_t size = 0;
+    double ms = 0;
+    struct timespec begin;
+    classes_t *classes = NULL;
+    image_t *regions_image = NULL;
+    regions_t regions = { .noe = 0, .region = NULL };
+    fmat_t *features = NULL;
+    match_t *exact = NULL, *quant = NULL;
+    qmat_t *codes = NULL;
+
+    LOG_DBG("input_filename:'%s' test_image_filename:'%s'\n",
+	    input_filename, test_image_filename);
+
+    util_fit(((classes = fe_load_classes_with_features(input_filename)) == NULL));
+    util_fite((classes->samples == NULL),
+	    LOG_ERR("There is no sample, learn with -S to keep them!\n"));
+    util_fit((fe_classes_index(classes) != 0));
+    /* Exact matching needs the tree, it is not built for a db keeping codes */
+    if (classes->samples_tree == NULL) {
+	util_fit(((classes->samples_tree = kdtree_build(classes->samples)) == NULL));
+    }
+    if (classes->qsamples) {
+	LOG_INFO("db codes: %u bit, %zu bytes\n", classes->qsamples->bits,
+		qmat_size(classes->qsamples));
+    }
+
+    util_fit(((regions_image = _cv_get_regions(test_image_filename, &regions, rand())) == NULL));
+    util_fite((regions.noe == 0), LOG_ERR("There is no region in the test image!\n"));
+    util_fit(((features = fe_get_all(*regions_image, regions, &classes->set)) == NULL));
+
+    util_fite(((exact = (match_t *)calloc(regions.noe, sizeof(match_t))) == NULL),
+	    LOG_ERR("Matches allocation failed!\n"));
+    util_fite(((quant = (match_t *)calloc(regions.noe, sizeof(match_t))) == NULL),
+	    LOG_ERR("Matches allocation failed!\n"));
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (run = 0; run < CV_CONF_BENCH_RUNS; run++) {
+	util_fit((match_knn(features, classes->samples_tree, classes->labels, fe_knn_k,
+			fe_match_epsilon, exact) != 0));
+    }
+    ms = _cv_elapsed_ms(&begin) / CV_CONF_BENCH_RUNS;
+    size = (size_t)classes->samples->rows * classes->samples->stride * sizeof(fmat_val_t);
+    LOG_INFO("exact : %zu bytes, %.3f ms per run\n", size, ms);
+
+    for (b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+	util_fit(((codes = qmat_build(classes->samples, bits[b])) == NULL));
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (run = 0; run < CV_CONF_BENCH_RUNS; run++) {
+	    util_fit((match_knn_quant(features, codes, classes->samples, classes->labels,
+			    fe_knn_k, fe_match_epsilon, quant) != 0));
+	}
+	ms = _cv_elapsed_ms(&begin) / CV_CONF_BENCH_RUNS;
+
+	for (i = 0, agree = 0; i < regions.noe; i++) {
+	    if (quant[i].index == exact[i].index) agree++;
+	}
+	LOG_INFO("%2u bit: %zu bytes (%.1fx smaller), %.3f ms per run, %u/%u decisions agree\n",
+		bits[b], qmat_size(codes), (double)size / qmat_size(codes), ms, agree,
+		regions.noe);
+	qmat_free(&codes);
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    qmat_free(&codes);
+    fe_classes_free(&classes);
+    sfree(regions.region);
+    sfree_image(regions_image);
+    sfree_fmat(features);
+    sfree(exact);
+    sfree(quant);
+
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Times the direct kernels and the FFT tiles on the intensity of the input
+ * with random non-separable masks of growing size, checks they give the same
+ * image and reports the first size the FFT tiles win.
+ */
+int cv_mask_bench(const char *input_filename)
+{
+    int ret = 0;
+    uint32_t i = 0, s = 0, run = 0, crossover = 0;
+    const uint32_t sizes[] = { 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 25, 31, 41, 51, 63 };
+    double ms[2] = { 0, 0 }, t = 0;
+    struct timespec begin;
+    image_t *image = NULL, *intensity = NULL, direct, fft;
+    mask_t mask = { .buf = NULL, .row = NULL, .column = NULL };
+
+    LOG_DBG("input_filename:'%s'\n", input_filename);
+
+    direct.buf = fft.buf = NULL;
+    util_fit(((image = bmp_load(input_filename)) == NULL));
+    util_fit(((intensity = bmp_convert_to_intensity(*image)) == NULL));
+    direct = fft = *intensity;
+    util_fite(((direct.buf = (uint8_t *)malloc(intensity->size)) == NULL ||
+		(fft.buf = (uint8_t *)malloc(intensity->size)) == NULL),
+	    LOG_ERR("Bench image allocation failed!\n"));
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+	mask.width = mask.height = sizes[s];
+	sfree(mask.buf);
+	util_fite(((mask.buf = (int16_t *)malloc(sizes[s] * sizes[s] * sizeof(int16_t))) == NULL),
+		LOG_ERR("Bench mask allocation failed!\n"));
+	/* Positive sum, random weights are not separable */
+	for (i = 0; i < sizes[s] * sizes[s]; i++) {
+	    mask.buf[i] = rand() % 16 - 4;
+	}
+	mask.buf[sizes[s] * sizes[s] / 2] += sizes[s] * sizes[s];
+
+	ms[0] = ms[1] = 0;
+	for (run = 0; run < CV_CONF_MASK_BENCH_RUNS; run++) {
+	    memcpy(direct.buf, intensity->buf, intensity->size);
+	    clock_gettime(CLOCK_MONOTONIC, &begin);
+	    util_fit((mask_apply_path(direct, mask, MASK_PATH_DIRECT) != 0));
+	    t = _cv_elapsed_ms(&begin);
+	    ms[0] = (run == 0 || t < ms[0]) ? t : ms[0];
+
+	    memcpy(fft.buf, intensity->buf, intensity->size);
+	    clock_gettime(CLOCK_MONOTONIC, &begin);
+	    util_fit((mask_apply_path(fft, mask, MASK_PATH_FFT) != 0));
+	    t = _cv_elapsed_ms(&begin);
+	    ms[1] = (run == 0 || t < ms[1]) ? t : ms[1];
+	}
+	util_fite((memcmp(direct.buf, fft.buf, intensity->size) != 0),
+		LOG_ERR("%ux%u mask outputs differ!\n", sizes[s], sizes[s]));
+	if (crossover == 0 && ms[1] < ms[0]) crossover = sizes[s];
+	LOG_INFO("%2ux%-2u mask: direct %9.3f ms, fft %9.3f ms\n", sizes[s], sizes[s],
+		ms[0], ms[1]);
+    }
+    if (crossover) {
+	LOG_INFO("FFT tiles are faster from %ux%u masks\n", crossover, crossover);
+    } else {
+	LOG_INFO("FFT tiles are never faster\n");
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree(mask.buf);
+    sfree(direct.buf);
+    sfree(fft.buf);
+    sfree_image(image);
+    sfree_image(intensity);
+    return ret;
+}
+
 /*------------------------------------------------------------------------------*/
 int cv_feature_extraction(const char *type, const char *input_filename,
 	const char *test_image_filename, const char *output_filename)
@@ -486,6 +1107,14 @@ int cv_feature_extraction(const char *type, const char *input_filename,
 		LOG_ERR("Feature extraction with 'test' needs test image file as input!\n"));
 	util_fit((cv_feature_extraction_test(input_filename, test_image_filename,
 			output_filename) != 0));
+    } else if (strcmp(type, "update") == 0) {
+	util_fit((cv_feature_extraction_update(input_filename, output_filename) != 0));
+    } else if (strcmp(type, "convert") == 0) {
+	util_fit((cv_feature_extraction_convert(input_filename, output_filename) != 0));
+    } else if (strcmp(type, "bench") == 0) {
+	util_fite((test_image_filename == NULL),
+		LOG_ERR("Feature extraction with 'bench' needs test image file as input!\n"));
+	util_fit((cv_feature_extraction_bench(input_filename, test_image_filename) != 0));
     } else {
 	LOG_ERR("'%s' is not supperted for feature extraction!\n", type);
 	goto fail;
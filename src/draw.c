@@ -9,12 +9,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 
 #include "log.h"
 #include "util.h"
 #include "bmp.h"
 #include "draw.h"
+#include "thread-pool.h"
 
 #ifndef LOG_LEVEL_CONF_DRAW
 #define LOG_LEVEL LOG_LEVEL_ERR
@@ -23,7 +23,6 @@
 #endif /* LOG_LEVEL_CONF_DRAW */
 
 /*------------------------------------------------------------------------------*/
-#define PI 3.141592
 #define SHAPE_NAME_LEN 16
 #define SHAPE_NAME_SF "%15s" /* SF: Scanf Format */
 
@@ -46,13 +45,287 @@ static uint8_t pre_defined_colors[][3] = {
 #define DRAW_GRAYSCALE_COLOR	COLOR_BLACK
 #define GET_COLOR(n, c, k)	((n > 1) ? pre_defined_colors[c][k] : DRAW_GRAYSCALE_COLOR)
 
-#define draw_set_pixels(_ptr, c) do {			\
-	ptr = _ptr;					\
-	for (k = 0; k < image.cb; k++) {		\
-	    *(ptr + k) = GET_COLOR(image.cb,		\
-		    (c % PREDEFINED_COLORS_SIZE), k);	\
-	}						\
-    } while (0)
+#define DRAW_MAX_CB		4 /* colour bytes of a 32 bit image */
+
+/*------------------------------------------------------------------------------*/
+/* Image with its pixel layout, rows out of first to last are clipped */
+typedef struct {
+    uint8_t *buf;
+    uint32_t width;
+    uint32_t height;
+    uint8_t cb;
+    draw_format_t format;   /* stride is set */
+    int32_t first;
+    int32_t last;
+} draw_canvas_t;
+
+/*------------------------------------------------------------------------------*/
+/* Canvas of the whole image, NULL format is top-down packed RGB */
+static void _draw_canvas(draw_canvas_t *cv, image_t image, const draw_format_t *format)
+{
+    cv->buf = image.buf;
+    cv->width = image.width;
+    cv->height = image.height;
+    cv->cb = image.cb;
+    memset(&cv->format, 0, sizeof(draw_format_t));
+    if (format) cv->format = *format;
+    if (cv->format.stride == 0) cv->format.stride = image.width * image.cb;
+    cv->first = 0;
+    cv->last = (int32_t)image.height - 1;
+}
+
+/*------------------------------------------------------------------------------*/
+static inline uint8_t* _draw_addr(const draw_canvas_t *cv, int32_t x, int32_t y)
+{
+    if (cv->format.bottom_up) x = cv->height - 1 - x;
+    return cv->buf + (size_t)x * cv->format.stride + (size_t)y * cv->cb;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Colour bytes of color in the canvas order, extra bytes of a 32 bit image are opaque */
+static void _draw_pixel(const draw_canvas_t *cv, uint8_t color, uint8_t *pixel)
+{
+    uint8_t k = 0, c = 0;
+
+    for (k = 0; k < cv->cb && k < DRAW_MAX_CB; k++) {
+	c = (cv->format.bgr && k < 3) ? 2 - k : k;
+	pixel[k] = (c < 3) ? GET_COLOR(cv->cb, (color % PREDEFINED_COLORS_SIZE), c) : 0xff;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+static void _draw_point(const draw_canvas_t *cv, int32_t x, int32_t y, const uint8_t *pixel)
+{
+    if (x < cv->first || x > cv->last || y < 0 || y >= (int32_t)cv->width) return;
+    memcpy(_draw_addr(cv, x, y), pixel, cv->cb);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Fills columns y0 to y1 (both included) of row x, clipped to the canvas. Gray
+ * rows are a memset, colour rows copy the filled part over the rest doubling
+ * it each time.
+ */
+static void _draw_span(const draw_canvas_t *cv, int32_t x, int32_t y0, int32_t y1,
+	const uint8_t *pixel)
+{
+    size_t len = 0, n = 0;
+    uint8_t *dst = NULL;
+
+    if (x < cv->first || x > cv->last) return;
+    if (y0 < 0) y0 = 0;
+    if (y1 >= (int32_t)cv->width) y1 = cv->width - 1;
+    if (y0 > y1) return;
+
+    dst = _draw_addr(cv, x, y0);
+    len = (size_t)(y1 - y0 + 1) * cv->cb;
+    if (cv->cb == 1) {
+	memset(dst, pixel[0], len);
+	return;
+    }
+    memcpy(dst, pixel, cv->cb);
+    for (n = cv->cb; n < len; n *= 2) {
+	memcpy(dst + n, dst, (n < len - n) ? n : len - n);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Midpoint circle, integer only. Outline points are mirrored to the eight
+ * octants. A fill spans each row once: rows y away from the center while y
+ * steps, rows x away once x is about to step, with the widest y of that x.
+ */
+static void _draw_circle(const draw_canvas_t *cv, circle_t circle, uint8_t filled,
+	const uint8_t *pixel)
+{
+    int32_t x = circle.r, y = 0, err = 1 - circle.r;
+
+    while (x >= y) {
+	if (filled) {
+	    _draw_span(cv, circle.x + y, circle.y - x, circle.y + x, pixel);
+	    if (y) _draw_span(cv, circle.x - y, circle.y - x, circle.y + x, pixel);
+	    if (err >= 0 && x != y) {
+		_draw_span(cv, circle.x + x, circle.y - y, circle.y + y, pixel);
+		_draw_span(cv, circle.x - x, circle.y - y, circle.y + y, pixel);
+	    }
+	} else {
+	    _draw_point(cv, circle.x + x, circle.y + y, pixel);
+	    _draw_point(cv, circle.x + x, circle.y - y, pixel);
+	    _draw_point(cv, circle.x - x, circle.y + y, pixel);
+	    _draw_point(cv, circle.x - x, circle.y - y, pixel);
+	    _draw_point(cv, circle.x + y, circle.y + x, pixel);
+	    _draw_point(cv, circle.x + y, circle.y - x, pixel);
+	    _draw_point(cv, circle.x - y, circle.y + x, pixel);
+	    _draw_point(cv, circle.x - y, circle.y - x, pixel);
+	}
+
+	y++;
+	if (err < 0) {
+	    err += 2 * y + 1;
+	} else {
+	    x--;
+	    err += 2 * (y - x) + 1;
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Ellipse walk state, v rows and u columns away from the center */
+typedef struct {
+    const draw_canvas_t *cv;
+    ellipse_t ellipse;
+    uint8_t filled;
+    const uint8_t *pixel;
+    int32_t row;	/* row offset of the pending span, -1 if none */
+    int32_t half;	/* widest column offset seen on it */
+} draw_ellipse_t;
+
+/*------------------------------------------------------------------------------*/
+static void _draw_ellipse_flush(draw_ellipse_t *e)
+{
+    if (e->row < 0) return;
+    _draw_span(e->cv, e->ellipse.x + e->row, e->ellipse.y - e->half,
+	    e->ellipse.y + e->half, e->pixel);
+    if (e->row) {
+	_draw_span(e->cv, e->ellipse.x - e->row, e->ellipse.y - e->half,
+		e->ellipse.y + e->half, e->pixel);
+    }
+    e->row = -1;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Rows only shrink along the walk, a fill spans each row once it is left */
+static void _draw_ellipse_plot(draw_ellipse_t *e, int32_t v, int32_t u)
+{
+    if (!e->filled) {
+	_draw_point(e->cv, e->ellipse.x + v, e->ellipse.y + u, e->pixel);
+	_draw_point(e->cv, e->ellipse.x + v, e->ellipse.y - u, e->pixel);
+	_draw_point(e->cv, e->ellipse.x - v, e->ellipse.y + u, e->pixel);
+	_draw_point(e->cv, e->ellipse.x - v, e->ellipse.y - u, e->pixel);
+	return;
+    }
+    if (v != e->row) {
+	_draw_ellipse_flush(e);
+	e->row = v;
+	e->half = u;
+    } else if (u > e->half) {
+	e->half = u;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Midpoint ellipse, integer only. The decision values are scaled by four so
+ * the half pixel midpoints stay integers. First region steps the columns
+ * while the slope is below one, the second one steps the rows.
+ */
+static void _draw_ellipse(const draw_canvas_t *cv, ellipse_t ellipse, uint8_t filled,
+	const uint8_t *pixel)
+{
+    int64_t ra = ellipse.a, rb = ellipse.b, a2 = ra * ra, b2 = rb * rb;
+    int64_t u = 0, v = ra, du = 0, dv = 2 * b2 * v, d = 0;
+    draw_ellipse_t e = { .cv = cv, .ellipse = ellipse, .filled = filled,
+	.pixel = pixel, .row = -1, .half = 0 };
+
+    /* Flat ellipse has no row to step, it is the center row */
+    if (ra == 0) {
+	_draw_span(cv, ellipse.x, ellipse.y - ellipse.b, ellipse.y + ellipse.b, pixel);
+	return;
+    }
+
+    d = 4 * a2 - 4 * b2 * ra + b2;
+    while (du < dv) {
+	_draw_ellipse_plot(&e, v, u);
+	u++;
+	du += 2 * a2;
+	if (d < 0) {
+	    d += 4 * (du + a2);
+	} else {
+	    v--;
+	    dv -= 2 * b2;
+	    d += 4 * (du - dv + a2);
+	}
+    }
+
+    d = a2 * (2 * u + 1) * (2 * u + 1) + 4 * b2 * (v - 1) * (v - 1) - 4 * a2 * b2;
+    while (v >= 0) {
+	_draw_ellipse_plot(&e, v, u);
+	v--;
+	dv -= 2 * b2;
+	if (d > 0) {
+	    d += 4 * (b2 - dv);
+	} else {
+	    u++;
+	    du += 2 * a2;
+	    d += 4 * (du - dv + b2);
+	}
+    }
+    /* Thin ellipses leave the last row before reaching their tips */
+    for (; u <= rb; u++) {
+	_draw_ellipse_plot(&e, 0, u);
+    }
+    _draw_ellipse_flush(&e);
+}
+
+/*------------------------------------------------------------------------------*/
+/* Rows first to last clipped to the canvas, empty if first > last */
+static void _draw_rows(const draw_canvas_t *cv, int32_t *first, int32_t *last)
+{
+    if (*first < cv->first) *first = cv->first;
+    if (*last > cv->last) *last = cv->last;
+}
+
+/*------------------------------------------------------------------------------*/
+static void _draw_plus(const draw_canvas_t *cv, plus_t plus, const uint8_t *pixel)
+{
+    int32_t i = 0, first = plus.x - plus.len / 2, last = plus.x + plus.len / 2;
+
+    _draw_rows(cv, &first, &last);
+    for (i = first; i <= last; i++) {
+	_draw_point(cv, i, plus.y, pixel);
+    }
+    _draw_span(cv, plus.x, plus.y - plus.len / 2, plus.y + plus.len / 2, pixel);
+}
+
+/*------------------------------------------------------------------------------*/
+/* Centered frame of a region frame, see draw_rect */
+static rectangle_t _draw_rect_centered(rectangle_t rect, uint8_t orig_center, uint8_t filled)
+{
+    if (!orig_center) {
+	rect.x += (rect.height / 2) + 2;
+	rect.y += (rect.width / 2) + 2;
+	if (!filled) {
+	    rect.height += 2;
+	    rect.width += 2;
+	}
+    }
+    return rect;
+}
+
+/*------------------------------------------------------------------------------*/
+static void _draw_rect(const draw_canvas_t *cv, rectangle_t rect, uint8_t filled,
+	const uint8_t *pixel)
+{
+    int32_t i = 0, first = rect.x - (rect.height / 2), last = rect.x + (rect.height / 2);
+    int32_t left = rect.y - (rect.width / 2), right = rect.y + (rect.width / 2);
+
+    if (!filled) {
+	/* A to D and B to C */
+	_draw_span(cv, first, left, right, pixel);
+	_draw_span(cv, last, left, right, pixel);
+    }
+
+    _draw_rows(cv, &first, &last);
+    for (i = first; i <= last; i++) {
+	if (filled) {
+	    _draw_span(cv, i, left, right, pixel);
+	} else {
+	    /* A to B and D to C */
+	    _draw_point(cv, i, left, pixel);
+	    _draw_point(cv, i, right, pixel);
+	}
+    }
+}
 
 /*------------------------------------------------------------------------------*/
 /*    |	    ^
@@ -61,23 +334,14 @@ static uint8_t pre_defined_colors[][3] = {
  */
 void draw_plus(image_t image, plus_t plus, uint8_t color)
 {
-    int32_t i = 0, k = 0;
-    uint8_t *ptr = NULL;
+    uint8_t pixel[DRAW_MAX_CB];
+    draw_canvas_t cv;
 
     LOG_DBG("plus %d %d %d\n", plus.x, plus.y, plus.len);
 
-    for (i = -plus.len / 2; i <= plus.len / 2; i++) {
-	int32_t _x = plus.x + i;
-	int32_t _y = plus.y + i;
-	if (_x >= 0 && _x < image.height && plus.y >= 0 && plus.y < image.width) {
-	    draw_set_pixels(image.buf + (image.width * image.cb * _x) +
-		    plus.y * image.cb, color);
-	}
-	if (_y >= 0 && _y < image.width && plus.x >= 0 && plus.x < image.height) {
-	    draw_set_pixels(image.buf + (image.width * image.cb * plus.x) +
-		   _y * image.cb, color);
-	}
-    }
+    _draw_canvas(&cv, image, NULL);
+    _draw_pixel(&cv, color, pixel);
+    _draw_plus(&cv, plus, pixel);
 }
 
 /*------------------------------------------------------------------------------*/
@@ -89,56 +353,15 @@ void draw_plus(image_t image, plus_t plus, uint8_t color)
  */
 void draw_rect(image_t image, rectangle_t rect, uint8_t orig_center, uint8_t color)
 {
-    int32_t i = 0, k = 0, _x = 0, _y = 0;
-    uint8_t *ptr = NULL;
+    uint8_t pixel[DRAW_MAX_CB];
+    draw_canvas_t cv;
 
-    if (!orig_center) {
-	rect.x += (rect.height / 2) + 2;
-	rect.y += (rect.width / 2) + 2;
-	rect.height += 2;
-	rect.width += 2;
-    }
+    rect = _draw_rect_centered(rect, orig_center, 0);
     LOG_DBG("rectangle %d %d %d %d\n", rect.x, rect.y, rect.width, rect.height);
-    /* A to B and D to C */
-    for (i = -rect.height / 2; i <= rect.height / 2; i++) {
-	_x = rect.x + i;
-
-	if (_x >= 0 && _x < image.height) {
-	    /* A to B */
-	    _y = rect.y - (rect.width / 2);
-	    if (_y >= 0) {
-		draw_set_pixels(image.buf + (image.width * image.cb * _x) +
-			_y * image.cb, color);
-	    }
-
-	    /* D to C */
-	    _y = rect.y + (rect.width / 2);
-	    if (_y < image.width) {
-		draw_set_pixels(image.buf + (image.width * image.cb * _x) +
-			_y * image.cb, color);
-	    }
-	}
-    }
-    /* A to D and B to C */
-    for (i = -rect.width / 2; i <= rect.width / 2; i++) {
-	_y = rect.y + i;
-
-	if (_y >= 0 && _y < image.width) {
-	    /* A to D */
-	    _x = rect.x - (rect.height / 2);
-	    if (_x >= 0) {
-		draw_set_pixels(image.buf + (image.width * image.cb * _x) +
-			_y * image.cb, color);
-	    }
 
-	    /* B to C */
-	    _x = rect.x + (rect.height / 2);
-	    if (_x < image.height) {
-		draw_set_pixels(image.buf + (image.width * image.cb * _x) +
-			_y * image.cb, color);
-	    }
-	}
-    }
+    _draw_canvas(&cv, image, NULL);
+    _draw_pixel(&cv, color, pixel);
+    _draw_rect(&cv, rect, 0, pixel);
 }
 
 /*------------------------------------------------------------------------------*/
@@ -150,26 +373,15 @@ void draw_rect(image_t image, rectangle_t rect, uint8_t orig_center, uint8_t col
  */
 void draw_filled_rect(image_t image, rectangle_t rect, uint8_t orig_center, uint8_t color)
 {
-    int32_t i = 0, j = 0, k = 0, _x = 0, _y = 0;
-    uint8_t *ptr = NULL;
+    uint8_t pixel[DRAW_MAX_CB];
+    draw_canvas_t cv;
 
-    if (!orig_center) {
-	rect.x += (rect.height / 2) + 2;
-	rect.y += (rect.width / 2) + 2;
-    }
+    rect = _draw_rect_centered(rect, orig_center, 1);
     LOG_DBG("rectangle %d %d %d %d\n", rect.x, rect.y, rect.width, rect.height);
-    for (i = -rect.height / 2; i <= rect.height / 2; i++) {
-	_x = rect.x + i;
-	if (_x >= 0 && _x < image.height) {
-	    for (j = -rect.width / 2; j <= rect.width / 2; j++) {
-		_y = rect.y + j;
-		if (_y >= 0 && _y < image.width) {
-		    draw_set_pixels(image.buf + (image.width * image.cb * _x) +
-			    _y * image.cb, color);
-		}
-	    }
-	}
-    }
+
+    _draw_canvas(&cv, image, NULL);
+    _draw_pixel(&cv, color, pixel);
+    _draw_rect(&cv, rect, 1, pixel);
 }
 
 /*------------------------------------------------------------------------------*/
@@ -183,19 +395,27 @@ void draw_filled_rect(image_t image, rectangle_t rect, uint8_t orig_center, uint
  */
 void draw_circle(image_t image, circle_t circle, uint8_t color)
 {
-    int32_t i = 0, k = 0, _x = 0, _y = 0;
-    uint8_t *ptr = NULL;
+    uint8_t pixel[DRAW_MAX_CB];
+    draw_canvas_t cv;
 
     LOG_DBG("circle %d %d %d\n", circle.x, circle.y, circle.r);
 
-    for (i = 0; i < 360; i++) {
-	_x = circle.r * cos((PI * i) / 180) + circle.x;
-	_y = circle.r * sin((PI * i) / 180) + circle.y;
+    _draw_canvas(&cv, image, NULL);
+    _draw_pixel(&cv, color, pixel);
+    _draw_circle(&cv, circle, 0, pixel);
+}
 
-	if(_x >= 0 && _x < image.height && _y >= 0 && _y < image.width){
-	    draw_set_pixels(image.buf + (image.width * image.cb * _x) + _y * image.cb, color);
-	}
-    }
+/*------------------------------------------------------------------------------*/
+void draw_filled_circle(image_t image, circle_t circle, uint8_t color)
+{
+    uint8_t pixel[DRAW_MAX_CB];
+    draw_canvas_t cv;
+
+    LOG_DBG("filled circle %d %d %d\n", circle.x, circle.y, circle.r);
+
+    _draw_canvas(&cv, image, NULL);
+    _draw_pixel(&cv, color, pixel);
+    _draw_circle(&cv, circle, 1, pixel);
 }
 
 /*------------------------------------------------------------------------------*/
@@ -211,72 +431,116 @@ void draw_circle(image_t image, circle_t circle, uint8_t color)
  */
 void draw_ellipse(image_t image, ellipse_t ellipse, uint8_t color)
 {
-    int32_t i = 0, k = 0, _x = 0, _y = 0;
-    uint8_t *ptr = NULL;
+    uint8_t pixel[DRAW_MAX_CB];
+    draw_canvas_t cv;
 
     LOG_DBG("ellipse %d %d %d %d\n", ellipse.x, ellipse.y, ellipse.a, ellipse.b);
 
-    for (i = 0; i < 360; i++) {
-	_x = ellipse.x + ellipse.a * cos((PI * i) / 180);
-	_y = ellipse.y + ellipse.b * sin((PI * i) / 180);
+    _draw_canvas(&cv, image, NULL);
+    _draw_pixel(&cv, color, pixel);
+    _draw_ellipse(&cv, ellipse, 0, pixel);
+}
 
-	if (_x >= 0 && _x < image.height && _y >= 0 && _y < image.width) {
-	    draw_set_pixels(image.buf + (image.width * image.cb * _x) + _y * image.cb, color);
-	}
+/*------------------------------------------------------------------------------*/
+void draw_filled_ellipse(image_t image, ellipse_t ellipse, uint8_t color)
+{
+    uint8_t pixel[DRAW_MAX_CB];
+    draw_canvas_t cv;
+
+    LOG_DBG("filled ellipse %d %d %d %d\n", ellipse.x, ellipse.y, ellipse.a, ellipse.b);
+
+    _draw_canvas(&cv, image, NULL);
+    _draw_pixel(&cv, color, pixel);
+    _draw_ellipse(&cv, ellipse, 1, pixel);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Queues a copy of cmd, rectangles are stored centered.
+ */
+int draw_list_add(draw_list_t *list, const draw_cmd_t *cmd)
+{
+    int ret = 0;
+    draw_cmd_t *cmds = NULL;
+
+    if (list->noe == list->capacity) {
+	util_fite(((cmds = (draw_cmd_t *)realloc(list->cmds,
+			    (list->capacity * 2 + 1) * sizeof(draw_cmd_t))) == NULL),
+		LOG_ERR("Draw commands allocation failed!\n"));
+	list->cmds = cmds;
+	list->capacity = list->capacity * 2 + 1;
     }
+
+    list->cmds[list->noe] = *cmd;
+    if (cmd->shape == DRAW_RECT || cmd->shape == DRAW_FILLED_RECT) {
+	list->cmds[list->noe].rect = _draw_rect_centered(cmd->rect, cmd->orig_center,
+		cmd->shape == DRAW_FILLED_RECT);
+	list->cmds[list->noe].orig_center = 1;
+    }
+    list->noe++;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
 }
 
 /*------------------------------------------------------------------------------*/
-int draw_multi_shapes(image_t image, const char *filename, uint8_t color)
+/*
+ * Parses the shapes in the file into the list, see draw_multi_shapes.
+ */
+int draw_list_load(draw_list_t *list, const char *filename, uint8_t color)
 {
     int ret = 0;
     FILE *file = NULL;
     char shape_name[SHAPE_NAME_LEN];
-    plus_t plus;
-    rectangle_t rect;
-    circle_t circle;
-    ellipse_t ellipse;
+    draw_cmd_t cmd;
 
-    LOG_DBG("image:%p filename:'%s'\n", &image, filename);
+    LOG_DBG("list:%p filename:'%s'\n", list, filename);
 
     util_fite(((file = fopen(filename, "r")) == NULL), LOG_ERR("File open failed!\n"));
 
     while (1) {
 	util_fite(((fscanf(file, SHAPE_NAME_SF, shape_name)) != 1),
 		LOG_ERR("Reading shape name failed!\n"));
+
+	memset(&cmd, 0, sizeof(draw_cmd_t));
+	cmd.color = color;
+	cmd.orig_center = 1;
 	if (!strcmp("EOF", shape_name)) {
 	    /* If we reach here, all the figures have been read properly.
 	     * We can break the loop. */
 	    break;
 	} else if (!strcmp("plus", shape_name)) {
-	    util_fite(((fscanf(file, "%d %d %d", &plus.x, &plus.y, &plus.len)) != 3),
+	    cmd.shape = DRAW_PLUS;
+	    util_fite(((fscanf(file, "%d %d %d", &cmd.plus.x, &cmd.plus.y, &cmd.plus.len)) != 3),
 		    LOG_ERR("%s reading failed!\n", shape_name));
-
-	    draw_plus(image, plus, color);
 	} else if (!strcmp("rectangle", shape_name)) {
-	    util_fite(((fscanf(file, "%d %d %d %d", &rect.x, &rect.y, &rect.width,
-				&rect.height)) != 4),
+	    cmd.shape = DRAW_RECT;
+	    util_fite(((fscanf(file, "%d %d %d %d", &cmd.rect.x, &cmd.rect.y, &cmd.rect.width,
+				&cmd.rect.height)) != 4),
 		    LOG_ERR("%s reading failed!\n", shape_name));
-
-	    draw_rect(image, rect, 1, color);
-	} else if (!strcmp("circle", shape_name)) {
-	    util_fite(((fscanf(file, "%d %d %d", &circle.x, &circle.y, &circle.r)) != 3),
+	} else if (!strcmp("circle", shape_name) || !strcmp("filled-circle", shape_name)) {
+	    cmd.shape = (shape_name[0] == 'f') ? DRAW_FILLED_CIRCLE : DRAW_CIRCLE;
+	    util_fite(((fscanf(file, "%d %d %d", &cmd.circle.x, &cmd.circle.y,
+				&cmd.circle.r)) != 3),
 		    LOG_ERR("%s reading failed!\n", shape_name));
-
-	    draw_circle(image, circle, color);
-	} else if (!strcmp("ellipse", shape_name)) {
-	    util_fite(((fscanf(file, "%d %d %d %d", &ellipse.x, &ellipse.y,
-				&ellipse.a, &ellipse.b)) != 4),
+	} else if (!strcmp("ellipse", shape_name) || !strcmp("filled-ellipse", shape_name)) {
+	    cmd.shape = (shape_name[0] == 'f') ? DRAW_FILLED_ELLIPSE : DRAW_ELLIPSE;
+	    util_fite(((fscanf(file, "%d %d %d %d", &cmd.ellipse.x, &cmd.ellipse.y,
+				&cmd.ellipse.a, &cmd.ellipse.b)) != 4),
 		    LOG_ERR("%s reading failed!\n", shape_name));
-
-	    draw_ellipse(image, ellipse, color);
 	} else {
 	    LOG_ERR("Shape '%s' is not supported!\n", shape_name);
 	    goto fail;
 	}
+	util_fit((draw_list_add(list, &cmd) != 0));
     }
 
-    LOG_DBG("All shapes successfully drawed!\n");
+    LOG_DBG("%u shapes queued\n", list->noe);
     goto success;
 
 fail:
@@ -287,3 +551,177 @@ success:
     return ret;
 }
 
+/*------------------------------------------------------------------------------*/
+void draw_list_free(draw_list_t *list)
+{
+    sfree(list->cmds);
+    list->noe = list->capacity = 0;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Rows the command may touch */
+static void _draw_cmd_rows(const draw_cmd_t *cmd, int32_t *first, int32_t *last)
+{
+    int32_t half = 0, center = 0;
+
+    switch (cmd->shape) {
+	case DRAW_PLUS:
+	    center = cmd->plus.x;
+	    half = abs(cmd->plus.len / 2);
+	    break;
+	case DRAW_RECT:
+	case DRAW_FILLED_RECT:
+	    center = cmd->rect.x;
+	    half = abs(cmd->rect.height / 2);
+	    break;
+	case DRAW_CIRCLE:
+	case DRAW_FILLED_CIRCLE:
+	    center = cmd->circle.x;
+	    half = abs(cmd->circle.r);
+	    break;
+	default:
+	    center = cmd->ellipse.x;
+	    half = abs(cmd->ellipse.a);
+	    break;
+    }
+    *first = center - half;
+    *last = center + half;
+}
+
+/*------------------------------------------------------------------------------*/
+static void _draw_cmd(const draw_canvas_t *cv, const draw_cmd_t *cmd)
+{
+    uint8_t pixel[DRAW_MAX_CB];
+
+    _draw_pixel(cv, cmd->color, pixel);
+    switch (cmd->shape) {
+	case DRAW_PLUS:
+	    _draw_plus(cv, cmd->plus, pixel);
+	    break;
+	case DRAW_RECT:
+	case DRAW_FILLED_RECT:
+	    _draw_rect(cv, cmd->rect, cmd->shape == DRAW_FILLED_RECT, pixel);
+	    break;
+	case DRAW_CIRCLE:
+	case DRAW_FILLED_CIRCLE:
+	    _draw_circle(cv, cmd->circle, cmd->shape == DRAW_FILLED_CIRCLE, pixel);
+	    break;
+	default:
+	    _draw_ellipse(cv, cmd->ellipse, cmd->shape == DRAW_FILLED_ELLIPSE, pixel);
+	    break;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    draw_canvas_t cv;
+    const draw_list_t *list;
+    uint32_t *starts;	/* tiles + 1 entries, commands of tile t are from starts[t] */
+    uint32_t *indexes;	/* commands of the tiles, in list order in each tile */
+} draw_render_t;
+
+/*------------------------------------------------------------------------------*/
+static int _draw_tile_job(void *arg, uint32_t t)
+{
+    draw_render_t *render = (draw_render_t *)arg;
+    uint32_t i = 0;
+    draw_canvas_t tile = render->cv;
+
+    /* Tile is the canvas clipped to its rows */
+    tile.first = t * DRAW_CONF_TILE_ROWS;
+    if (tile.last > tile.first + DRAW_CONF_TILE_ROWS - 1) {
+	tile.last = tile.first + DRAW_CONF_TILE_ROWS - 1;
+    }
+
+    for (i = render->starts[t]; i < render->starts[t + 1]; i++) {
+	_draw_cmd(&tile, &render->list->cmds[render->indexes[i]]);
+    }
+    return 0;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Draws the queued shapes into the image. Shapes are binned into tiles of
+ * DRAW_CONF_TILE_ROWS rows and the tiles are drawn on the thread pool, each
+ * writes only its rows. Shapes are drawn in list order in every tile, the
+ * result is the same as drawing them one by one. Image buffer is laid out as
+ * format tells, NULL is packed top-down RGB.
+ */
+int draw_list_render(image_t image, const draw_format_t *format, const draw_list_t *list)
+{
+    int ret = 0;
+    uint32_t tiles = (image.height + DRAW_CONF_TILE_ROWS - 1) / DRAW_CONF_TILE_ROWS;
+    uint32_t i = 0, t = 0;
+    int32_t first = 0, last = 0;
+    uint64_t *costs = NULL;
+    draw_render_t render = { .list = list, .starts = NULL, .indexes = NULL };
+
+    LOG_DBG("%u shapes into %u tiles\n", list->noe, tiles);
+
+    util_sit((list->noe == 0 || tiles == 0));
+    _draw_canvas(&render.cv, image, format);
+    util_fite(((render.starts = (uint32_t *)calloc(tiles + 1, sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Tile starts allocation failed!\n"));
+    util_fite(((costs = (uint64_t *)calloc(tiles, sizeof(uint64_t))) == NULL),
+	    LOG_ERR("Tile costs allocation failed!\n"));
+
+    /* Count the shapes of each tile, then place them in list order */
+    for (i = 0; i < list->noe; i++) {
+	_draw_cmd_rows(&list->cmds[i], &first, &last);
+	_draw_rows(&render.cv, &first, &last);
+	for (t = first / DRAW_CONF_TILE_ROWS; first <= last && t <= last / DRAW_CONF_TILE_ROWS; t++) {
+	    costs[t]++;
+	}
+    }
+    for (t = 0; t < tiles; t++) {
+	render.starts[t + 1] = render.starts[t] + costs[t];
+    }
+    util_fite(((render.indexes = (uint32_t *)malloc((render.starts[tiles] + 1) *
+			    sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Tile indexes allocation failed!\n"));
+    memset(costs, 0, tiles * sizeof(uint64_t));
+    for (i = 0; i < list->noe; i++) {
+	_draw_cmd_rows(&list->cmds[i], &first, &last);
+	_draw_rows(&render.cv, &first, &last);
+	for (t = first / DRAW_CONF_TILE_ROWS; first <= last && t <= last / DRAW_CONF_TILE_ROWS; t++) {
+	    render.indexes[render.starts[t] + costs[t]++] = i;
+	}
+    }
+
+    util_fit((tpool_run(tiles, costs, _draw_tile_job, &render) != 0));
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree(costs);
+    sfree(render.starts);
+    sfree(render.indexes);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+int draw_multi_shapes(image_t image, const draw_format_t *format, const char *filename,
+	uint8_t color)
+{
+    int ret = 0;
+    draw_list_t list = { .cmds = NULL, .noe = 0, .capacity = 0 };
+
+    LOG_DBG("image:%p filename:'%s'\n", &image, filename);
+
+    util_fit((draw_list_load(&list, filename, color) != 0));
+    util_fit((draw_list_render(image, format, &list) != 0));
+
+    LOG_DBG("All shapes successfully drawed!\n");
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    draw_list_free(&list);
+    return ret;
+}
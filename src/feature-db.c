@@ -0,0 +1,436 @@
+/**
+ * \file
+ *	Binary feature database functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "util.h"
+#include "morphology.h"
+#include "feature-db.h"
+
+#ifndef LOG_LEVEL_CONF_FDB
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_FDB */
+#define LOG_LEVEL LOG_LEVEL_CONF_FDB
+#endif /* LOG_LEVEL_CONF_FDB */
+
+/*------------------------------------------------------------------------------*/
+#define FDB_ALIGN(_x) ((((uint64_t)(_x)) + FMAT_ALIGN - 1) & ~((uint64_t)FMAT_ALIGN - 1))
+
+/*------------------------------------------------------------------------------*/
+/* Pads the file with zeros up to offset */
+static int _fdb_pad(FILE *file, uint64_t offset)
+{
+    int ret = 0;
+    long pos = 0;
+
+    util_fite(((pos = ftell(file)) < 0), LOG_ERR("ftell failed\n"));
+    for (; (uint64_t)pos < offset; pos++) {
+	util_fite((fputc(0, file) == EOF), LOG_ERR("fputc failed\n"));
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Section must lie in the file */
+static uint8_t _fdb_section_valid(const fdb_header_t *header, uint64_t offset, uint64_t size)
+{
+    return (offset % FMAT_ALIGN) == 0 && offset <= header->size &&
+	size <= header->size - offset;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _fdb_header_check(const fdb_header_t *header, size_t size)
+{
+    int ret = 0;
+    uint64_t row_size = (uint64_t)header->stride * sizeof(fmat_val_t);
+    uint64_t code_row_size = (uint64_t)header->quant_stride * (header->quant_bits / 8);
+
+    util_fite((memcmp(header->magic, FDB_MAGIC, FDB_MAGIC_LEN) != 0),
+	    LOG_ERR("Not a binary feature db!\n"));
+    util_fite((header->version != FDB_VERSION),
+	    LOG_ERR("Unsupported db version %u\n", header->version));
+    util_fite((header->byte_order != FDB_BYTE_ORDER),
+	    LOG_ERR("Db is written with another byte order!\n"));
+    util_fite((header->value_size != sizeof(fmat_val_t)),
+	    LOG_ERR("Db values are %u bytes, this build uses %u! Convert it to text first\n",
+		header->value_size, (uint32_t)sizeof(fmat_val_t)));
+    util_fite((header->size != size), LOG_ERR("Db is truncated!\n"));
+    util_fite((header->cols == 0 || header->cols > FE_CONF_MAX_FEATURES),
+	    LOG_ERR("Unsupported features number of entries. (%u > %u)\n",
+		header->cols, FE_CONF_MAX_FEATURES));
+
+    util_fite((!_fdb_section_valid(header, header->set_offset, header->set_size) ||
+		!_fdb_section_valid(header, header->names_offset, header->names_size) ||
+		!_fdb_section_valid(header, header->total_offset,
+		    (uint64_t)header->classes * sizeof(uint32_t)) ||
+		!_fdb_section_valid(header, header->features_offset,
+		    header->classes * row_size) ||
+		!_fdb_section_valid(header, header->labels_offset,
+		    (uint64_t)header->samples * sizeof(uint32_t)) ||
+		!_fdb_section_valid(header, header->samples_offset,
+		    header->samples * row_size) ||
+		!_fdb_section_valid(header, header->files_offset,
+		    (uint64_t)header->files * sizeof(fdb_file_t)) ||
+		!_fdb_section_valid(header, header->paths_offset, header->paths_size)),
+	    LOG_ERR("Db sections are corrupted!\n"));
+
+    util_sit((header->quant_bits == 0));
+    util_fite(((header->quant_bits != 8 && header->quant_bits != 16) || header->samples == 0 ||
+		header->quant_stride != (header->cols + QMAT_CHUNK - 1) / QMAT_CHUNK * QMAT_CHUNK),
+	    LOG_ERR("Db sample codes are corrupted!\n"));
+    util_fite((!_fdb_section_valid(header, header->quant_offset,
+		    2 * (uint64_t)header->quant_stride * sizeof(double)) ||
+		!_fdb_section_valid(header, header->codes_offset,
+		    header->samples * code_row_size)),
+	    LOG_ERR("Db sections are corrupted!\n"));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns 1 if the file starts with the binary db magic.
+ */
+uint8_t fdb_is_binary(const char *filename)
+{
+    FILE *file = NULL;
+    char magic[FDB_MAGIC_LEN];
+    uint8_t ret = 0;
+
+    util_sit(((file = fopen(filename, "rb")) == NULL));
+    ret = (fread(magic, 1, FDB_MAGIC_LEN, file) == FDB_MAGIC_LEN &&
+	    memcmp(magic, FDB_MAGIC, FDB_MAGIC_LEN) == 0);
+
+success:
+    if (file) fclose(file);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns 1 if the file name has the binary db extension.
+ */
+uint8_t fdb_is_binary_filename(const char *filename)
+{
+    size_t len = strlen(filename), ext = strlen(FDB_EXTENSION);
+
+    return len > ext && strcmp(&filename[len - ext], FDB_EXTENSION) == 0;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Maps the db, class and sample matrices point into the private mapping so
+ * nothing is parsed or copied except the small per class arrays. If the db
+ * keeps sample codes, knn scans them and reads only the re-ranked sample rows,
+ * the sample pages are faulted in one by one.
+ */
+classes_t* fdb_load(const char *filename)
+{
+    int fd = -1;
+    uint32_t i = 0;
+    uint64_t page = 0;
+    struct stat st;
+    void *map = MAP_FAILED;
+    uint8_t *base = NULL;
+    const char *name = NULL, *end = NULL;
+    const fdb_header_t *header = NULL;
+    const fdb_file_t *file = NULL;
+    classes_t *classes = NULL;
+    freg_set_t set = { .noe = 0 };
+
+    LOG_DBG("filename:'%s'\n", filename);
+
+    util_fite(((fd = open(filename, O_RDONLY)) < 0), LOG_ERR("File open failed!\n"));
+    util_fite((fstat(fd, &st) != 0), LOG_ERR("File stat failed!\n"));
+    util_fite(((size_t)st.st_size < sizeof(fdb_header_t)), LOG_ERR("Db is truncated!\n"));
+
+    /* Private writable mapping, updates copy the touched pages only */
+    util_fite(((map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0))
+		== MAP_FAILED), LOG_ERR("File mapping failed!\n"));
+    base = (uint8_t *)map;
+    header = (const fdb_header_t *)base;
+
+    util_fit((_fdb_header_check(header, st.st_size) != 0));
+
+    /* Features the db is learned with, in column order */
+    name = (const char *)&base[header->set_offset];
+    end = name + header->set_size;
+    for (i = 0; i < header->cols; i++) {
+	util_fite((name >= end || memchr(name, '\0', end - name) == NULL),
+		LOG_ERR("Feature name table is corrupted!\n"));
+	util_fit((freg_set_add(&set, name) != 0));
+	name += strlen(name) + 1;
+    }
+
+    util_fit(((classes = fe_classes_alloc(&set)) == NULL));
+    classes->map = map;
+    classes->map_size = st.st_size;
+    map = MAP_FAILED;
+
+    util_fite((classes->features->stride != header->stride),
+	    LOG_ERR("Db stride %u does not match %u!\n", header->stride,
+		classes->features->stride));
+
+    if (header->classes > 0) {
+	util_fite(((classes->pool = (class_t *)calloc(header->classes, sizeof(class_t))) == NULL),
+		LOG_ERR("Class pool allocation failed!\n"));
+	util_fite(((classes->total_noe = (uint32_t *)malloc(header->classes *
+			    sizeof(uint32_t))) == NULL),
+		LOG_ERR("Classes total_noe allocation failed\n"));
+    }
+
+    /* Names are used in place, each must end in the table */
+    name = (const char *)&base[header->names_offset];
+    end = name + header->names_size;
+    for (i = 0; i < header->classes; i++) {
+	util_fite((name >= end || memchr(name, '\0', end - name) == NULL),
+		LOG_ERR("Class name table is corrupted!\n"));
+	classes->pool[i].index = i;
+	classes->pool[i].name = (char *)name;
+	classes->pool[i].mapped = 1;
+	util_fit((fe_classes_link(classes, &classes->pool[i]) != 0));
+	classes->noe++;
+	name += strlen(name) + 1;
+    }
+    classes->capacity = header->classes;
+
+    if (header->classes > 0) {
+	memcpy(classes->total_noe, &base[header->total_offset],
+		header->classes * sizeof(uint32_t));
+    }
+    util_fit((fmat_map(classes->features, &base[header->features_offset], header->classes) != 0));
+
+    if (header->samples > 0) {
+	util_fit(((classes->samples = fmat_alloc(0, header->cols)) == NULL));
+	util_fit((fmat_map(classes->samples, &base[header->samples_offset], header->samples) != 0));
+
+	/* Labels are copied, learning more samples grows them */
+	util_fite(((classes->labels = (uint32_t *)malloc(header->samples *
+			    sizeof(uint32_t))) == NULL),
+		LOG_ERR("Labels allocation failed!\n"));
+	memcpy(classes->labels, &base[header->labels_offset], header->samples * sizeof(uint32_t));
+	for (i = 0; i < header->samples; i++) {
+	    util_fite((classes->labels[i] >= header->classes),
+		    LOG_ERR("Invalid sample class %u\n", classes->labels[i]));
+	}
+    }
+
+    if (header->quant_bits) {
+	util_fit(((classes->qsamples = qmat_map(&base[header->codes_offset],
+			    (double *)&base[header->quant_offset],
+			    (double *)&base[header->quant_offset] + header->quant_stride,
+			    header->samples, header->cols, header->quant_bits)) == NULL));
+	classes->quant_bits = header->quant_bits;
+	/* Re-ranking reads scattered rows, reading ahead would load them all */
+	page = header->samples_offset & ~((uint64_t)sysconf(_SC_PAGESIZE) - 1);
+	madvise(&base[page], header->samples_offset - page +
+		header->samples * (uint64_t)header->stride * sizeof(fmat_val_t), MADV_RANDOM);
+    }
+
+    /* Records are copied, paths are used in place */
+    if (header->files > 0) {
+	util_fite(((classes->learned = (learned_file_t *)calloc(header->files,
+			    sizeof(learned_file_t))) == NULL),
+		LOG_ERR("Learned files allocation failed\n"));
+	util_fite(((classes->keys = (learned_key_t *)calloc(header->files,
+			    sizeof(learned_key_t))) == NULL),
+		LOG_ERR("Learned keys allocation failed\n"));
+	classes->learned_capacity = header->files;
+    }
+    file = (const fdb_file_t *)&base[header->files_offset];
+    name = (const char *)&base[header->paths_offset];
+    for (i = 0; i < header->files; i++, file++) {
+	util_fite((file->index >= header->classes || file->path_offset >= header->paths_size ||
+		    file->sample > header->samples ||
+		    file->samples > header->samples - file->sample ||
+		    memchr(&name[file->path_offset], '\0',
+			header->paths_size - file->path_offset) == NULL),
+		LOG_ERR("Learned file %u is corrupted!\n", i));
+	classes->learned[i].path = (char *)&name[file->path_offset];
+	classes->learned[i].index = file->index;
+	classes->learned[i].regions = file->regions;
+	classes->learned[i].size = file->size;
+	classes->learned[i].mtime = file->mtime;
+	classes->learned[i].hash = file->hash;
+	classes->learned[i].sample = file->sample;
+	classes->learned[i].samples = file->samples;
+	classes->learned[i].mapped = 1;
+	memcpy(classes->learned[i].sum, file->sum, header->cols * sizeof(double));
+	classes->learned_noe++;
+    }
+
+    LOG_DBG("%u classes, %u samples, %u files mapped\n", header->classes, header->samples,
+	    header->files);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    if (map != MAP_FAILED) munmap(map, st.st_size);
+    fe_classes_free(&classes);
+
+success:
+    if (fd >= 0) close(fd);
+    return classes;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Writes the classes (and the samples and their codes if there are) as a binary db.
+ */
+int fdb_save(const char *filename, classes_t *classes)
+{
+    FILE *file = NULL;
+    int ret = 0;
+    uint32_t i = 0, samples = classes->samples ? classes->samples->rows : 0;
+    uint64_t row_size = (uint64_t)classes->features->stride * sizeof(fmat_val_t), offset = 0;
+    uint64_t code_row_size = 0;
+    class_t *current_class = classes->head;
+    const qmat_t *codes = classes->qsamples;
+    fdb_header_t header;
+    fdb_file_t record;
+
+    LOG_DBG("filename:'%s' classes:%p\n", filename, classes);
+
+    memset(&header, 0, sizeof(fdb_header_t));
+    memcpy(header.magic, FDB_MAGIC, FDB_MAGIC_LEN);
+    header.version = FDB_VERSION;
+    header.byte_order = FDB_BYTE_ORDER;
+    header.value_size = sizeof(fmat_val_t);
+    header.classes = classes->noe;
+    header.cols = classes->features->cols;
+    header.stride = classes->features->stride;
+    header.samples = samples;
+    header.files = classes->learned_noe;
+    /* Codes of other samples (a stale index) are not saved */
+    if (codes && samples > 0 && codes->rows == samples) {
+	header.quant_bits = codes->bits;
+	header.quant_stride = codes->stride;
+	code_row_size = (uint64_t)codes->stride * (codes->bits / 8);
+    }
+
+    for (i = 0; i < classes->set.noe; i++) {
+	header.set_size += strlen(freg_name(&classes->set, i)) + 1;
+    }
+    for (current_class = classes->head; current_class; current_class = current_class->next) {
+	header.names_size += strlen(current_class->name) + 1;
+    }
+    header.set_offset = FDB_ALIGN(sizeof(fdb_header_t));
+    header.names_offset = FDB_ALIGN(header.set_offset + header.set_size);
+    header.total_offset = FDB_ALIGN(header.names_offset + header.names_size);
+    header.features_offset = FDB_ALIGN(header.total_offset + classes->noe * sizeof(uint32_t));
+    header.labels_offset = FDB_ALIGN(header.features_offset + classes->noe * row_size);
+    header.quant_offset = FDB_ALIGN(header.labels_offset + samples * sizeof(uint32_t));
+    header.codes_offset = FDB_ALIGN(header.quant_offset +
+	    2 * (uint64_t)header.quant_stride * sizeof(double));
+    header.samples_offset = FDB_ALIGN(header.codes_offset + samples * code_row_size);
+    header.files_offset = FDB_ALIGN(header.samples_offset + samples * row_size);
+    header.paths_offset = FDB_ALIGN(header.files_offset +
+	    (uint64_t)header.files * sizeof(fdb_file_t));
+    for (i = 0; i < header.files; i++) {
+	header.paths_size += strlen(classes->learned[i].path) + 1;
+    }
+    header.size = header.paths_offset + header.paths_size;
+
+    util_fite(((file = fopen(filename, "wb")) == NULL),
+	    LOG_ERR("File open failed!\n"));
+    util_fite((fwrite(&header, sizeof(fdb_header_t), 1, file) != 1),
+	    LOG_ERR("fwrite failed\n"));
+
+    util_fit((_fdb_pad(file, header.set_offset) != 0));
+    for (i = 0; i < classes->set.noe; i++) {
+	util_fite((fwrite(freg_name(&classes->set, i), strlen(freg_name(&classes->set, i)) + 1,
+			1, file) != 1), LOG_ERR("fwrite failed\n"));
+    }
+
+    /* Names in row order, the class list is kept in that order */
+    util_fit((_fdb_pad(file, header.names_offset) != 0));
+    for (current_class = classes->head, i = 0; current_class;
+	    current_class = current_class->next, i++) {
+	util_fite((current_class->index != i), LOG_ERR("Class list is out of row order!\n"));
+	util_fite((fwrite(current_class->name, strlen(current_class->name) + 1, 1, file) != 1),
+		LOG_ERR("fwrite failed\n"));
+    }
+
+    util_fit((_fdb_pad(file, header.total_offset) != 0));
+    util_fite((fwrite(classes->total_noe, sizeof(uint32_t), classes->noe, file) != classes->noe),
+	    LOG_ERR("fwrite failed\n"));
+
+    util_fit((_fdb_pad(file, header.features_offset) != 0));
+    util_fite((fwrite(classes->features->data, row_size, classes->noe, file) != classes->noe),
+	    LOG_ERR("fwrite failed\n"));
+
+    util_fit((_fdb_pad(file, header.labels_offset) != 0));
+    util_fite((samples && fwrite(classes->labels, sizeof(uint32_t), samples, file) != samples),
+	    LOG_ERR("fwrite failed\n"));
+
+    if (header.quant_bits) {
+	util_fit((_fdb_pad(file, header.quant_offset) != 0));
+	util_fite((fwrite(codes->offset, sizeof(double), codes->stride, file) != codes->stride ||
+		    fwrite(codes->scale, sizeof(double), codes->stride, file) != codes->stride),
+		LOG_ERR("fwrite failed\n"));
+	util_fit((_fdb_pad(file, header.codes_offset) != 0));
+	util_fite((fwrite(codes->data, code_row_size, samples, file) != samples),
+		LOG_ERR("fwrite failed\n"));
+    }
+
+    util_fit((_fdb_pad(file, header.samples_offset) != 0));
+    util_fite((samples && fwrite(classes->samples->data, row_size, samples, file) != samples),
+	    LOG_ERR("fwrite failed\n"));
+
+    /* Paths follow the records in the same order */
+    util_fit((_fdb_pad(file, header.files_offset) != 0));
+    for (i = 0; i < header.files; i++) {
+	memset(&record, 0, sizeof(fdb_file_t));
+	record.path_offset = offset;
+	record.size = classes->learned[i].size;
+	record.mtime = classes->learned[i].mtime;
+	record.hash = classes->learned[i].hash;
+	record.index = classes->learned[i].index;
+	record.regions = classes->learned[i].regions;
+	record.sample = classes->learned[i].sample;
+	record.samples = classes->learned[i].samples;
+	memcpy(record.sum, classes->learned[i].sum, classes->set.noe * sizeof(double));
+	util_fite((fwrite(&record, sizeof(fdb_file_t), 1, file) != 1), LOG_ERR("fwrite failed\n"));
+	offset += strlen(classes->learned[i].path) + 1;
+    }
+
+    util_fit((_fdb_pad(file, header.paths_offset) != 0));
+    for (i = 0; i < header.files; i++) {
+	util_fite((fwrite(classes->learned[i].path, strlen(classes->learned[i].path) + 1, 1,
+			file) != 1), LOG_ERR("fwrite failed\n"));
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    if (file) fclose(file);
+    return ret;
+}
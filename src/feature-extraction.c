@@ -9,14 +9,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "log.h"
 #include "util.h"
 #include "bmp.h"
 #include "morphology.h"
-#include "moment.h"
+#include "feature-registry.h"
+#include "thread-pool.h"
+#include "match.h"
 #include "feature-extraction.h"
+#include "feature-db.h"
 
 #ifndef LOG_LEVEL_CONF_FE
 #define LOG_LEVEL LOG_LEVEL_ERR
@@ -26,201 +33,616 @@
 
 #define FILLED_RECT_SIZE    10
 #define FSCANF_READ_BUFLEN  256
+#define FSCANF_READ_LINE    "255"	/* FSCANF_READ_BUFLEN - 1 as a scanf width */
+#define FILE_HASH_BUFLEN    4096
+#define LEGACY_FEATURES	    "hu1,hu2,hu3,hu4,hu5,hu6,hu7" /* text dbs without a FEATURES line */
 
 /*------------------------------------------------------------------------------*/
-extern double fe_match_epsilon;  /* defined in test.c */
-
-/*------------------------------------------------------------------------------*/
-static features_t* _fe_get(image_t image, region_t region)
-{
-    uint8_t i = 0;
-    features_t *features = NULL;
-
-    util_fite(((features = (features_t *)calloc(1, sizeof(features_t))) == NULL),
-	    LOG_ERR("Features allocation failed!\n"));
-    features->noe = SUPPORTED_FEATURES_NOE;
-
-    util_fite(((features->feature = (double *)calloc(features->noe, sizeof(double))) == NULL),
-	    LOG_ERR("Features->feature allocation failed!\n"));
-
-    features->feature[0] = moment_normalized_central(image, region, 2, 0)
-	+ moment_normalized_central(image, region, 0, 2);
-
-    features->feature[1] = pow(moment_normalized_central(image, region, 2, 0)
-	    - moment_normalized_central(image, region, 0, 2), 2)
-	+ (moment_normalized_central(image, region, 1, 1) * 4);
-
-    features->feature[2] = pow(moment_normalized_central(image, region, 3, 0)
-	    - (3 * moment_normalized_central(image, region, 1, 2)), 2)
-	+ pow((3 * moment_normalized_central(image, region, 2, 1))
-		- moment_normalized_central(image, region, 0, 3), 2);
-
-    features->feature[3] = pow(moment_normalized_central(image, region, 3, 0)
-	    + moment_normalized_central(image, region, 1, 2), 2)
-	+ pow(moment_normalized_central(image, region, 2, 1)
-		+ moment_normalized_central(image, region, 0, 3), 2);
-
-    features->feature[4] = ((moment_normalized_central(image, region, 3, 0)
-		- (3 * moment_normalized_central(image, region, 1, 2)))
-	    * (moment_normalized_central(image, region, 3, 0)
-		+ moment_normalized_central(image, region, 1, 2))
-	    * ( (pow(moment_normalized_central(image, region, 3, 0)
-			+ moment_normalized_central(image, region, 1, 2), 2))
-		- ( 3 * pow(moment_normalized_central(image, region, 2, 1)
-			+ moment_normalized_central(image, region, 0, 3), 2)) ))
-	+ ((3 * moment_normalized_central(image, region, 2, 1)
-		    - moment_normalized_central(image, region, 0, 3))
-		* (moment_normalized_central(image, region, 2, 1)
-		    + moment_normalized_central(image, region, 0, 3))
-		* ( (3 * pow(moment_normalized_central(image, region, 3, 0)
-			    + moment_normalized_central(image, region, 1, 2), 2))
-		    - pow(moment_normalized_central(image, region, 2, 1)
-			+ moment_normalized_central(image, region, 0, 3), 2) ));
-
-    features->feature[5] = ( (moment_normalized_central(image, region, 2, 0)
-		- moment_normalized_central(image, region, 0, 2))
-	    * (pow(moment_normalized_central(image, region, 3, 0)
-		    + moment_normalized_central(image, region, 1, 2), 2)
-		- pow(moment_normalized_central(image, region, 2, 1)
-		    + moment_normalized_central(image, region, 0, 3), 2)) )
-	+ 4 * moment_normalized_central(image, region, 1, 1)
-	* (moment_normalized_central(image, region, 3, 0)
-		+ moment_normalized_central(image, region, 1, 2))
-	* (moment_normalized_central(image, region, 2, 1)
-		+ moment_normalized_central(image, region, 0, 3));
-
-    features->feature[6] = ((3 * moment_normalized_central(image, region, 2, 1)
-		- moment_normalized_central(image, region, 0, 3))
-	    * (moment_normalized_central(image, region, 3, 0)
-		+ moment_normalized_central(image, region, 1, 2))
-	    * ( pow(moment_normalized_central(image, region, 3, 0)
-		    + moment_normalized_central(image, region, 1, 2), 2)
-		- (3 * pow(moment_normalized_central(image, region, 2, 1)
-			+ moment_normalized_central(image, region, 0, 3), 2))))
-	- (moment_normalized_central(image, region, 3, 0)
-		- 3 * moment_normalized_central(image, region, 1, 2)
-		* (moment_normalized_central(image, region, 2, 1)
-		    + moment_normalized_central(image, region, 0, 3))
-		* (3 * pow(moment_normalized_central(image, region, 3, 0)
-			+ moment_normalized_central(image, region, 1, 2), 2)
-		    - pow(moment_normalized_central(image, region, 2, 1)
-			+ moment_normalized_central(image, region, 0, 3), 2)));
+extern double fe_match_epsilon;	    /* defined in test.c */
+extern match_mode_t fe_match_mode;  /* defined in test.c */
+extern uint8_t fe_keep_samples;	    /* defined in test.c */
+extern uint32_t fe_knn_k;	    /* defined in test.c */
+extern uint8_t fe_quant_bits;	    /* defined in test.c, zero disables quantized knn */
+extern const char *fe_features;	    /* defined in test.c */
+
+/*------------------------------------------------------------------------------*/
+/* Calculates the set columns of the region, shared intermediates are calculated once */
+static void _fe_get(image_t image, region_t region, const freg_set_t *set, fmat_val_t *feature)
+{
+    uint32_t i = 0;
+    freg_region_t r;
+
+    freg_region_init(&r, image, region);
+    for (i = 0; i < set->noe; i++) {
+	feature[i] = freg_feature(&r, set, i);
+    }
 
     LOG_DBG("Region %u: [%d,%d_%d,%d]\n", region.label, region.rect.x,
 	    region.rect.y, region.rect.width, region.rect.height);
-    for (i = 0; i < features->noe; i++) {
-	LOG_DBG("\tfeature[%u] = %f\n", i, features->feature[i]);
+    for (i = 0; i < set->noe; i++) {
+	LOG_DBG("\t%s = %f\n", freg_name(set, i), feature[i]);
     }
+}
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    image_t image;
+    regions_t regions;
+    const freg_set_t *set;
+    fmat_t *features;	/* regions.noe x set->noe */
+} fe_job_t;
+
+/*------------------------------------------------------------------------------*/
+static int _fe_get_job(void *arg, uint32_t index)
+{
+    fe_job_t *job = (fe_job_t *)arg;
+
+    _fe_get(job->image, job->regions.region[index], job->set, fmat_row(job->features, index));
+    return 0;
+}
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    image_t image;
+    regions_t regions;
+    const freg_set_t *set;
+    const uint32_t *order;  /* set columns in the order of their cost */
+    const match_index_t *index;
+    match_t *matches;	    /* regions.noe entries */
+    uint32_t *evaluated;    /* regions.noe entries, features asked by the cascade */
+} fe_cascade_job_t;
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    freg_region_t region;
+    const freg_set_t *set;
+} fe_cascade_region_t;
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _fe_cascade_feature(void *arg, uint32_t j)
+{
+    fe_cascade_region_t *r = (fe_cascade_region_t *)arg;
+
+    return freg_feature(&r->region, r->set, j);
+}
+
+/*------------------------------------------------------------------------------*/
+static int _fe_cascade_job(void *arg, uint32_t index)
+{
+    fe_cascade_job_t *job = (fe_cascade_job_t *)arg;
+    fe_cascade_region_t r = { .set = job->set };
+
+    freg_region_init(&r.region, job->image, job->regions.region[index]);
+    return match_cascade(job->index, job->order, _fe_cascade_feature, &r,
+	    fe_match_epsilon, &job->matches[index], &job->evaluated[index]);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Sums the feature rows into sum, in row order so the result does not depend on
+ * the thread count that calculated them.
+ */
+static void _fe_sum(const fmat_t *features, double *sum)
+{
+    uint32_t i = 0, j = 0;
+    const fmat_val_t *row = NULL;
+
+    memset(sum, 0, features->cols * sizeof(double));
+    for (i = 0; i < features->rows; i++) {
+	row = fmat_row(features, i);
+	for (j = 0; j < features->cols; j++) {
+	    sum[j] += row[j];
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Appends the feature rows to the sample store, labeled with class index.
+ */
+static int _fe_classes_add_samples(classes_t *classes, uint32_t index, const fmat_t *features)
+{
+    int ret = 0;
+    uint32_t i = 0;
+    uint32_t *labels = NULL;
+
+    if (classes->samples == NULL) {
+	util_fit(((classes->samples = fmat_alloc(0, classes->set.noe)) == NULL));
+    }
+    util_fit((fmat_reserve(classes->samples, classes->samples->rows + features->rows) != 0));
+
+    /* labels grow with the matrix capacity */
+    util_fite(((labels = (uint32_t *)realloc(classes->labels,
+			classes->samples->capacity * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Labels allocation failed!\n"));
+    classes->labels = labels;
+
+    for (i = 0; i < features->rows; i++) {
+	classes->labels[classes->samples->rows] = index;
+	util_fit((fmat_append(classes->samples, fmat_row(features, i)) < 0));
+    }
+
+    /* Indexes are built over the old rows */
+    kdtree_free(&classes->samples_tree);
+    qmat_free(&classes->qsamples);
 
     goto success;
 
 fail:
-    sfree_features(features);
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
 
 success:
-    return features;
+    return ret;
 }
 
 /*------------------------------------------------------------------------------*/
-static features_t* _fe_get_sum(image_t image, regions_t regions)
+static int _fe_file_stat(const char *path, uint64_t *size, int64_t *mtime)
 {
-    int i = 0, j = 0;
-    features_t *features = NULL, *temp_features = NULL;
+    int ret = 0;
+    struct stat st;
 
-    for (i = 0; i < regions.noe; i++) {
-	if (i == 0) {
-	    /* initialize features */
-	    util_fit(((features = _fe_get(image, regions.region[i])) == NULL));
-	} else {
-	    /* read into temp_features and add into features */
-	    util_fit(((temp_features = _fe_get(image, regions.region[i])) == NULL));
-	    for (j = 0; j < features->noe; j++) {
-		features->feature[j] += temp_features->feature[j];
+    util_fite((stat(path, &st) != 0), LOG_ERR("'%s' stat failed!\n", path));
+    *size = st.st_size;
+    *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _fe_file_hash(const char *path, uint64_t *hash)
+{
+    int ret = 0;
+    FILE *file = NULL;
+    uint8_t buf[FILE_HASH_BUFLEN];
+    size_t len = 0;
+
+    util_fite(((file = fopen(path, "rb")) == NULL), LOG_ERR("'%s' open failed!\n", path));
+
+    *hash = UTIL_FNV1A_INIT;
+    while ((len = fread(buf, 1, FILE_HASH_BUFLEN, file)) > 0) {
+	*hash = util_fnv1a(buf, len, *hash);
+    }
+    util_fite((ferror(file)), LOG_ERR("'%s' read failed!\n", path));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    if (file) fclose(file);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _fe_learned_key_cmp(const void *a, const void *b)
+{
+    return strcmp(((const learned_key_t *)a)->path, ((const learned_key_t *)b)->path);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns the learned record of path, NULL if it is not learned. Records
+ * appended after the last sort are scanned one by one, the keys are sorted again
+ * when they outnumber the sorted ones.
+ */
+static learned_file_t* _fe_learned_find(classes_t *classes, const char *path)
+{
+    uint32_t i = 0;
+    learned_key_t key = { .path = path, .index = 0 }, *found = NULL;
+
+    if (classes->learned_noe - classes->keys_noe > classes->keys_noe) {
+	for (i = 0; i < classes->learned_noe; i++) {
+	    classes->keys[i].path = classes->learned[i].path;
+	    classes->keys[i].index = i;
+	}
+	qsort(classes->keys, classes->learned_noe, sizeof(learned_key_t), _fe_learned_key_cmp);
+	classes->keys_noe = classes->learned_noe;
+    }
+
+    if (classes->keys_noe > 0) {
+	found = (learned_key_t *)bsearch(&key, classes->keys, classes->keys_noe,
+		sizeof(learned_key_t), _fe_learned_key_cmp);
+	if (found) return &classes->learned[found->index];
+    }
+    for (i = classes->keys_noe; i < classes->learned_noe; i++) {
+	if (strcmp(classes->learned[i].path, path) == 0) return &classes->learned[i];
+    }
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Takes the regions of a learned file back out of the running average of its
+ * class and drops its samples, the file is learned again after it is changed.
+ */
+static void _fe_classes_forget(classes_t *classes, learned_file_t *file)
+{
+    uint32_t i = 0;
+    fmat_val_t *avg = fmat_row(classes->features, file->index);
+    uint32_t *total_noe = &classes->total_noe[file->index];
+
+    if (file->regions >= *total_noe) {
+	memset(avg, 0, classes->features->cols * sizeof(fmat_val_t));
+	*total_noe = 0;
+    } else {
+	for (i = 0; i < classes->features->cols; i++) {
+	    avg[i] = (((double)avg[i] * *total_noe) - file->sum[i]) /
+		(*total_noe - file->regions);
+	}
+	*total_noe -= file->regions;
+    }
+
+    if (file->samples > 0) {
+	fmat_remove(classes->samples, file->sample, file->samples);
+	memmove(&classes->labels[file->sample], &classes->labels[file->sample + file->samples],
+		(classes->samples->rows - file->sample) * sizeof(uint32_t));
+	for (i = 0; i < classes->learned_noe; i++) {
+	    if (classes->learned[i].sample > file->sample) {
+		classes->learned[i].sample -= file->samples;
 	    }
-	    sfree_features(temp_features);
 	}
+	file->sample = file->samples = 0;
+
+	/* Indexes are built over the old rows */
+	kdtree_free(&classes->samples_tree);
+	qmat_free(&classes->qsamples);
     }
-    features->total_noe = regions.noe;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Fills the features selected with '-F' into set.
+ */
+int fe_features_selected(freg_set_t *set)
+{
+    return freg_set_parse(set, fe_features);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Allocates empty classes with a column for each feature of set.
+ */
+classes_t* fe_classes_alloc(const freg_set_t *set)
+{
+    classes_t *classes = NULL;
+
+    util_fite(((classes = (classes_t *)calloc(1, sizeof(classes_t))) == NULL),
+	    LOG_ERR("Classes allocation failed!\n"));
+    classes->set = *set;
+    util_fit(((classes->features = fmat_alloc(0, set->noe)) == NULL));
 
     goto success;
 
 fail:
-    LOG_ERR("%s failed!\n", __func__);
-    sfree_features(features);
-    sfree_features(temp_features);
+    fe_classes_free(&classes);
 
 success:
-    return features;
+    return classes;
+}
+
+/*------------------------------------------------------------------------------*/
+static uint64_t _fe_name_hash(const char *name)
+{
+    return util_fnv1a(name, strlen(name), UTIL_FNV1A_INIT);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns the slot of name in the class table, or the empty slot it would take.
+ * Table is never full, probing always ends.
+ */
+static uint32_t _fe_classes_slot(const classes_t *classes, const char *name)
+{
+    uint32_t mask = classes->table_size - 1;
+    uint32_t slot = _fe_name_hash(name) & mask;
+
+    while (classes->table[slot] != NULL && strcmp(classes->table[slot]->name, name) != 0) {
+	slot = (slot + 1) & mask;
+    }
+    return slot;
 }
 
 /*------------------------------------------------------------------------------*/
-class_t* fe_classes_insert(class_t **head, char *name, features_t *features)
+static int _fe_classes_rehash(classes_t *classes, uint32_t size)
 {
-    class_t *ptr = *head;
-    uint8_t i = 0;
+    int ret = 0;
+    uint32_t i = 0, old_size = classes->table_size;
+    class_t **old_table = classes->table;
 
-    if (*head == NULL) {
-	util_fite(((*head = (class_t *)calloc(1, sizeof(class_t))) == NULL),
-		LOG_ERR("Class first allocation failed\n"));
-	ptr = *head;
+    util_fite(((classes->table = (class_t **)calloc(size, sizeof(class_t *))) == NULL),
+	    LOG_ERR("Class table allocation failed\n"));
+    classes->table_size = size;
+
+    for (i = 0; i < old_size; i++) {
+	if (old_table[i] == NULL) continue;
+	classes->table[_fe_classes_slot(classes, old_table[i]->name)] = old_table[i];
+    }
+    sfree(old_table);
+
+    goto success;
+
+fail:
+    classes->table = old_table;
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Appends a named class node to the list and the name table, the caller sets
+ * its index. Fails if the name is already there.
+ */
+int fe_classes_link(classes_t *classes, class_t *_class)
+{
+    int ret = 0;
+    uint32_t slot = 0;
+
+    /* Keep the load factor at most one half */
+    if ((classes->noe + 1) * 2 > classes->table_size) {
+	util_fit((_fe_classes_rehash(classes, classes->table_size ?
+			classes->table_size * 2 : 16) != 0));
+    }
+
+    slot = _fe_classes_slot(classes, _class->name);
+    util_fite((classes->table[slot] != NULL),
+	    LOG_ERR("Class '%s' is already defined!\n", _class->name));
+    classes->table[slot] = _class;
+
+    _class->next = NULL;
+    if (classes->tail) {
+	classes->tail->next = _class;
     } else {
-	while (ptr->next != NULL) {
-	    ptr = ptr->next;
-	}
-	util_fite(((ptr->next = (class_t *)calloc(1, sizeof(class_t))) == NULL),
-		LOG_ERR("Class new allocation failed\n"));
-	ptr = ptr->next;
+	classes->head = _class;
     }
+    classes->tail = _class;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Appends a class, its features row is copied from features (zeros if NULL).
+ */
+class_t* fe_classes_insert(classes_t *classes, char *name, const fmat_val_t *features,
+	uint32_t total_noe)
+{
+    class_t *ptr = NULL;
+    uint32_t *total = NULL;
+    int32_t index = 0;
+
+    util_fite(((ptr = (class_t *)calloc(1, sizeof(class_t))) == NULL),
+	    LOG_ERR("Class new allocation failed\n"));
     util_fite(((ptr->name = strdup(name)) == NULL),
 	    LOG_ERR("Duplicating class name failed\n"));
-    if (features != NULL) {
-	util_fite(((ptr->features = (features_t *)calloc(1, sizeof(features_t))) == NULL),
-		LOG_ERR("Features allocation failed!\n"));
-	ptr->features->total_noe = features->total_noe;
-	ptr->features->noe = features->noe;
-	util_fite(((ptr->features->feature = (double *)calloc(features->noe, sizeof(double))) == NULL),
-		LOG_ERR("Features->feature allocation failed!\n"));
-	for (i = 0; i < features->noe; i++) {
-	    ptr->features->feature[i] = features->feature[i];
-	}
+
+    if (classes->noe == classes->capacity) {
+	util_fite(((total = (uint32_t *)realloc(classes->total_noe,
+			    (classes->capacity * 2 + 1) * sizeof(uint32_t))) == NULL),
+		LOG_ERR("Classes total_noe allocation failed\n"));
+	classes->total_noe = total;
+	classes->capacity = classes->capacity * 2 + 1;
+    }
+    util_fit(((index = fmat_append(classes->features, features)) < 0));
+    if (fe_classes_link(classes, ptr) != 0) {
+	/* Drop the row again, nothing refers to it */
+	classes->features->rows--;
+	goto fail;
     }
+
+    ptr->index = index;
+    classes->total_noe[index] = total_noe;
+    classes->noe++;
     LOG_DBG("Class %p - '%s' added\n", ptr, name);
 
     goto success;
 
 fail:
     if (ptr) sfree(ptr->name);
-    if (ptr == *head) {
-	sfree(*head);
-	ptr = NULL;
-    } else {
-	sfree(ptr);
-    }
+    sfree(ptr);
 
 success:
     return ptr;
 }
 
 /*------------------------------------------------------------------------------*/
-int fe_classes_update(class_t *_class, image_t image, regions_t regions)
+/*
+ * Returns the class with the given name, NULL if there is not.
+ */
+class_t* fe_classes_find(classes_t *classes, const char *name)
+{
+    if (classes->table_size == 0) return NULL;
+    return classes->table[_fe_classes_slot(classes, name)];
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Appends a zeroed learned file record for path.
+ */
+learned_file_t* fe_classes_learned_append(classes_t *classes, const char *path)
+{
+    learned_file_t *learned = NULL;
+    learned_key_t *keys = NULL;
+
+    if (classes->learned_noe == classes->learned_capacity) {
+	util_fite(((learned = (learned_file_t *)realloc(classes->learned,
+			    (classes->learned_capacity * 2 + 1) * sizeof(learned_file_t))) == NULL),
+		LOG_ERR("Learned files allocation failed\n"));
+	classes->learned = learned;
+	util_fite(((keys = (learned_key_t *)realloc(classes->keys,
+			    (classes->learned_capacity * 2 + 1) * sizeof(learned_key_t))) == NULL),
+		LOG_ERR("Learned keys allocation failed\n"));
+	classes->keys = keys;
+	classes->learned_capacity = classes->learned_capacity * 2 + 1;
+    }
+
+    learned = &classes->learned[classes->learned_noe];
+    memset(learned, 0, sizeof(learned_file_t));
+    util_fite(((learned->path = strdup(path)) == NULL),
+	    LOG_ERR("Duplicating file path failed\n"));
+    classes->learned_noe++;
+
+    goto success;
+
+fail:
+    learned = NULL;
+
+success:
+    return learned;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns 1 if path is learned into _class and not changed since. The size and
+ * mtime are checked first, the content hash only if they differ (a touched file
+ * is not learned again). A file moved to another class is learned again.
+ */
+uint8_t fe_classes_learned_unchanged(classes_t *classes, const class_t *_class,
+	const char *path)
+{
+    uint64_t size = 0, hash = 0;
+    int64_t mtime = 0;
+    learned_file_t *file = NULL;
+
+    if ((file = _fe_learned_find(classes, path)) == NULL) return 0;
+    file->seen = 1;
+    if (file->index != _class->index) return 0;
+    if (_fe_file_stat(path, &size, &mtime) != 0 || size != file->size) return 0;
+    if (mtime == file->mtime) return 1;
+
+    if (_fe_file_hash(path, &hash) != 0 || hash != file->hash) return 0;
+    file->mtime = mtime;
+    return 1;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Forgets the learned files that are not seen (checked or folded) since the db
+ * is loaded, they are deleted or dropped from the class image list. Returns the
+ * number of forgotten files.
+ */
+uint32_t fe_classes_learned_prune(classes_t *classes)
+{
+    uint32_t i = 0, noe = 0;
+    learned_file_t *file = NULL;
+
+    /* Forgetting moves the sample rows of the other records, compact after */
+    for (i = 0; i < classes->learned_noe; i++) {
+	file = &classes->learned[i];
+	if (file->seen) continue;
+	LOG_INFO("'%s' is not listed anymore, forgotten\n", file->path);
+	_fe_classes_forget(classes, file);
+    }
+    for (i = 0; i < classes->learned_noe; i++) {
+	file = &classes->learned[i];
+	if (file->seen) {
+	    if (noe != i) classes->learned[noe] = *file;
+	    noe++;
+	} else if (!file->mapped) {
+	    sfree(file->path);
+	}
+    }
+
+    i = classes->learned_noe - noe;
+    classes->learned_noe = noe;
+    /* Records moved, the keys are sorted again on the next lookup */
+    classes->keys_noe = 0;
+
+    return i;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Fills the size, mtime and content hash of path into state, the path pointer
+ * is stored as is.
+ */
+int fe_learned_state(const char *path, learned_file_t *state)
+{
+    int ret = 0;
+
+    memset(state, 0, sizeof(learned_file_t));
+    state->path = (char *)path;
+    util_fit((_fe_file_stat(path, &state->size, &state->mtime) != 0));
+    util_fit((_fe_file_hash(path, &state->hash) != 0));
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Folds the region features (rows of features) into the running average of the
+ * class, they are also kept as samples if fe_keep_samples is set. The image file
+ * (if state is given) is recorded as learned, a file learned before is taken out
+ * of its class first.
+ */
+int fe_classes_fold(classes_t *classes, class_t *_class, const learned_file_t *state,
+	const fmat_t *features)
 {
     int ret = 0, i = 0;
-    features_t *features = NULL;
+    double sum[FE_CONF_MAX_FEATURES];
+    fmat_val_t *avg = fmat_row(classes->features, _class->index);
+    uint32_t *total_noe = &classes->total_noe[_class->index];
+    learned_file_t *file = NULL;
 
-    if (_class->features == NULL) {
-	util_fit(((_class->features = fe_get_avg(image, regions)) == NULL));
-    } else {
-	util_fit(((features = _fe_get_sum(image, regions)) == NULL));
-	/* Calculate new avg */
-	for (i = 0; i < _class->features->noe; i++) {
-	    _class->features->feature[i] =
-		((_class->features->feature[i] * _class->features->total_noe) +
-		    (features->feature[i])) /
-		(_class->features->total_noe + features->total_noe);
-	    _class->features->total_noe += features->total_noe;
+    _fe_sum(features, sum);
+
+    if (state) {
+	if ((file = _fe_learned_find(classes, state->path)) != NULL) {
+	    _fe_classes_forget(classes, file);
+	} else {
+	    util_fit(((file = fe_classes_learned_append(classes, state->path)) == NULL));
 	}
+	file->index = _class->index;
+	file->seen = 1;
+	file->regions = features->rows;
+	file->size = state->size;
+	file->mtime = state->mtime;
+	file->hash = state->hash;
+	file->sample = file->samples = 0;
+	memcpy(file->sum, sum, features->cols * sizeof(double));
+    }
+
+    /* No regions, nothing to fold (the average would be 0/0 for an empty class) */
+    if (features->rows == 0) {
+	goto success;
     }
 
+    if (fe_keep_samples) {
+	if (file) {
+	    file->sample = classes->samples ? classes->samples->rows : 0;
+	    file->samples = features->rows;
+	}
+	util_fit((_fe_classes_add_samples(classes, _class->index, features) != 0));
+    }
+
+    /* Calculate new avg */
+    for (i = 0; i < features->cols; i++) {
+	avg[i] = (((double)avg[i] * *total_noe) + sum[i]) / (*total_noe + features->rows);
+    }
+    *total_noe += features->rows;
+
     goto success;
 
 fail:
@@ -228,143 +650,289 @@ fail:
     ret = -1;
 
 success:
-    sfree_features(features);
     return ret;
 }
 
 /*------------------------------------------------------------------------------*/
-void fe_classes_free(class_t **head)
+/*
+ * Calculates the features of the regions and folds them into the class, see
+ * fe_classes_fold.
+ */
+int fe_classes_update(classes_t *classes, class_t *_class, const char *filename,
+	image_t image, regions_t regions)
 {
-    class_t *ptr = *head, *current = NULL;
+    int ret = 0;
+    fmat_t *features = NULL;
+    learned_file_t state;
 
+    util_fit(((features = fe_get_all(image, regions, &classes->set)) == NULL));
+    if (filename) util_fit((fe_learned_state(filename, &state) != 0));
+    util_fit((fe_classes_fold(classes, _class, filename ? &state : NULL, features) != 0));
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree_fmat(features);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+void fe_classes_free(classes_t **classes)
+{
+    uint32_t i = 0;
+    class_t *ptr = NULL, *current = NULL;
+
+    if (*classes == NULL) return;
+
+    ptr = (*classes)->head;
     while (ptr != NULL) {
-	sfree(ptr->name);
 	util_sl_free(&(ptr->files));
-	sfree_features(ptr->features);
 
 	current = ptr;
 	ptr = ptr->next;
-	sfree(current);
+	if (!current->mapped) {
+	    sfree(current->name);
+	    sfree(current);
+	}
     }
-    *head = NULL;
+    sfree((*classes)->pool);
+    sfree((*classes)->table);
+    sfree((*classes)->total_noe);
+    sfree_fmat((*classes)->features);
+    match_index_free(&(*classes)->index);
+    sfree_fmat((*classes)->samples);
+    sfree((*classes)->labels);
+    kdtree_free(&(*classes)->samples_tree);
+    qmat_free(&(*classes)->qsamples);
+    for (i = 0; i < (*classes)->learned_noe; i++) {
+	if (!(*classes)->learned[i].mapped) sfree((*classes)->learned[i].path);
+    }
+    sfree((*classes)->learned);
+    sfree((*classes)->keys);
+    /* Matrices are freed above, nothing points into the mapping anymore */
+    if ((*classes)->map) munmap((*classes)->map, (*classes)->map_size);
+    sfree(*classes);
 }
 
 /*------------------------------------------------------------------------------*/
-features_t* fe_get_avg(image_t image, regions_t regions)
+/*
+ * Calculates the set features of all regions on the thread pool. Row i of the
+ * returned regions.noe x set->noe matrix holds the features of region i.
+ */
+fmat_t* fe_get_all(image_t image, regions_t regions, const freg_set_t *set)
 {
-    int i = 0;
-    features_t *features = NULL;
+    uint32_t i = 0;
+    uint64_t *costs = NULL;
+    fe_job_t job = { .image = image, .regions = regions, .set = set, .features = NULL };
+
+    util_fit(((job.features = fmat_alloc(regions.noe, set->noe)) == NULL));
+    util_fite(((costs = (uint64_t *)malloc(regions.noe * sizeof(uint64_t))) == NULL),
+	    LOG_ERR("Costs allocation failed!\n"));
 
-    util_fit(((features = _fe_get_sum(image, regions)) == NULL));
+    /* Moments scan the whole region frame, use its area as the cost */
+    for (i = 0; i < regions.noe; i++) {
+	costs[i] = (uint64_t)(regions.region[i].rect.width + 1) *
+	    (regions.region[i].rect.height + 1);
+    }
+
+    util_fit((tpool_run(regions.noe, costs, _fe_get_job, &job) != 0));
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    sfree_fmat(job.features);
+
+success:
+    sfree(costs);
+    return job.features;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns the average of the rows of all as a single row matrix.
+ */
+fmat_t* fe_avg(const fmat_t *all)
+{
+    uint32_t i = 0;
+    double sum[FE_CONF_MAX_FEATURES];
+    fmat_t *features = NULL;
+
+    _fe_sum(all, sum);
+    util_fit(((features = fmat_alloc(1, all->cols)) == NULL));
 
     /* Calculate avg and return */
-    for (i = 0; i < features->noe; i++) {
-	features->feature[i] /= features->total_noe;
+    for (i = 0; i < all->cols; i++) {
+	features->data[i] = sum[i] / all->rows;
     }
 
     goto success;
 
 fail:
     LOG_ERR("%s failed!\n", __func__);
-    sfree_features(features);
 
 success:
     return features;
 }
 
 /*------------------------------------------------------------------------------*/
-int fe_test(image_t image, regions_t regions, class_t classes, image_t final_image)
+/*
+ * Returns the average features of the regions as a single row matrix.
+ */
+fmat_t* fe_get_avg(image_t image, regions_t regions, const freg_set_t *set)
 {
-    int i = 0, j = 0, ret = 0, class_count = 0, matched_class_index = 0;
-    uint8_t *matched_classes = NULL, max = 0, identified = 0;
-    features_t *features = NULL;
-    class_t *current_class = NULL;
-    double val = 0, min = 0;
-    rectangle_t rect = { .x = 0, .y = 0, .height = FILLED_RECT_SIZE,
-	.width = FILLED_RECT_SIZE };
+    fmat_t *all = NULL, *features = NULL;
 
-    current_class = &classes;
-    while (current_class != NULL) {
-	class_count++;
-	current_class = current_class->next;
-    }
+    util_fit(((all = fe_get_all(image, regions, set)) == NULL));
+    util_fit(((features = fe_avg(all)) == NULL));
 
-    util_fit(((matched_classes = (uint8_t *)calloc(1, class_count * sizeof(uint8_t))) == NULL));
+    goto success;
 
-    for (i = 0; i < regions.noe; i++) {
-	util_fit(((features = _fe_get(image, regions.region[i])) == NULL));
-
-	identified = 0;
-	for (j = 0; j < features->noe; j++) {
-	    /* initial to first class */
-	    min = fabs(classes.features->feature[j] - features->feature[j]);
-	    matched_class_index = 0;
-
-	    /* check for other classes */
-	    current_class = classes.next;
-	    while (current_class != NULL) {
-		val = fabs(current_class->features->feature[j] - features->feature[j]);
-		if (val < min) {
-		    min = val;
-		    matched_class_index = current_class->index;
-		}
-		current_class = current_class->next;
-	    }
+fail:
+    LOG_ERR("%s failed!\n", __func__);
 
-	    if (min < fe_match_epsilon) {
-		matched_classes[matched_class_index]++;
-		identified = 1;
-	    }
+success:
+    sfree_fmat(all);
+    return features;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Cascade mode calculates the features of each region lazily, see match_cascade.
+ * How many features it evaluated is collected in stats (may be NULL).
+ */
+static int _fe_test_cascade(image_t image, regions_t regions, classes_t *classes,
+	match_t *matches, fe_cascade_stats_t *stats)
+{
+    int ret = 0;
+    uint32_t i = 0;
+    uint32_t order[FE_CONF_MAX_FEATURES];
+    uint64_t *costs = NULL;
+    fe_cascade_job_t job = { .image = image, .regions = regions, .set = &classes->set,
+	.order = order, .index = classes->index, .matches = matches, .evaluated = NULL };
+
+    freg_set_order(&classes->set, order);
+
+    util_fite(((job.evaluated = (uint32_t *)calloc(regions.noe, sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Evaluated allocation failed!\n"));
+    util_fite(((costs = (uint64_t *)malloc(regions.noe * sizeof(uint64_t))) == NULL),
+	    LOG_ERR("Costs allocation failed!\n"));
+
+    for (i = 0; i < regions.noe; i++) {
+	costs[i] = (uint64_t)(regions.region[i].rect.width + 1) *
+	    (regions.region[i].rect.height + 1);
+    }
+    util_fit((tpool_run(regions.noe, costs, _fe_cascade_job, &job) != 0));
+
+    if (stats) {
+	memset(stats, 0, sizeof(fe_cascade_stats_t));
+	stats->regions = regions.noe;
+	for (i = 0; i < regions.noe; i++) {
+	    stats->evaluated += job.evaluated[i];
+	    stats->histogram[job.evaluated[i]]++;
 	}
+    }
 
-	if (!identified) continue;
+    goto success;
 
-	matched_class_index = 0;
-	max = matched_classes[matched_class_index];
-	matched_classes[matched_class_index] = 0;
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
 
-	current_class = classes.next;
-	while (current_class != NULL) {
-	    if (max < matched_classes[current_class->index]) {
-		matched_class_index = current_class->index;
-		max = matched_classes[matched_class_index];
-	    }
-	    /* also clear the array in this loop */
-	    matched_classes[current_class->index] = 0;
-	    current_class = current_class->next;
+success:
+    sfree(job.evaluated);
+    sfree(costs);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+int fe_test(image_t image, regions_t regions, classes_t classes, image_t final_image,
+	const draw_format_t *format, fe_cascade_stats_t *stats)
+{
+    int ret = 0;
+    uint32_t i = 0;
+    fmat_t *features = NULL;
+    match_t *matches = NULL;
+    rectangle_t rect = { .x = 0, .y = 0, .height = FILLED_RECT_SIZE,
+	.width = FILLED_RECT_SIZE };
+    draw_list_t marks = { .cmds = NULL, .noe = 0, .capacity = 0 };
+    draw_cmd_t cmd;
+
+    util_fite((classes.noe == 0), LOG_ERR("There is no class!\n"));
+    util_fite(((matches = (match_t *)calloc(regions.noe, sizeof(match_t))) == NULL),
+	    LOG_ERR("Matches allocation failed!\n"));
+
+    /* Cascade calculates only the features it needs */
+    if (fe_match_mode != MATCH_MODE_CASCADE) {
+	util_fit(((features = fe_get_all(image, regions, &classes.set)) == NULL));
+    }
+
+    if (fe_match_mode == MATCH_MODE_CASCADE) {
+	util_fit((_fe_test_cascade(image, regions, &classes, matches, stats) != 0));
+    } else if (fe_match_mode == MATCH_MODE_KNN) {
+	util_fite((classes.samples_tree == NULL && classes.qsamples == NULL),
+		LOG_ERR("There is no sample, learn with -S to keep them!\n"));
+	if (classes.qsamples) {
+	    util_fit((match_knn_quant(features, classes.qsamples, classes.samples,
+			    classes.labels, fe_knn_k, fe_match_epsilon, matches) != 0));
+	} else {
+	    util_fit((match_knn(features, classes.samples_tree, classes.labels, fe_knn_k,
+			    fe_match_epsilon, matches) != 0));
 	}
+    } else {
+	util_fit((match_regions(features, classes.features, classes.index, fe_match_mode,
+			fe_match_epsilon, matches) != 0));
+    }
+
+    /* Marks are queued and drawn tile by tile at once */
+    for (i = 0; i < regions.noe; i++) {
+	if (matches[i].index < 0) continue;
+
+	LOG_DBG("Region %u -> class %d (score %f)\n", i, matches[i].index, matches[i].score);
+
 	/* Draw a rectangle around the region with class color */
-	draw_rect(final_image, regions.region[i].rect, 0, matched_class_index);
+	cmd.shape = DRAW_RECT;
+	cmd.color = matches[i].index;
+	cmd.orig_center = 0;
+	cmd.rect = regions.region[i].rect;
+	util_fit((draw_list_add(&marks, &cmd) != 0));
 
 	/* Draw a filled rectangle to the left-top corner with class color */
-	rect.x = regions.region[i].rect.x;
-	rect.y = regions.region[i].rect.y;
-	draw_filled_rect(final_image, rect, 0, matched_class_index);
+	cmd.shape = DRAW_FILLED_RECT;
+	cmd.rect = rect;
+	cmd.rect.x = regions.region[i].rect.x;
+	cmd.rect.y = regions.region[i].rect.y;
+	util_fit((draw_list_add(&marks, &cmd) != 0));
 
 	/* TODO: Allow user to define class colors with formatted input files.
 	 *       Add color-class relation into image corner.
 	 *       Add percentage into region corner. */
-
-	sfree_features(features);
     }
+    util_fit((draw_list_render(final_image, format, &marks) != 0));
 
     goto success;
 
 fail:
     LOG_ERR("%s failed!\n", __func__);
     ret = -1;
-    sfree_features(features);
 
 success:
-    sfree(matched_classes);
+    sfree_fmat(features);
+    sfree(matches);
+    draw_list_free(&marks);
     return ret;
 }
 
 /*------------------------------------------------------------------------------*/
-int fe_save(const char *filename, features_t features)
+int fe_save(const char *filename, fmat_t features)
 {
     FILE *file = NULL;
-    int i = 0, ret = 0;
+    int ret = 0;
+    uint32_t i = 0;
 
     LOG_DBG("filename:'%s' features:%p\n", filename, &features);
 
@@ -372,11 +940,11 @@ int fe_save(const char *filename, features_t features)
 	    LOG_ERR("File open failed!\n"));
 
     /* Write noe first */
-    util_fite((fprintf(file, "%u\n", features.noe) < 0), LOG_ERR("fprintf failed\n"));
+    util_fite((fprintf(file, "%u\n", features.cols) < 0), LOG_ERR("fprintf failed\n"));
 
     /* Write result to file */
-    for (i = 0; i < features.noe; i++) {
-	util_fite((fprintf(file, "%f\n", features.feature[i]) < 0),
+    for (i = 0; i < features.cols; i++) {
+	util_fite((fprintf(file, "%f\n", features.data[i]) < 0),
 		LOG_ERR("fprintf failed\n"));
     }
 
@@ -394,83 +962,227 @@ success:
 }
 
 /*------------------------------------------------------------------------------*/
-class_t* fe_load_classes_with_features(const char *filename)
+static classes_t* _fe_load_classes_text(const char *filename)
 {
     FILE *file = NULL;
-    /* Points to classes head pointer and store all classes */
-    class_t *classes = NULL, *current_class = NULL;
+    /* Stores all classes, features are read into the class matrix directly */
+    classes_t *classes = NULL;
+    class_t *current_class = NULL;
     char buf[FSCANF_READ_BUFLEN];
-    uint8_t i = 0, class_index = 0;
-    features_t features = { .total_noe = 0, .noe = 0, .feature = NULL };
+    uint32_t i = 0, noe = 0, total_noe = 0, index = 0;
+    fmat_val_t *row = NULL;
+    fmat_t *sample = NULL;
+    learned_file_t *learned = NULL, state;
+    freg_set_t set = { .noe = 0 };
 
     LOG_DBG("filename:'%s'\n", filename);
 
     util_fite(((file = fopen(filename, "r")) == NULL),
 	    LOG_ERR("File open failed!\n"));
 
-    do {
+    /* Feature names lead the db, older dbs have the Hu invariants */
+    util_fite((fscanf(file, "%s", buf) < 0), LOG_ERR("Reading file failed\n"));
+    if (strcmp(buf, "FEATURES") == 0) {
+	util_fite((fscanf(file, "%u", &noe) != 1), LOG_ERR("Reading features number failed\n"));
+	for (i = 0; i < noe; i++) {
+	    util_fite((fscanf(file, "%s", buf) != 1), LOG_ERR("Reading feature[%u] failed\n", i));
+	    util_fit((freg_set_add(&set, buf) != 0));
+	}
+	util_fite((set.noe == 0), LOG_ERR("Db has no feature!\n"));
 	util_fite((fscanf(file, "%s", buf) < 0), LOG_ERR("Reading file failed\n"));
+    } else {
+	util_fit((freg_set_parse(&set, LEGACY_FEATURES) != 0));
+    }
+
+    util_fit(((classes = fe_classes_alloc(&set)) == NULL));
+    /* Single zero row, samples are appended with it then read in place */
+    util_fit(((sample = fmat_alloc(1, set.noe)) == NULL));
+
+    /* buf holds the next keyword, it is read at the end of each entry */
+    do {
 	if (strcmp(buf, "CLASS") == 0) {
-	    features.total_noe = features.noe = 0;
-	    util_fite((fscanf(file, "%s %u %hhu", buf, &features.total_noe, &features.noe) < 0),
+	    total_noe = noe = 0;
+	    util_fite((fscanf(file, "%s %u %u", buf, &total_noe, &noe) < 0),
 		    LOG_ERR("Reading class name and features numbers\n"));
-	    util_fite((features.noe != SUPPORTED_FEATURES_NOE),
+	    util_fite((noe != set.noe),
 		    LOG_ERR("Unsupported features number of entries. (%u != %u)\n",
-			features.noe, SUPPORTED_FEATURES_NOE));
+			noe, set.noe));
+
+	    util_fit(((current_class = fe_classes_insert(classes, buf, NULL, total_noe)) == NULL));
 
-	    util_fite(((features.feature = (double *)calloc(features.noe, sizeof(double))) == NULL),
-		    LOG_ERR("Features->feature allocation failed!\n"));
-	    for (i = 0; i < features.noe; i++) {
-		util_fite((fscanf(file, "%lf", &features.feature[i]) < 0),
+	    row = fmat_row(classes->features, current_class->index);
+	    for (i = 0; i < noe; i++) {
+		util_fite((fscanf(file, FMAT_VAL_SF, &row[i]) < 0),
 			LOG_ERR("Reading feature[%u] failed\n", i));
 	    }
-
-	    util_fit(((current_class = fe_classes_insert(&classes, buf, &features)) == NULL));
-
-	    sfree(features.feature);
-	    current_class->index = class_index++;
+	} else if (strcmp(buf, "FILE") == 0) {
+	    util_fite((fscanf(file, "%u %u %" SCNu64 " %" SCNd64 " %" SCNx64 " %u %u", &index,
+			    &state.regions, &state.size, &state.mtime, &state.hash, &state.sample,
+			    &state.samples) != 7),
+		    LOG_ERR("Reading learned file failed\n"));
+	    util_fite((index >= classes->noe), LOG_ERR("Invalid learned file class %u\n", index));
+	    for (i = 0; i < set.noe; i++) {
+		util_fite((fscanf(file, "%lf", &state.sum[i]) != 1),
+			LOG_ERR("Reading learned file sum[%u] failed\n", i));
+	    }
+	    /* Path is the rest of the line, it may have spaces */
+	    util_fite((fscanf(file, " %" FSCANF_READ_LINE "[^\n]", buf) != 1),
+		    LOG_ERR("Reading learned file path failed\n"));
+
+	    util_fit(((learned = fe_classes_learned_append(classes, buf)) == NULL));
+	    learned->index = index;
+	    learned->regions = state.regions;
+	    learned->size = state.size;
+	    learned->mtime = state.mtime;
+	    learned->hash = state.hash;
+	    learned->sample = state.sample;
+	    learned->samples = state.samples;
+	    memcpy(learned->sum, state.sum, set.noe * sizeof(double));
+	} else if (strcmp(buf, "SAMPLE") == 0) {
+	    /* Class index refers to the classes above in saved order */
+	    util_fite((fscanf(file, "%u", &index) < 0), LOG_ERR("Reading sample class failed\n"));
+	    util_fite((index >= classes->noe), LOG_ERR("Invalid sample class %u\n", index));
+
+	    util_fit((_fe_classes_add_samples(classes, index, sample) != 0));
+	    row = fmat_row(classes->samples, classes->samples->rows - 1);
+	    for (i = 0; i < set.noe; i++) {
+		util_fite((fscanf(file, FMAT_VAL_SF, &row[i]) < 0),
+			LOG_ERR("Reading sample feature[%u] failed\n", i));
+	    }
 	} else if (strcmp(buf, "EOF") == 0) {
 	    break;
 	}
+	util_fite((fscanf(file, "%s", buf) < 0), LOG_ERR("Reading file failed\n"));
     } while (1); /* Reading EOF or fscanf fail will break the loop*/
 
+    /* Samples follow the files, their rows are known only now */
+    for (i = 0; i < classes->learned_noe; i++) {
+	learned = &classes->learned[i];
+	util_fite((learned->samples > 0 && (classes->samples == NULL ||
+			learned->sample > classes->samples->rows ||
+			learned->samples > classes->samples->rows - learned->sample)),
+		LOG_ERR("Invalid samples of learned file '%s'\n", learned->path));
+    }
+
     goto success;
 
 fail:
     fe_classes_free(&classes);
-    sfree(features.feature);
 
 success:
+    sfree_fmat(sample);
     if (file) fclose(file);
     return classes;
 }
 
 /*------------------------------------------------------------------------------*/
-class_t* fe_load_classes(const char *filename)
+/*
+ * Loads a text or binary (detected by its magic) db.
+ */
+classes_t* fe_load_classes_with_features(const char *filename)
+{
+    if (fdb_is_binary(filename)) return fdb_load(filename);
+    return _fe_load_classes_text(filename);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Quantizes the samples to bits wide codes, the codes at hand (kept in a binary
+ * db) are used if they have the same width.
+ */
+static int _fe_classes_quantize(classes_t *classes, uint8_t bits)
+{
+    int ret = 0;
+
+    util_sit((classes->samples == NULL || classes->samples->rows == 0));
+    util_sit((classes->qsamples && classes->qsamples->bits == bits));
+
+    qmat_free(&classes->qsamples);
+    util_fit(((classes->qsamples = qmat_build(classes->samples, bits)) == NULL));
+    LOG_DBG("%u samples quantized to %u bits\n", classes->samples->rows, bits);
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Indexes the classes and the samples once, every test region queries them.
+ * The samples are searched by their codes if the db keeps them or fe_quant_bits
+ * is set, the tree is built only otherwise.
+ */
+int fe_classes_index(classes_t *classes)
+{
+    int ret = 0;
+
+    if (classes->noe > 0 && classes->index == NULL) {
+	util_fit(((classes->index = match_index_build(classes->features)) == NULL));
+    }
+    if (fe_quant_bits) {
+	util_fit((_fe_classes_quantize(classes, fe_quant_bits) != 0));
+    }
+    if (classes->samples && classes->qsamples == NULL && classes->samples_tree == NULL) {
+	util_fit(((classes->samples_tree = kdtree_build(classes->samples)) == NULL));
+	LOG_DBG("%u samples indexed\n", classes->samples->rows);
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+classes_t* fe_load_classes(const char *filename)
 {
     FILE *file = NULL;
-    /* Points to classes head pointer and store all classes */
-    class_t *classes = NULL, *current_class = NULL;
-    char buf[FSCANF_READ_BUFLEN];
-    uint8_t class_index = 0;
+    /* Stores all classes */
+    classes_t *classes = NULL;
+    class_t *current_class = NULL;
+    char buf[FSCANF_READ_BUFLEN], line[FSCANF_READ_BUFLEN];
+    size_t len = 0;
+    freg_set_t set;
 
     LOG_DBG("filename:'%s'\n", filename);
 
     util_fite(((file = fopen(filename, "r")) == NULL),
 	    LOG_ERR("File open failed!\n"));
 
+    /* Classes are learned with the selected features */
+    util_fit((fe_features_selected(&set) != 0));
+    util_fit(((classes = fe_classes_alloc(&set)) == NULL));
+
     do {
 	util_fite((fscanf(file, "%s", buf) < 0), LOG_ERR("Reading file failed\n"));
 	if (strcmp(buf, "CLASS") == 0) {
 	    util_fite((fscanf(file, "%s", buf) < 0), LOG_ERR("Reading class name failed\n"));
-	    util_fit(((current_class = fe_classes_insert(&classes, buf, NULL)) == NULL));
-	    current_class->index = class_index++;
+	    util_fit(((current_class = fe_classes_insert(classes, buf, NULL, 0)) == NULL));
 	} else if (strcmp(buf, "EOF") == 0) {
 	    break;
 	} else {
 	    util_fite((current_class == NULL),
 		    LOG_ERR("Current class is NULL, invalid file format\n"));
-	    util_fit((util_sl_insert(&current_class->files, buf) == NULL));
+	    /* File path is the rest of the line, it may have spaces */
+	    line[0] = '\0';
+	    if (fscanf(file, "%" FSCANF_READ_LINE "[^\n]", line) == 1) {
+		util_fite((strlen(buf) + strlen(line) >= FSCANF_READ_BUFLEN),
+			LOG_ERR("File path is too long\n"));
+		strcat(buf, line);
+		for (len = strlen(buf); isspace((unsigned char)buf[len - 1]); len--) {
+		    buf[len - 1] = '\0';
+		}
+	    }
+	    util_fit((util_sl_insert(&current_class->files, &current_class->files_tail, buf)
+			== NULL));
 	}
     } while (1); /* Reading EOF or fscanf fail will break the loop*/
 
@@ -485,30 +1197,63 @@ success:
 }
 
 /*------------------------------------------------------------------------------*/
-int fe_save_classes(const char *filename, class_t *_class)
+static int _fe_save_classes_text(const char *filename, classes_t *classes)
 {
     FILE *file = NULL;
-    int i = 0, ret = 0;
-    class_t *current_class = _class;
-
-    LOG_DBG("filename:'%s' class:%p\n", filename, current_class);
+    int ret = 0;
+    uint32_t i = 0, j = 0;
+    class_t *current_class = classes->head;
+    fmat_val_t *row = NULL;
+    learned_file_t *learned = NULL;
 
     util_fite(((file = fopen(filename, "w")) == NULL),
 	    LOG_ERR("File open failed!\n"));
 
+    util_fite((fprintf(file, "FEATURES %u", classes->set.noe) < 0), LOG_ERR("fprintf failed\n"));
+    for (i = 0; i < classes->set.noe; i++) {
+	util_fite((fprintf(file, " %s", freg_name(&classes->set, i)) < 0),
+		LOG_ERR("fprintf failed\n"));
+    }
+    util_fite((fprintf(file, "\n") < 0), LOG_ERR("fprintf failed\n"));
+
     while (current_class != NULL) {
+	row = fmat_row(classes->features, current_class->index);
 	util_fite((fprintf(file, "CLASS %s %u %u\n", current_class->name,
-		    current_class->features->total_noe,
-		    current_class->features->noe) < 0), LOG_ERR("fprintf failed\n"));
+		    classes->total_noe[current_class->index],
+		    classes->features->cols) < 0), LOG_ERR("fprintf failed\n"));
 
-	/* Write result to file */
-	for (i = 0; i < current_class->features->noe; i++) {
-	    util_fite((fprintf(file, "%f\n", current_class->features->feature[i]) < 0),
+	/* Exact, updating takes the learned file sums back out of the average */
+	for (i = 0; i < classes->features->cols; i++) {
+	    util_fite((fprintf(file, "%.17g\n", row[i]) < 0),
 		    LOG_ERR("fprintf failed\n"));
 	}
 
 	current_class = current_class->next;
     }
+
+    /* Learned files and samples refer to classes by their saved order */
+    for (j = 0; j < classes->learned_noe; j++) {
+	learned = &classes->learned[j];
+	util_fite((fprintf(file, "FILE %u %u %" PRIu64 " %" PRId64 " %016" PRIx64 " %u %u",
+			learned->index, learned->regions, learned->size, learned->mtime,
+			learned->hash, learned->sample, learned->samples) < 0),
+		LOG_ERR("fprintf failed\n"));
+	for (i = 0; i < classes->set.noe; i++) {
+	    util_fite((fprintf(file, " %.17g", learned->sum[i]) < 0), LOG_ERR("fprintf failed\n"));
+	}
+	/* Path last, read up to the end of line */
+	util_fite((fprintf(file, " %s\n", learned->path) < 0), LOG_ERR("fprintf failed\n"));
+    }
+    for (j = 0; classes->samples && j < classes->samples->rows; j++) {
+	row = fmat_row(classes->samples, j);
+	util_fite((fprintf(file, "SAMPLE %u", classes->labels[j]) < 0),
+		LOG_ERR("fprintf failed\n"));
+	/* Exact, retraining on the samples must see the learned values */
+	for (i = 0; i < classes->samples->cols; i++) {
+	    util_fite((fprintf(file, " %.17g", row[i]) < 0), LOG_ERR("fprintf failed\n"));
+	}
+	util_fite((fprintf(file, "\n") < 0), LOG_ERR("fprintf failed\n"));
+    }
     /* End with EOF */
     util_fite((fprintf(file, "EOF\n") < 0), LOG_ERR("fprintf failed\n"));
 
@@ -522,3 +1267,42 @@ success:
     return ret;
 }
 
+/*------------------------------------------------------------------------------*/
+/*
+ * Saves the classes as text, or as a binary db if filename has its extension.
+ * The db is written next to filename and renamed over it, so a mapped db that
+ * is being updated stays intact until the new one is complete.
+ */
+int fe_save_classes(const char *filename, classes_t *classes)
+{
+    int ret = 0;
+    char *tmp = NULL;
+
+    LOG_DBG("filename:'%s' classes:%p\n", filename, classes);
+
+    util_fite(((tmp = (char *)malloc(strlen(filename) + sizeof(".tmp"))) == NULL),
+	    LOG_ERR("Temporary file name allocation failed!\n"));
+    sprintf(tmp, "%s.tmp", filename);
+
+    if (fdb_is_binary_filename(filename)) {
+	/* Codes are computed while learning, the ones of the run win over the db */
+	if (fe_quant_bits) classes->quant_bits = fe_quant_bits;
+	if (classes->quant_bits) {
+	    util_fit((_fe_classes_quantize(classes, classes->quant_bits) != 0));
+	}
+	util_fit((fdb_save(tmp, classes) != 0));
+    } else {
+	util_fit((_fe_save_classes_text(tmp, classes) != 0));
+    }
+    util_fite((rename(tmp, filename) != 0), LOG_ERR("Renaming '%s' failed!\n", tmp));
+
+    goto success;
+
+fail:
+    ret = -1;
+    if (tmp) remove(tmp);
+
+success:
+    sfree(tmp);
+    return ret;
+}
@@ -0,0 +1,249 @@
+/**
+ * \file
+ *	Feature matrix functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+#include "feature-matrix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FMAT_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define FMAT_HAVE_AVX2 0
+#endif
+
+#ifndef LOG_LEVEL_CONF_FMAT
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_FMAT */
+#define LOG_LEVEL LOG_LEVEL_CONF_FMAT
+#endif /* LOG_LEVEL_CONF_FMAT */
+
+/*------------------------------------------------------------------------------*/
+#define FMAT_ALIGN_VALUES   (FMAT_ALIGN / sizeof(fmat_val_t))
+#define FMAT_MIN_CAPACITY   8
+
+/*------------------------------------------------------------------------------*/
+typedef fmat_val_t (*fmat_distance_fn_t)(const fmat_val_t *, const fmat_val_t *, uint32_t);
+
+static fmat_val_t _fmat_distance_init(const fmat_val_t *, const fmat_val_t *, uint32_t);
+
+/* Selected on the first call */
+static fmat_distance_fn_t fmat_distance_fn = _fmat_distance_init;
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Allocates a zero filled rows x cols matrix.
+ */
+fmat_t* fmat_alloc(uint32_t rows, uint32_t cols)
+{
+    fmat_t *fmat = NULL;
+
+    LOG_DBG("rows:%u cols:%u\n", rows, cols);
+
+    util_fite((cols == 0), LOG_ERR("Matrix cols can not be zero!\n"));
+
+    util_fite(((fmat = (fmat_t *)calloc(1, sizeof(fmat_t))) == NULL),
+	    LOG_ERR("Matrix allocation failed!\n"));
+    fmat->cols = cols;
+    fmat->stride = ((cols + FMAT_ALIGN_VALUES - 1) / FMAT_ALIGN_VALUES) * FMAT_ALIGN_VALUES;
+
+    util_fit((fmat_reserve(fmat, rows) != 0));
+    fmat->rows = rows;
+
+    goto success;
+
+fail:
+    sfree_fmat(fmat);
+
+success:
+    return fmat;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Makes sure there is room for at least capacity rows, new rows are zeroed.
+ * Growing a mapped matrix copies its rows out of the mapping.
+ */
+int fmat_reserve(fmat_t *fmat, uint32_t capacity)
+{
+    int ret = 0;
+    void *data = NULL;
+    size_t row_size = fmat->stride * sizeof(fmat_val_t);
+
+    util_sit((capacity <= fmat->capacity && fmat->data != NULL));
+    if (capacity < FMAT_MIN_CAPACITY) capacity = FMAT_MIN_CAPACITY;
+
+    util_fite((posix_memalign(&data, FMAT_ALIGN, capacity * row_size) != 0),
+	    LOG_ERR("Matrix data allocation failed!\n"));
+
+    if (fmat->data) memcpy(data, fmat->data, fmat->rows * row_size);
+    memset((uint8_t *)data + fmat->rows * row_size, 0, (capacity - fmat->rows) * row_size);
+
+    if (fmat->mapped) fmat->mapped = 0;
+    else sfree(fmat->data);
+    fmat->data = (fmat_val_t *)data;
+    fmat->capacity = capacity;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Points the matrix at rows borrowed from a file mapping, data must be FMAT_ALIGN
+ * aligned and laid out with the matrix stride. It is not freed with the matrix.
+ */
+int fmat_map(fmat_t *fmat, void *data, uint32_t rows)
+{
+    int ret = 0;
+
+    util_fite((((uintptr_t)data % FMAT_ALIGN) != 0),
+	    LOG_ERR("Mapped matrix data is not aligned!\n"));
+
+    if (!fmat->mapped) sfree(fmat->data);
+    fmat->data = (fmat_val_t *)data;
+    fmat->rows = fmat->capacity = rows;
+    fmat->mapped = 1;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Appends a row (cols values, or zeros if NULL) and returns its index.
+ */
+int32_t fmat_append(fmat_t *fmat, const fmat_val_t *row)
+{
+    int32_t ret = 0;
+
+    if (fmat->rows == fmat->capacity) {
+	util_fit((fmat_reserve(fmat, fmat->capacity * 2) != 0));
+    }
+    if (row) memcpy(fmat_row(fmat, fmat->rows), row, fmat->cols * sizeof(fmat_val_t));
+    ret = fmat->rows++;
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Removes noe rows starting from row first, the rows after them move up. A
+ * mapped matrix is changed in place, the mapping is private.
+ */
+void fmat_remove(fmat_t *fmat, uint32_t first, uint32_t noe)
+{
+    memmove(fmat_row(fmat, first), fmat_row(fmat, first + noe),
+	    (size_t)(fmat->rows - first - noe) * fmat->stride * sizeof(fmat_val_t));
+    fmat->rows -= noe;
+}
+
+/*------------------------------------------------------------------------------*/
+/* The scalar kernel sums in the same lane order as the SIMD one, so both paths
+ * give bit identical results. */
+static fmat_val_t _fmat_distance_scalar(const fmat_val_t *a, const fmat_val_t *b,
+	uint32_t stride)
+{
+    uint32_t j = 0, l = 0, w = 0;
+    fmat_val_t lane[FMAT_LANES], d = 0;
+
+    memset(lane, 0, sizeof(lane));
+    for (j = 0; j < stride; j += FMAT_LANES) {
+	for (l = 0; l < FMAT_LANES; l++) {
+	    d = a[j + l] - b[j + l];
+	    lane[l] += d * d;
+	}
+    }
+    /* pairwise, same as the horizontal add of the SIMD kernel */
+    for (w = FMAT_LANES / 2; w > 0; w /= 2) {
+	for (l = 0; l < w; l++) {
+	    lane[l] += lane[l + w];
+	}
+    }
+    return lane[0];
+}
+
+#if FMAT_HAVE_AVX2
+/*------------------------------------------------------------------------------*/
+/* a and b must be 32 byte aligned, stride is a multiple of FMAT_LANES */
+__attribute__((target("avx2")))
+static fmat_val_t _fmat_distance_avx2(const fmat_val_t *a, const fmat_val_t *b,
+	uint32_t stride)
+{
+    uint32_t j = 0;
+#if FE_CONF_FLOAT32
+    __m256 acc = _mm256_setzero_ps(), d;
+    __m128 s;
+
+    for (j = 0; j < stride; j += FMAT_LANES) {
+	d = _mm256_sub_ps(_mm256_load_ps(a + j), _mm256_load_ps(b + j));
+	acc = _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+    }
+    s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+#else /* FE_CONF_FLOAT32 */
+    __m256d acc = _mm256_setzero_pd(), d;
+    __m128d s;
+
+    for (j = 0; j < stride; j += FMAT_LANES) {
+	d = _mm256_sub_pd(_mm256_load_pd(a + j), _mm256_load_pd(b + j));
+	acc = _mm256_add_pd(acc, _mm256_mul_pd(d, d));
+    }
+    s = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+    return _mm_cvtsd_f64(s);
+#endif /* FE_CONF_FLOAT32 */
+}
+#endif /* FMAT_HAVE_AVX2 */
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _fmat_distance_init(const fmat_val_t *a, const fmat_val_t *b, uint32_t stride)
+{
+    fmat_distance_fn_t fn = _fmat_distance_scalar;
+
+#if FMAT_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) fn = _fmat_distance_avx2;
+#endif /* FMAT_HAVE_AVX2 */
+
+    __atomic_store_n(&fmat_distance_fn, fn, __ATOMIC_RELAXED);
+    return fn(a, b, stride);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns the squared euclidean distance of two rows of matrices with the same
+ * stride. Padding values are zero so whole strides are summed.
+ */
+fmat_val_t fmat_distance(const fmat_val_t *a, const fmat_val_t *b, uint32_t stride)
+{
+    return __atomic_load_n(&fmat_distance_fn, __ATOMIC_RELAXED)(a, b, stride);
+}
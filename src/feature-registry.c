@@ -0,0 +1,334 @@
+/**
+ * \file
+ *	Feature extractor registry
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "util.h"
+#include "feature-registry.h"
+
+#ifndef LOG_LEVEL_CONF_FREG
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_FREG */
+#define LOG_LEVEL LOG_LEVEL_CONF_FREG
+#endif /* LOG_LEVEL_CONF_FREG */
+
+/*------------------------------------------------------------------------------*/
+/* Second and third order normalized central moments, Hu invariants use them */
+typedef struct {
+    double n20, n02, n11;
+    double n30, n12, n21, n03;
+} freg_hu_t;
+
+/*------------------------------------------------------------------------------*/
+static void _freg_hu(const freg_region_t *r, freg_hu_t *hu, uint8_t order)
+{
+    hu->n20 = moment_normalized(&r->moment, 2, 0);
+    hu->n02 = moment_normalized(&r->moment, 0, 2);
+    hu->n11 = moment_normalized(&r->moment, 1, 1);
+    if (order < 3) return;
+    hu->n30 = moment_normalized(&r->moment, 3, 0);
+    hu->n12 = moment_normalized(&r->moment, 1, 2);
+    hu->n21 = moment_normalized(&r->moment, 2, 1);
+    hu->n03 = moment_normalized(&r->moment, 0, 3);
+}
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _freg_hu1(const freg_region_t *r)
+{
+    freg_hu_t m;
+
+    _freg_hu(r, &m, 2);
+    return m.n20 + m.n02;
+}
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _freg_hu2(const freg_region_t *r)
+{
+    freg_hu_t m;
+
+    _freg_hu(r, &m, 2);
+    return pow(m.n20 - m.n02, 2) + (m.n11 * 4);
+}
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _freg_hu3(const freg_region_t *r)
+{
+    freg_hu_t m;
+
+    _freg_hu(r, &m, 3);
+    return pow(m.n30 - (3 * m.n12), 2) + pow((3 * m.n21) - m.n03, 2);
+}
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _freg_hu4(const freg_region_t *r)
+{
+    freg_hu_t m;
+
+    _freg_hu(r, &m, 3);
+    return pow(m.n30 + m.n12, 2) + pow(m.n21 + m.n03, 2);
+}
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _freg_hu5(const freg_region_t *r)
+{
+    freg_hu_t m;
+
+    _freg_hu(r, &m, 3);
+    return ((m.n30 - (3 * m.n12)) * (m.n30 + m.n12)
+	    * ( (pow(m.n30 + m.n12, 2)) - ( 3 * pow(m.n21 + m.n03, 2)) ))
+	+ ((3 * m.n21 - m.n03) * (m.n21 + m.n03)
+		* ( (3 * pow(m.n30 + m.n12, 2)) - pow(m.n21 + m.n03, 2) ));
+}
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _freg_hu6(const freg_region_t *r)
+{
+    freg_hu_t m;
+
+    _freg_hu(r, &m, 3);
+    return ( (m.n20 - m.n02)
+	    * (pow(m.n30 + m.n12, 2) - pow(m.n21 + m.n03, 2)) )
+	+ 4 * m.n11 * (m.n30 + m.n12) * (m.n21 + m.n03);
+}
+
+/*------------------------------------------------------------------------------*/
+static fmat_val_t _freg_hu7(const freg_region_t *r)
+{
+    freg_hu_t m;
+
+    _freg_hu(r, &m, 3);
+    return ((3 * m.n21 - m.n03) * (m.n30 + m.n12)
+	    * ( pow(m.n30 + m.n12, 2) - (3 * pow(m.n21 + m.n03, 2))))
+	- (m.n30 - 3 * m.n12 * (m.n21 + m.n03)
+		* (3 * pow(m.n30 + m.n12, 2) - pow(m.n21 + m.n03, 2)));
+}
+
+/*------------------------------------------------------------------------------*/
+/* Shorter side of the region frame over the longer one */
+static fmat_val_t _freg_aspect(const freg_region_t *r)
+{
+    double w = r->region.rect.width, h = r->region.rect.height;
+
+    if (w == 0 || h == 0) return 0;
+    return (w < h) ? w / h : h / w;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Part of the region frame covered by the region */
+static fmat_val_t _freg_extent(const freg_region_t *r)
+{
+    double area = (double)r->region.rect.width * r->region.rect.height;
+
+    if (area == 0) return 0;
+    return r->moment.m00 / area;
+}
+
+/*------------------------------------------------------------------------------*/
+/* One for a disc, smaller for longer or ragged regions */
+static fmat_val_t _freg_compactness(const freg_region_t *r)
+{
+    double perimeter = r->perimeter;
+
+    if (perimeter == 0) return 0;
+    return 4 * M_PI * r->moment.m00 / (perimeter * perimeter);
+}
+
+/*------------------------------------------------------------------------------*/
+/* Ids are indexes in this table and are not stored, dbs keep the names */
+static const freg_feature_t freg_features[] = {
+    { "hu1", FREG_NEED_RAW | FREG_NEED_CENTRAL2, 2, _freg_hu1 },
+    { "hu2", FREG_NEED_RAW | FREG_NEED_CENTRAL2, 2, _freg_hu2 },
+    { "hu3", FREG_NEED_RAW | FREG_NEED_CENTRAL3, 3, _freg_hu3 },
+    { "hu4", FREG_NEED_RAW | FREG_NEED_CENTRAL3, 3, _freg_hu4 },
+    { "hu5", FREG_NEED_RAW | FREG_NEED_CENTRAL3, 3, _freg_hu5 },
+    { "hu6", FREG_NEED_RAW | FREG_NEED_CENTRAL3, 3, _freg_hu6 },
+    { "hu7", FREG_NEED_RAW | FREG_NEED_CENTRAL3, 3, _freg_hu7 },
+    { "aspect", 0, 0, _freg_aspect },
+    { "extent", FREG_NEED_RAW, 1, _freg_extent },
+    { "compactness", FREG_NEED_RAW | FREG_NEED_CONTOUR, 2, _freg_compactness },
+};
+
+#define FREG_FEATURES_NOE   (sizeof(freg_features) / sizeof(freg_features[0]))
+
+/*------------------------------------------------------------------------------*/
+static uint32_t _freg_perimeter(image_t image, region_t region)
+{
+    uint32_t i = 0, j = 0, perimeter = 0;
+    uint8_t label = region.label;
+    rectangle_t *rect = &(region.rect);
+
+    for (i = rect->x; i < rect->x + rect->height; i++) {
+	for (j = rect->y; j < rect->y + rect->width; j++) {
+	    if (image.buf[i * image.width + j] != label) continue;
+	    if (i == 0 || i + 1 >= image.height || j == 0 || j + 1 >= image.width ||
+		    image.buf[(i - 1) * image.width + j] != label ||
+		    image.buf[(i + 1) * image.width + j] != label ||
+		    image.buf[i * image.width + j - 1] != label ||
+		    image.buf[i * image.width + j + 1] != label) {
+		perimeter++;
+	    }
+	}
+    }
+    return perimeter;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Calculates the missing intermediates of needs, the dependencies first */
+static void _freg_prepare(freg_region_t *r, uint8_t needs)
+{
+    needs &= ~r->ready;
+    if (needs & (FREG_NEED_CENTRAL2 | FREG_NEED_CENTRAL3)) needs |= FREG_NEED_RAW & ~r->ready;
+
+    if (needs & FREG_NEED_RAW) {
+	moment_raw(r->image, r->region, &r->moment);
+    }
+    /* Third order pass calculates the second order ones too if they are missing */
+    if (needs & FREG_NEED_CENTRAL3) {
+	moment_central(r->image, r->region, 3, &r->moment);
+	needs |= FREG_NEED_CENTRAL2;
+    } else if (needs & FREG_NEED_CENTRAL2) {
+	moment_central(r->image, r->region, 2, &r->moment);
+    }
+    if (needs & FREG_NEED_CONTOUR) {
+	r->perimeter = _freg_perimeter(r->image, r->region);
+    }
+    r->ready |= needs;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns the name of column j of the set.
+ */
+const char* freg_name(const freg_set_t *set, uint32_t j)
+{
+    return freg_features[set->ids[j]].name;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Prints the registered feature names, comma separated.
+ */
+void freg_print(FILE *file)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < FREG_FEATURES_NOE; i++) {
+	fprintf(file, "%s%s", i ? "," : "", freg_features[i].name);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Appends the feature with the given name as the next column of the set.
+ */
+int freg_set_add(freg_set_t *set, const char *name)
+{
+    int ret = 0;
+    uint32_t i = 0, j = 0;
+
+    for (i = 0; i < FREG_FEATURES_NOE; i++) {
+	if (strcmp(freg_features[i].name, name) == 0) break;
+    }
+    util_fite((i == FREG_FEATURES_NOE), LOG_ERR("Unknown feature '%s'!\n", name));
+    for (j = 0; j < set->noe; j++) {
+	util_fite((set->ids[j] == i), LOG_ERR("Feature '%s' is selected twice!\n", name));
+    }
+    util_fite((set->noe == FE_CONF_MAX_FEATURES),
+	    LOG_ERR("At most %u features can be selected!\n", FE_CONF_MAX_FEATURES));
+    set->ids[set->noe++] = i;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Fills the set from a comma separated feature name list.
+ */
+int freg_set_parse(freg_set_t *set, const char *list)
+{
+    int ret = 0;
+    size_t len = 0;
+    char name[FREG_NAME_LEN];
+
+    set->noe = 0;
+    while (1) {
+	len = strcspn(list, ",");
+	util_fite((len == 0 || len >= FREG_NAME_LEN),
+		LOG_ERR("Invalid feature name in '%s'!\n", list));
+	memcpy(name, list, len);
+	name[len] = '\0';
+	util_fit((freg_set_add(set, name) != 0));
+
+	if (list[len] == '\0') break;
+	list += len + 1;
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+uint8_t freg_set_equal(const freg_set_t *a, const freg_set_t *b)
+{
+    return a->noe == b->noe && memcmp(a->ids, b->ids, a->noe) == 0;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Fills the set columns in the order of their cost, columns of the same cost
+ * keep their set order.
+ */
+void freg_set_order(const freg_set_t *set, uint32_t *order)
+{
+    uint32_t i = 0, j = 0, column = 0;
+
+    for (i = 0; i < set->noe; i++) {
+	column = i;
+	for (j = i; j > 0 && freg_features[set->ids[order[j - 1]]].cost >
+		freg_features[set->ids[column]].cost; j--) {
+	    order[j] = order[j - 1];
+	}
+	order[j] = column;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+void freg_region_init(freg_region_t *r, image_t image, region_t region)
+{
+    memset(r, 0, sizeof(freg_region_t));
+    r->image = image;
+    r->region = region;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Calculates column j of the set for the region, the intermediates it needs
+ * are calculated once and shared by the other columns.
+ */
+fmat_val_t freg_feature(freg_region_t *r, const freg_set_t *set, uint32_t j)
+{
+    const freg_feature_t *feature = &freg_features[set->ids[j]];
+
+    _freg_prepare(r, feature->needs);
+    return feature->get(r);
+}
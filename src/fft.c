@@ -0,0 +1,246 @@
+/**
+ * \file
+ *	Fast Fourier transform functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "util.h"
+#include "fft.h"
+
+#ifndef LOG_LEVEL_CONF_FFT
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_FFT */
+#define LOG_LEVEL LOG_LEVEL_CONF_FFT
+#endif /* LOG_LEVEL_CONF_FFT */
+
+/*------------------------------------------------------------------------------*/
+/* e^(-2 pi i k / n), each root from its own angle so errors do not pile up */
+static double complex _fft_root(uint32_t k, uint32_t n)
+{
+    double angle = -2 * M_PI * k / n;
+
+    return cos(angle) + I * sin(angle);
+}
+
+/*------------------------------------------------------------------------------*/
+fft_t* fft_plan(uint32_t n)
+{
+    uint32_t i = 0, bits = 0, reverse = 0, b = 0;
+    fft_t *fft = NULL;
+
+    LOG_DBG("n:%u\n", n);
+
+    util_fite((n == 0 || (n & (n - 1)) != 0), LOG_ERR("%u is not a power of two!\n", n));
+    util_fite(((fft = (fft_t *)calloc(1, sizeof(fft_t))) == NULL),
+	    LOG_ERR("FFT plan allocation failed!\n"));
+    fft->n = n;
+    util_fite(((fft->reverse = (uint32_t *)malloc(n * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("FFT indexes allocation failed!\n"));
+    util_fite(((fft->twiddles = (double complex *)malloc((n / 2 + 1) *
+			    sizeof(double complex))) == NULL),
+	    LOG_ERR("FFT twiddles allocation failed!\n"));
+
+    for (bits = 0; (UINT32_C(1) << bits) < n; bits++);
+    for (i = 0; i < n; i++) {
+	for (b = 0, reverse = 0; b < bits; b++) {
+	    reverse |= ((i >> b) & 1) << (bits - 1 - b);
+	}
+	fft->reverse[i] = reverse;
+    }
+    for (i = 0; i < n / 2; i++) {
+	fft->twiddles[i] = _fft_root(i, n);
+    }
+
+    goto success;
+
+fail:
+    fft_free(&fft);
+
+success:
+    return fft;
+}
+
+/*------------------------------------------------------------------------------*/
+void fft_free(fft_t **fft)
+{
+    if (*fft == NULL) return;
+
+    sfree((*fft)->reverse);
+    sfree((*fft)->twiddles);
+    sfree(*fft);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * In place iterative transform, inverse uses the conjugate roots and is not
+ * scaled by 1 / n.
+ */
+void fft_run(const fft_t *fft, double complex *data, uint8_t inverse)
+{
+    uint32_t i = 0, j = 0, k = 0, len = 0, step = 0;
+    double complex t = 0, w = 0;
+
+    for (i = 0; i < fft->n; i++) {
+	j = fft->reverse[i];
+	if (i >= j) continue;
+	t = data[i];
+	data[i] = data[j];
+	data[j] = t;
+    }
+
+    for (len = 2; len <= fft->n; len <<= 1) {
+	step = fft->n / len;
+	for (i = 0; i < fft->n; i += len) {
+	    for (k = 0; k < len / 2; k++) {
+		w = fft->twiddles[k * step];
+		if (inverse) w = conj(w);
+		t = w * data[i + k + len / 2];
+		data[i + k + len / 2] = data[i + k] - t;
+		data[i + k] += t;
+	    }
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+fft2_t* fft2_plan(uint32_t size)
+{
+    uint32_t k = 0;
+    fft2_t *fft2 = NULL;
+
+    LOG_DBG("size:%u\n", size);
+
+    util_fite((size < 2), LOG_ERR("Tile size %u is too small!\n", size));
+    util_fite(((fft2 = (fft2_t *)calloc(1, sizeof(fft2_t))) == NULL),
+	    LOG_ERR("FFT plan allocation failed!\n"));
+    fft2->size = size;
+    util_fit(((fft2->half = fft_plan(size / 2)) == NULL));
+    util_fit(((fft2->full = fft_plan(size)) == NULL));
+    util_fite(((fft2->twiddles = (double complex *)malloc(FFT_BINS(size) *
+			    sizeof(double complex))) == NULL),
+	    LOG_ERR("FFT twiddles allocation failed!\n"));
+    util_fite(((fft2->scratch = (double complex *)malloc(size * sizeof(double complex))) == NULL),
+	    LOG_ERR("FFT scratch allocation failed!\n"));
+    for (k = 0; k < FFT_BINS(size); k++) {
+	fft2->twiddles[k] = _fft_root(k, size);
+    }
+
+    goto success;
+
+fail:
+    fft2_free(&fft2);
+
+success:
+    return fft2;
+}
+
+/*------------------------------------------------------------------------------*/
+void fft2_free(fft2_t **fft2)
+{
+    if (*fft2 == NULL) return;
+
+    fft_free(&(*fft2)->half);
+    fft_free(&(*fft2)->full);
+    sfree((*fft2)->twiddles);
+    sfree((*fft2)->scratch);
+    sfree(*fft2);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Even and odd values of a real row are the real and imaginary parts of a
+ * half size complex row, its transform Z splits back into the real one:
+ *   X[k] = (Z[k] + Z*[m - k]) / 2 - i w^k (Z[k] - Z*[m - k]) / 2,  m = size / 2
+ */
+static void _fft2_row_forward(fft2_t *fft2, const double *in, double complex *out)
+{
+    uint32_t k = 0, m = fft2->size / 2;
+    double complex *z = fft2->scratch, even = 0, odd = 0;
+
+    for (k = 0; k < m; k++) {
+	z[k] = in[2 * k] + I * in[2 * k + 1];
+    }
+    fft_run(fft2->half, z, 0);
+    for (k = 0; k <= m; k++) {
+	even = (z[k % m] + conj(z[(m - k) % m])) / 2;
+	odd = (z[k % m] - conj(z[(m - k) % m])) / 2;
+	out[k] = even - I * fft2->twiddles[k] * odd;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Undoes _fft2_row_forward, the result is scaled by size / 2 */
+static void _fft2_row_inverse(fft2_t *fft2, const double complex *in, double *out)
+{
+    uint32_t k = 0, m = fft2->size / 2;
+    double complex *z = fft2->scratch, even = 0, odd = 0;
+
+    for (k = 0; k < m; k++) {
+	even = (in[k] + conj(in[m - k])) / 2;
+	odd = (in[k] - conj(in[m - k])) / 2 * conj(fft2->twiddles[k]);
+	z[k] = even + I * odd;
+    }
+    fft_run(fft2->half, z, 1);
+    for (k = 0; k < m; k++) {
+	out[2 * k] = creal(z[k]);
+	out[2 * k + 1] = cimag(z[k]);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Transforms the columns of a size x FFT_BINS(size) spectrum in place */
+static void _fft2_columns(fft2_t *fft2, double complex *data, uint8_t inverse)
+{
+    uint32_t i = 0, k = 0, bins = FFT_BINS(fft2->size);
+
+    for (k = 0; k < bins; k++) {
+	for (i = 0; i < fft2->size; i++) {
+	    fft2->scratch[i] = data[i * bins + k];
+	}
+	fft_run(fft2->full, fft2->scratch, inverse);
+	for (i = 0; i < fft2->size; i++) {
+	    data[i * bins + k] = fft2->scratch[i];
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Spectrum of a size x size real tile into size x FFT_BINS(size) values.
+ */
+void fft2_forward(fft2_t *fft2, const double *in, double complex *out)
+{
+    uint32_t i = 0, bins = FFT_BINS(fft2->size);
+
+    for (i = 0; i < fft2->size; i++) {
+	_fft2_row_forward(fft2, &in[i * fft2->size], &out[i * bins]);
+    }
+    _fft2_columns(fft2, out, 0);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Real tile of a spectrum, the spectrum is overwritten. The result is
+ * scaled back, fft2_inverse(fft2_forward(x)) is x.
+ */
+void fft2_inverse(fft2_t *fft2, double complex *in, double *out)
+{
+    uint32_t i = 0, j = 0, bins = FFT_BINS(fft2->size);
+    double scale = 2.0 / ((double)fft2->size * fft2->size);
+
+    _fft2_columns(fft2, in, 1);
+    for (i = 0; i < fft2->size; i++) {
+	_fft2_row_inverse(fft2, &in[i * bins], &out[i * fft2->size]);
+	for (j = 0; j < fft2->size; j++) {
+	    out[i * fft2->size + j] *= scale;
+	}
+    }
+}
@@ -0,0 +1,267 @@
+/**
+ * \file
+ *	Filter chain functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+#include "filter-chain.h"
+
+#ifndef LOG_LEVEL_CONF_FCHAIN
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_FCHAIN */
+#define LOG_LEVEL LOG_LEVEL_CONF_FCHAIN
+#endif /* LOG_LEVEL_CONF_FCHAIN */
+
+/*------------------------------------------------------------------------------*/
+#define FCHAIN_NAME_LEN	    256
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Rolling input rows of a stage. rows[r] is the ring slot of image row r, the
+ * ring keeps the rows the next output row reads and the ones received after.
+ */
+typedef struct {
+    const fchain_stage_t *stage;
+    uint32_t above;		/* input rows above an output row the stage reads */
+    uint32_t below;		/* input rows below it */
+    uint8_t *ring;		/* above + below + 1 rows */
+    uint8_t **rows;		/* height slot pointers */
+    uint8_t *out;		/* output row */
+    uint32_t filled;		/* input rows received */
+    uint32_t next;		/* next output row */
+    mask_stream_t *stream;	/* FCHAIN_MASK stages */
+} fchain_run_t;
+
+typedef struct {
+    image_t image;		/* input, then the output rows */
+    uint32_t noe;
+    fchain_run_t *run;
+    uint32_t written;		/* output rows of the last stage */
+} fchain_ctx_t;
+
+/*------------------------------------------------------------------------------*/
+static int _fchain_add(fchain_t *chain, const char *name)
+{
+    int ret = 0;
+    fchain_stage_t *stage = &chain->stage[chain->noe];
+
+    LOG_DBG("stage %u: '%s'\n", chain->noe, name);
+
+    memset(stage, 0, sizeof(fchain_stage_t));
+    stage->type = FCHAIN_MORP;
+    if (!strcmp("dilation", name)) {
+	stage->op = MORP_DILATION;
+    } else if (!strcmp("erosion", name)) {
+	stage->op = MORP_EROSION;
+    } else if (!strcmp("open", name)) {
+	/* (A - B) + B */
+	stage->op = MORP_EROSION;
+	stage[1] = stage[0];
+	stage[1].op = MORP_DILATION;
+	chain->noe++;
+    } else if (!strcmp("close", name)) {
+	/* (A + B) - B */
+	stage->op = MORP_DILATION;
+	stage[1] = stage[0];
+	stage[1].op = MORP_EROSION;
+	chain->noe++;
+    } else {
+	stage->type = FCHAIN_MASK;
+	util_fite(((stage->mask = mask_read_from_file(name)) == NULL),
+		LOG_ERR("'%s' is neither a morphology nor a mask file!\n", name));
+    }
+    chain->noe++;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Reads a comma separated list of mask files and morphology operations
+ * (dilation, erosion, open, close), open and close are two stages.
+ */
+fchain_t* fchain_parse(const char *list)
+{
+    uint32_t max = 2;
+    size_t len = 0;
+    const char *p = NULL;
+    char name[FCHAIN_NAME_LEN];
+    fchain_t *chain = NULL;
+
+    LOG_DBG("list:'%s'\n", list);
+
+    for (p = list; *p; p++) {
+	if (*p == ',') max += 2;
+    }
+    util_fite(((chain = (fchain_t *)calloc(1, sizeof(fchain_t))) == NULL),
+	    LOG_ERR("Filter chain allocation failed!\n"));
+    util_fite(((chain->stage = (fchain_stage_t *)calloc(max, sizeof(fchain_stage_t))) == NULL),
+	    LOG_ERR("Filter chain stages allocation failed!\n"));
+
+    while (1) {
+	len = strcspn(list, ",");
+	util_fite((len == 0 || len >= FCHAIN_NAME_LEN),
+		LOG_ERR("Invalid filter in '%s'!\n", list));
+	memcpy(name, list, len);
+	name[len] = '\0';
+	util_fit((_fchain_add(chain, name) != 0));
+
+	if (list[len] == '\0') break;
+	list += len + 1;
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    fchain_free(&chain);
+
+success:
+    return chain;
+}
+
+/*------------------------------------------------------------------------------*/
+void fchain_free(fchain_t **chain)
+{
+    uint32_t i = 0;
+
+    if (*chain == NULL) return;
+
+    for (i = 0; (*chain)->stage && i < (*chain)->noe; i++) {
+	sfree_mask((*chain)->stage[i].mask);
+    }
+    sfree((*chain)->stage);
+    sfree(*chain);
+}
+
+/*------------------------------------------------------------------------------*/
+static void _fchain_run_free(fchain_run_t *run)
+{
+    sfree(run->ring);
+    sfree(run->rows);
+    sfree(run->out);
+    mask_stream_free(&run->stream);
+}
+
+/*------------------------------------------------------------------------------*/
+static int _fchain_run_init(fchain_run_t *run, const fchain_stage_t *stage, image_t image)
+{
+    int ret = 0;
+    uint32_t i = 0, depth = 0;
+
+    memset(run, 0, sizeof(fchain_run_t));
+    run->stage = stage;
+    if (stage->type == FCHAIN_MASK) {
+	run->above = stage->mask->height / 2;
+	run->below = stage->mask->height - 1 - run->above;
+	util_fit(((run->stream = mask_stream_new(stage->mask, image.width,
+			    image.height)) == NULL));
+    } else {
+	run->below = MORP_ROWS_BELOW;
+    }
+    depth = run->above + run->below + 1;
+
+    util_fite(((run->ring = (uint8_t *)malloc(depth * image.width)) == NULL),
+	    LOG_ERR("Filter ring allocation failed!\n"));
+    util_fite(((run->rows = (uint8_t **)malloc(image.height * sizeof(uint8_t *))) == NULL),
+	    LOG_ERR("Filter rows allocation failed!\n"));
+    util_fite(((run->out = (uint8_t *)malloc(image.width)) == NULL),
+	    LOG_ERR("Filter output row allocation failed!\n"));
+    for (i = 0; i < image.height; i++) {
+	run->rows[i] = &run->ring[(i % depth) * image.width];
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Hands the next input row to stage s and passes every output row it can
+ * write now to the next stage. The last stage writes into the image, its
+ * row i is written once row i and the ones below it are read.
+ */
+static void _fchain_push(fchain_ctx_t *ctx, uint32_t s, const uint8_t *row)
+{
+    uint32_t last = 0, width = ctx->image.width, height = ctx->image.height;
+    fchain_run_t *run = NULL;
+
+    if (s == ctx->noe) {
+	memcpy(&ctx->image.buf[ctx->written++ * width], row, width);
+	return;
+    }
+
+    run = &ctx->run[s];
+    memcpy(run->rows[run->filled++], row, width);
+    for (; run->next < height; run->next++) {
+	last = (run->next + run->below < height) ? run->next + run->below : height - 1;
+	if (last >= run->filled) break;
+
+	if (run->stage->type == FCHAIN_MASK) {
+	    mask_stream_row(run->stream, (const uint8_t * const *)run->rows, run->next, run->out);
+	} else {
+	    morp_row(run->stage->op, (const uint8_t * const *)run->rows, width, height,
+		    run->next, run->out);
+	}
+	_fchain_push(ctx, s + 1, run->out);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Runs the chain on the intensity image in one pass over its rows. Stages
+ * keep only the rows they read around an output row, intermediate images
+ * are never built. The result is the same as applying the stages one after
+ * the other with mask_apply and morp_apply.
+ */
+int fchain_apply(const fchain_t *chain, image_t image)
+{
+    int ret = 0;
+    uint32_t i = 0;
+    fchain_ctx_t ctx = { .image = image, .noe = chain->noe, .run = NULL, .written = 0 };
+
+    LOG_DBG("image:%ux%u stages:%u\n", image.width, image.height, chain->noe);
+
+    util_fite((image.cb != 1), LOG_ERR("Filter chains run on intensity images!\n"));
+    util_fite(((ctx.run = (fchain_run_t *)calloc(chain->noe, sizeof(fchain_run_t))) == NULL),
+	    LOG_ERR("Filter chain runs allocation failed!\n"));
+    for (i = 0; i < chain->noe; i++) {
+	util_fit((_fchain_run_init(&ctx.run[i], &chain->stage[i], image) != 0));
+    }
+
+    /* Rows are copied into the first ring before the output reaches them */
+    for (i = 0; i < image.height; i++) {
+	_fchain_push(&ctx, 0, &image.buf[i * image.width]);
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    for (i = 0; ctx.run && i < chain->noe; i++) {
+	_fchain_run_free(&ctx.run[i]);
+    }
+    sfree(ctx.run);
+    return ret;
+}
@@ -0,0 +1,272 @@
+/**
+ * \file
+ *	Sobel gradient functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "util.h"
+#include "gradient.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GRAD_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define GRAD_HAVE_AVX2 0
+#endif
+
+#ifndef LOG_LEVEL_CONF_GRAD
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_GRAD */
+#define LOG_LEVEL LOG_LEVEL_CONF_GRAD
+#endif /* LOG_LEVEL_CONF_GRAD */
+
+/*------------------------------------------------------------------------------*/
+/* Output pixels of a SIMD step */
+#define GRAD_LANES	16
+/* tan(22.5) in 1/65536 steps, direction sectors are bounded by
+ * ay = ax * tan(22.5) and ay = ax * tan(67.5) = ax * (2 + tan(22.5)) */
+#define GRAD_TAN_22_5	27146
+
+/*------------------------------------------------------------------------------*/
+/* Writes columns first to last (not included) of row i, rows are i - 1..i + 1 */
+typedef void (*grad_row_fn_t)(gradient_t *, const uint8_t *, const uint8_t *, const uint8_t *,
+	uint32_t, uint32_t, uint32_t);
+
+/*------------------------------------------------------------------------------*/
+static inline uint8_t _grad_direction(int32_t gx, int32_t gy)
+{
+    int32_t ax = abs(gx), ay = abs(gy), t = (ax * GRAD_TAN_22_5) >> 16;
+
+    if (ay <= t) return GRAD_DIR_0;
+    if (ay > 2 * ax + t) return GRAD_DIR_90;
+    return ((gx ^ gy) < 0) ? GRAD_DIR_135 : GRAD_DIR_45;
+}
+
+/*------------------------------------------------------------------------------*/
+static void _grad_row(gradient_t *grad, const uint8_t *up, const uint8_t *mid,
+	const uint8_t *down, uint32_t i, uint32_t first, uint32_t last)
+{
+    uint32_t j = 0;
+    size_t at = 0;
+    int32_t gx = 0, gy = 0;
+
+    for (j = first; j < last; j++) {
+	gx = (up[j + 1] - up[j - 1]) + 2 * (mid[j + 1] - mid[j - 1]) + (down[j + 1] - down[j - 1]);
+	gy = (down[j - 1] + 2 * down[j] + down[j + 1]) - (up[j - 1] + 2 * up[j] + up[j + 1]);
+	at = (size_t)i * grad->width + j;
+	grad->gx[at] = gx;
+	grad->gy[at] = gy;
+	/* Same float operations as the SIMD kernel */
+	grad->magnitude[at] = (grad->norm == GRAD_NORM_L1) ? abs(gx) + abs(gy) :
+	    (int16_t)(sqrtf((float)(gx * gx + gy * gy)) + 0.5f);
+	grad->direction[at] = _grad_direction(gx, gy);
+    }
+}
+
+#if GRAD_HAVE_AVX2
+/*------------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static inline __m256i _grad_load_avx2(const uint8_t *src)
+{
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)src));
+}
+
+/*------------------------------------------------------------------------------*/
+/* Rounded square roots of 16 sums of squares, 8 per float half */
+__attribute__((target("avx2")))
+static inline __m256i _grad_l2_avx2(__m256i gx, __m256i gy)
+{
+    __m256i lo, hi;
+    __m256 half = _mm256_set1_ps(0.5f);
+
+    lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(gx, gy), _mm256_unpacklo_epi16(gx, gy));
+    hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(gx, gy), _mm256_unpackhi_epi16(gx, gy));
+    lo = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_sqrt_ps(_mm256_cvtepi32_ps(lo)), half));
+    hi = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_sqrt_ps(_mm256_cvtepi32_ps(hi)), half));
+    /* Unpack and pack work in the same 128 bit lanes, the order comes back */
+    return _mm256_packs_epi32(lo, hi);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Sixteen pixels per step in 16 bit lanes, the derivatives are differences
+ * of widened neighbor loads and the direction is two compares against the
+ * sector bounds.
+ */
+__attribute__((target("avx2")))
+static void _grad_row_avx2(gradient_t *grad, const uint8_t *up, const uint8_t *mid,
+	const uint8_t *down, uint32_t i, uint32_t first, uint32_t last)
+{
+    uint32_t j = first;
+    size_t at = 0;
+    __m256i gx, gy, ax, ay, t, dir, diagonal, opposite;
+    __m128i bytes;
+
+    for (; j + GRAD_LANES <= last; j += GRAD_LANES) {
+	gx = _mm256_add_epi16(_mm256_sub_epi16(_grad_load_avx2(&up[j + 1]),
+		    _grad_load_avx2(&up[j - 1])), _mm256_sub_epi16(_grad_load_avx2(&down[j + 1]),
+		    _grad_load_avx2(&down[j - 1])));
+	gx = _mm256_add_epi16(gx, _mm256_slli_epi16(_mm256_sub_epi16(
+			_grad_load_avx2(&mid[j + 1]), _grad_load_avx2(&mid[j - 1])), 1));
+	gy = _mm256_sub_epi16(_mm256_add_epi16(_grad_load_avx2(&down[j - 1]),
+		    _grad_load_avx2(&down[j + 1])), _mm256_add_epi16(_grad_load_avx2(&up[j - 1]),
+		    _grad_load_avx2(&up[j + 1])));
+	gy = _mm256_add_epi16(gy, _mm256_slli_epi16(_mm256_sub_epi16(_grad_load_avx2(&down[j]),
+			_grad_load_avx2(&up[j])), 1));
+
+	at = (size_t)i * grad->width + j;
+	_mm256_storeu_si256((__m256i *)&grad->gx[at], gx);
+	_mm256_storeu_si256((__m256i *)&grad->gy[at], gy);
+
+	ax = _mm256_abs_epi16(gx);
+	ay = _mm256_abs_epi16(gy);
+	_mm256_storeu_si256((__m256i *)&grad->magnitude[at], (grad->norm == GRAD_NORM_L1) ?
+		_mm256_add_epi16(ax, ay) : _grad_l2_avx2(gx, gy));
+
+	/* ax < 2^10, the high half of ax * tan is the scalar shift */
+	t = _mm256_mulhi_epu16(ax, _mm256_set1_epi16(GRAD_TAN_22_5));
+	diagonal = _mm256_cmpgt_epi16(ay, t);
+	opposite = _mm256_srai_epi16(_mm256_xor_si256(gx, gy), 15);
+	/* 1 or 3 on the diagonals, 2 above the upper bound */
+	dir = _mm256_and_si256(diagonal, _mm256_sub_epi16(_mm256_set1_epi16(GRAD_DIR_45),
+		    _mm256_add_epi16(opposite, opposite)));
+	dir = _mm256_blendv_epi8(dir, _mm256_set1_epi16(GRAD_DIR_90), _mm256_cmpgt_epi16(ay,
+		    _mm256_add_epi16(_mm256_add_epi16(ax, ax), t)));
+	bytes = _mm_packus_epi16(_mm256_castsi256_si128(dir), _mm256_extracti128_si256(dir, 1));
+	_mm_storeu_si128((__m128i *)&grad->direction[at], bytes);
+    }
+    _grad_row(grad, up, mid, down, i, j, last);
+}
+#endif /* GRAD_HAVE_AVX2 */
+
+/*------------------------------------------------------------------------------*/
+static grad_row_fn_t _grad_row_fn(void)
+{
+    static grad_row_fn_t fn = NULL;
+    grad_row_fn_t picked = __atomic_load_n(&fn, __ATOMIC_RELAXED);
+
+    if (picked == NULL) {
+	picked = _grad_row;
+#if GRAD_HAVE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) picked = _grad_row_avx2;
+#endif /* GRAD_HAVE_AVX2 */
+	__atomic_store_n(&fn, picked, __ATOMIC_RELAXED);
+    }
+    return picked;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Zeroed planes of a width x height image */
+gradient_t* grad_new(uint32_t width, uint32_t height, grad_norm_t norm)
+{
+    size_t size = (size_t)width * height;
+    gradient_t *grad = NULL;
+
+    LOG_DBG("width:%u height:%u norm:%u\n", width, height, norm);
+
+    util_fite(((grad = (gradient_t *)calloc(1, sizeof(gradient_t))) == NULL),
+	    LOG_ERR("Gradient allocation failed!\n"));
+    grad->width = width;
+    grad->height = height;
+    grad->norm = norm;
+    util_fite(((grad->gx = (int16_t *)calloc(size, sizeof(int16_t))) == NULL ||
+		(grad->gy = (int16_t *)calloc(size, sizeof(int16_t))) == NULL ||
+		(grad->magnitude = (int16_t *)calloc(size, sizeof(int16_t))) == NULL ||
+		(grad->direction = (uint8_t *)calloc(size, sizeof(uint8_t))) == NULL),
+	    LOG_ERR("Gradient planes allocation failed!\n"));
+
+    goto success;
+
+fail:
+    grad_free(&grad);
+
+success:
+    return grad;
+}
+
+/*------------------------------------------------------------------------------*/
+void grad_free(gradient_t **grad)
+{
+    if (*grad == NULL) return;
+
+    sfree((*grad)->gx);
+    sfree((*grad)->gy);
+    sfree((*grad)->magnitude);
+    sfree((*grad)->direction);
+    sfree(*grad);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Fills rows first to last (not included) of the planes from the gray image,
+ * bands of rows can be filled independently. Border pixels are left alone.
+ */
+void grad_rows(gradient_t *grad, image_t image, uint32_t first, uint32_t last)
+{
+    uint32_t i = 0;
+    grad_row_fn_t fn = _grad_row_fn();
+
+    if (image.width < 3 || image.height < 3) return;
+
+    first = (first < 1) ? 1 : first;
+    last = (last > image.height - 1) ? image.height - 1 : last;
+    for (i = first; i < last; i++) {
+	fn(grad, &image.buf[(size_t)(i - 1) * image.width], &image.buf[(size_t)i * image.width],
+		&image.buf[(size_t)(i + 1) * image.width], i, 1, image.width - 1);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Sobel derivatives, magnitude and direction of a gray image in one pass.
+ */
+gradient_t* grad_build(image_t image, grad_norm_t norm)
+{
+    gradient_t *grad = NULL;
+
+    LOG_DBG("image:%p norm:%u\n", &image, norm);
+
+    util_fite((image.cb != 1), LOG_ERR("Gradient needs a gray image!\n"));
+    util_fit(((grad = grad_new(image.width, image.height, norm)) == NULL));
+    grad_rows(grad, image, 0, image.height);
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+
+success:
+    return grad;
+}
+
+/*------------------------------------------------------------------------------*/
+int grad_parse_norm(const char *name, grad_norm_t *norm)
+{
+    int ret = 0;
+
+    if (!strcmp("l1", name)) {
+	*norm = GRAD_NORM_L1;
+    } else if (!strcmp("l2", name)) {
+	*norm = GRAD_NORM_L2;
+    } else {
+	LOG_ERR("Gradient norm '%s' is not supported!\n", name);
+	goto fail;
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
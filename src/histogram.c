@@ -0,0 +1,116 @@
+/**
+ * \file
+ *	Histogram functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+#include "histogram.h"
+
+#ifndef LOG_LEVEL_CONF_HIST
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_HIST */
+#define LOG_LEVEL LOG_LEVEL_CONF_HIST
+#endif /* LOG_LEVEL_CONF_HIST */
+
+/*------------------------------------------------------------------------------*/
+hist_t* hist_new(uint32_t noe)
+{
+    hist_t *hist = NULL;
+
+    util_fite((noe == 0), LOG_ERR("Histogram needs bins!\n"));
+    util_fite(((hist = (hist_t *)calloc(1, sizeof(hist_t))) == NULL),
+	    LOG_ERR("Histogram allocation failed!\n"));
+    hist->noe = noe;
+    util_fite(((hist->bins = (uint32_t *)calloc(noe, sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Histogram bins allocation failed!\n"));
+
+    goto success;
+
+fail:
+    hist_free(&hist);
+
+success:
+    return hist;
+}
+
+/*------------------------------------------------------------------------------*/
+void hist_free(hist_t **hist)
+{
+    if (*hist == NULL) return;
+
+    sfree((*hist)->bins);
+    sfree(*hist);
+}
+
+/*------------------------------------------------------------------------------*/
+void hist_add_u8(hist_t *hist, const uint8_t *values, size_t n)
+{
+    size_t i = 0;
+    uint32_t last = hist->noe - 1;
+
+    if (hist->noe >= HIST_U8_BINS) {
+	for (i = 0; i < n; i++) hist->bins[values[i]]++;
+    } else {
+	for (i = 0; i < n; i++) hist->bins[(values[i] < last) ? values[i] : last]++;
+    }
+    hist->total += n;
+}
+
+/*------------------------------------------------------------------------------*/
+void hist_add_i16(hist_t *hist, const int16_t *values, size_t n)
+{
+    size_t i = 0;
+    int32_t last = hist->noe - 1;
+
+    for (i = 0; i < n; i++) {
+	hist->bins[(values[i] < 0) ? 0 : (values[i] < last) ? values[i] : last]++;
+    }
+    hist->total += n;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Histogram of the pixels of a gray image */
+hist_t* hist_build(image_t image)
+{
+    hist_t *hist = NULL;
+
+    util_fite((image.cb != 1), LOG_ERR("Histogram needs a gray image!\n"));
+    util_fit(((hist = hist_new(HIST_U8_BINS)) == NULL));
+    hist_add_u8(hist, image.buf, image.size);
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+
+success:
+    return hist;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Smallest bin b so that at least ratio of the values counted in bins first
+ * and above fall in first..b. Returns first if there is no such value.
+ */
+uint32_t hist_percentile(const hist_t *hist, uint32_t first, double ratio)
+{
+    uint32_t b = 0;
+    uint64_t total = 0, sum = 0;
+
+    for (b = first; b < hist->noe; b++) total += hist->bins[b];
+    if (total == 0) return first;
+
+    for (b = first; b < hist->noe - 1; b++) {
+	sum += hist->bins[b];
+	if (sum >= ratio * total) break;
+    }
+    return b;
+}
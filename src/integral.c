@@ -0,0 +1,142 @@
+/**
+ * \file
+ *	Integral image (summed-area table) functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+#include "integral.h"
+
+#ifndef LOG_LEVEL_CONF_INTEGRAL
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_INTEGRAL */
+#define LOG_LEVEL LOG_LEVEL_CONF_INTEGRAL
+#endif /* LOG_LEVEL_CONF_INTEGRAL */
+
+/*------------------------------------------------------------------------------*/
+/*     ^
+ *  x,height  <- y,width ->
+ *     v
+ * Corner entries of the rectangle, A is its top-left:
+ *   sum = D - B - C + A	  A B
+ *				  C D
+ */
+#define INTEGRAL_RECT(_table, _integral, _rect)						\
+    ((_table)[((_rect).x + (_rect).height) * (_integral)->stride + (_rect).y + (_rect).width] -\
+     (_table)[(_rect).x * (_integral)->stride + (_rect).y + (_rect).width] -		\
+     (_table)[((_rect).x + (_rect).height) * (_integral)->stride + (_rect).y] +		\
+     (_table)[(_rect).x * (_integral)->stride + (_rect).y])
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Builds the tables of a gray image in one pass, the squared sums only if
+ * squares is set.
+ */
+integral_t* integral_build(image_t image, uint8_t squares)
+{
+    uint32_t i = 0, j = 0, row = 0, stride = image.width + 1;
+    uint64_t row_squares = 0;
+    const uint8_t *pixels = NULL;
+    integral_t *integral = NULL;
+
+    LOG_DBG("image:%p squares:%u\n", &image, squares);
+
+    util_fite((image.cb != 1), LOG_ERR("Integral image needs a gray image!\n"));
+    util_fite(((integral = (integral_t *)calloc(1, sizeof(integral_t))) == NULL),
+	    LOG_ERR("Integral image allocation failed!\n"));
+    integral->width = image.width;
+    integral->height = image.height;
+    integral->stride = stride;
+
+    /* First row and column stay zero */
+    util_fite(((integral->sum = (uint32_t *)calloc((size_t)(image.height + 1) * stride,
+			    sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Integral sums allocation failed!\n"));
+    if (squares) {
+	util_fite(((integral->squares = (uint64_t *)calloc((size_t)(image.height + 1) * stride,
+				sizeof(uint64_t))) == NULL),
+		LOG_ERR("Integral squared sums allocation failed!\n"));
+    }
+
+    for (i = 0; i < image.height; i++) {
+	pixels = &image.buf[(size_t)i * image.width];
+	row = 0;
+	row_squares = 0;
+	for (j = 0; j < image.width; j++) {
+	    row += pixels[j];
+	    integral->sum[(size_t)(i + 1) * stride + j + 1] =
+		integral->sum[(size_t)i * stride + j + 1] + row;
+	    if (!squares) continue;
+	    row_squares += pixels[j] * pixels[j];
+	    integral->squares[(size_t)(i + 1) * stride + j + 1] =
+		integral->squares[(size_t)i * stride + j + 1] + row_squares;
+	}
+    }
+
+    goto success;
+
+fail:
+    integral_free(&integral);
+
+success:
+    return integral;
+}
+
+/*------------------------------------------------------------------------------*/
+void integral_free(integral_t **integral)
+{
+    if (*integral == NULL) return;
+
+    sfree((*integral)->sum);
+    sfree((*integral)->squares);
+    sfree(*integral);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Sum of the pixels in the rectangle, it must be in the image.
+ */
+uint32_t integral_sum(const integral_t *integral, rectangle_t rect)
+{
+    return INTEGRAL_RECT(integral->sum, integral, rect);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Sum of the squared pixels in the rectangle, the table must be built.
+ */
+uint64_t integral_squares(const integral_t *integral, rectangle_t rect)
+{
+    return INTEGRAL_RECT(integral->squares, integral, rect);
+}
+
+/*------------------------------------------------------------------------------*/
+double integral_mean(const integral_t *integral, rectangle_t rect)
+{
+    double area = (double)rect.width * rect.height;
+
+    if (area == 0) return 0;
+    return integral_sum(integral, rect) / area;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Population variance of the pixels in the rectangle, the squared sums
+ * table must be built.
+ */
+double integral_variance(const integral_t *integral, rectangle_t rect)
+{
+    double area = (double)rect.width * rect.height, sum = 0, variance = 0;
+
+    if (area == 0) return 0;
+    sum = integral_sum(integral, rect);
+    variance = (integral_squares(integral, rect) - sum * sum / area) / area;
+    return (variance < 0) ? 0 : variance;
+}
@@ -13,6 +13,7 @@
 #include "log.h"
 #include "util.h"
 #include "k-means.h"
+#include "histogram.h"
 
 #ifndef LOG_LEVEL_CONF_KMEANS
 #define LOG_LEVEL LOG_LEVEL_ERR
@@ -24,7 +25,7 @@
  * Increase it for reliability. */
 #define KMEANS_TEST_COUNT   5
 
-#define HISTOGRAM_LENGTH    256
+#define HISTOGRAM_LENGTH    HIST_U8_BINS
 
 /*------------------------------------------------------------------------------*/
 typedef struct cluster {
@@ -34,18 +35,23 @@ typedef struct cluster {
     float content_sum;
 } cluster_t;
 
-/*------------------------------------------------------------------------------*/
-static cluster_t *clusters = NULL;
-static uint8_t cluster_num = 0;
+/* Per call state, so thresholds of different images can run in parallel */
+typedef struct {
+    cluster_t *clusters;
+    uint8_t cluster_num;
+    unsigned int seed;	/* rand_r state */
+} kmeans_t;
 
 /*------------------------------------------------------------------------------*/
 /*
  * _print_clusters
  */
-static void _print_clusters()
+static void _print_clusters(kmeans_t *kmeans)
 {
     uint8_t i = 0;
-    for (i = 0; i < cluster_num; i++) {
+    cluster_t *clusters = kmeans->clusters;
+
+    for (i = 0; i < kmeans->cluster_num; i++) {
 	LOG_DBG("clusters[%u].\n"
 		"\tc=%u\n"
 		"\tc_u=%u\n"
@@ -60,23 +66,25 @@ static void _print_clusters()
 /*
  * _initialize_clusters
  */
-static void _initialize_clusters()
+static void _initialize_clusters(kmeans_t *kmeans)
 {
     uint8_t i = 0;
-    for (i = 0; i < cluster_num; i++) {
-	clusters[i].c_u = rand() % HISTOGRAM_LENGTH;
+    for (i = 0; i < kmeans->cluster_num; i++) {
+	kmeans->clusters[i].c_u = rand_r(&kmeans->seed) % HISTOGRAM_LENGTH;
     }
-    _print_clusters();
+    _print_clusters(kmeans);
 }
 
 /*------------------------------------------------------------------------------*/
 /*
  * _reset_clusters
  */
-static void _reset_clusters()
+static void _reset_clusters(kmeans_t *kmeans)
 {
     uint8_t i = 0;
-    for (i = 0; i < cluster_num; i++) {
+    cluster_t *clusters = kmeans->clusters;
+
+    for (i = 0; i < kmeans->cluster_num; i++) {
 	clusters[i].sum = 0;
 	clusters[i].content_sum = 0;
 	clusters[i].c = clusters[i].c_u;
@@ -87,12 +95,13 @@ static void _reset_clusters()
 /*
  * _add_point_to_cluster adds point into cluster which has minimum distance.
  */
-static void _add_point_to_cluster(int index, int histogram_val)
+static void _add_point_to_cluster(kmeans_t *kmeans, int index, int histogram_val)
 {
     uint8_t i = 0, min = 0, min_index = 0;
+    cluster_t *clusters = kmeans->clusters;
 
     min = abs(clusters[0].c - index);
-    for (i = 1; i < cluster_num; i++) {
+    for (i = 1; i < kmeans->cluster_num; i++) {
 	uint8_t current_distance = abs(clusters[i].c - index);
 	if (current_distance < min) {
 	    min = current_distance;
@@ -107,11 +116,12 @@ static void _add_point_to_cluster(int index, int histogram_val)
 /*
  * _calc_new_centroids calculates new centroids and stores in c_u.
  */
-static void _calc_new_centroids()
+static void _calc_new_centroids(kmeans_t *kmeans)
 {
     uint8_t i = 0;
+    cluster_t *clusters = kmeans->clusters;
 
-    for (i = 0; i < cluster_num; i++) {
+    for (i = 0; i < kmeans->cluster_num; i++) {
 	if (clusters[i].content_sum == 0) clusters[i].content_sum = 1;
 	clusters[i].c_u = clusters[i].sum / clusters[i].content_sum;
     }
@@ -121,15 +131,15 @@ static void _calc_new_centroids()
 /*
  * _check_centroids checks clusters are already orginized or not.
  */
-static uint8_t _check_centroids()
+static uint8_t _check_centroids(kmeans_t *kmeans)
 {
     uint8_t ret = 0, i = 0;
-    for (i = 0; i < cluster_num; i++) {
-	util_fit((fabs(clusters[i].c - clusters[i].c_u) > 2));
+    for (i = 0; i < kmeans->cluster_num; i++) {
+	util_fit((fabs(kmeans->clusters[i].c - kmeans->clusters[i].c_u) > 2));
     }
 
     /* For debugging move this call into fail case */
-    _print_clusters();
+    _print_clusters(kmeans);
     goto success;
 
 fail:
@@ -141,35 +151,35 @@ success:
 
 /*------------------------------------------------------------------------------*/
 /* TODO: seperate this function for (n != 2) cases. */
-static int kmeans_get_thold_do(uint8_t n, image_t image)
+static int kmeans_get_thold_do(kmeans_t *kmeans, uint8_t n, image_t image)
 {
     int ret = 0;
-    uint32_t *histogram = NULL, i = 0;
+    uint32_t i = 0;
+    hist_t *histogram = NULL;
 
-    util_fit(((histogram = (uint32_t *)calloc(1, HISTOGRAM_LENGTH * sizeof(uint32_t))) == NULL));
+    util_fit(((histogram = hist_build(image)) == NULL));
 
-    util_fit(((clusters = (cluster_t *)calloc(n, sizeof(cluster_t))) == NULL));
-    cluster_num = n;
+    util_fit(((kmeans->clusters = (cluster_t *)calloc(n, sizeof(cluster_t))) == NULL));
+    kmeans->cluster_num = n;
 
-    for (i = 0; i < image.size; i++) histogram[image.buf[i]]++;
-
-    util_fite((plot_histogram(histogram) != 0),
+    util_fite((plot_histogram(histogram->bins) != 0),
 	    LOG_ERR("Threshold plotting failed!\n"));
 
-    _initialize_clusters();
+    _initialize_clusters(kmeans);
     do {
 	/* loop reset, check function for more detail */
-	_reset_clusters();
+	_reset_clusters(kmeans);
 
 	/* new clustering */
-	for (i = 0; i < HISTOGRAM_LENGTH; i++) _add_point_to_cluster(i, histogram[i]);
+	for (i = 0; i < HISTOGRAM_LENGTH; i++) _add_point_to_cluster(kmeans, i, histogram->bins[i]);
 
 	/* calculate new cluster centroid */
-	_calc_new_centroids();
-    } while (_check_centroids());
+	_calc_new_centroids(kmeans);
+    } while (_check_centroids(kmeans));
 
-    ret = (clusters[0].c + clusters[1].c) / 2;
-    LOG_DBG("c1: %u, c2: %u -> threshold = %d\n", clusters[0].c, clusters[1].c, ret);
+    ret = (kmeans->clusters[0].c + kmeans->clusters[1].c) / 2;
+    LOG_DBG("c1: %u, c2: %u -> threshold = %d\n", kmeans->clusters[0].c,
+	    kmeans->clusters[1].c, ret);
     goto success;
 
 fail:
@@ -177,18 +187,23 @@ fail:
     ret = -1;
 
 success:
-    sfree(histogram);
-    sfree(clusters);
+    hist_free(&histogram);
+    sfree(kmeans->clusters);
     return ret;
 }
 
 /*------------------------------------------------------------------------------*/
-int kmeans_get_thold(uint8_t n, image_t image)
+/*
+ * Initial centroids are drawn from seed, the same seed always gives the same
+ * threshold whichever thread calculates it.
+ */
+int kmeans_get_thold(uint8_t n, image_t image, unsigned int seed)
 {
     int ret = 0, threshold_sum = 0, i = 0;
+    kmeans_t kmeans = { .clusters = NULL, .cluster_num = 0, .seed = seed };
 
     for (i = 0; i < KMEANS_TEST_COUNT; i++) {
-	util_fit(((ret = kmeans_get_thold_do(n, image)) < 0));
+	util_fit(((ret = kmeans_get_thold_do(&kmeans, n, image)) < 0));
 	threshold_sum += ret;
     }
     /* Little hack here: make it darker to eliminate noises more. */
@@ -0,0 +1,322 @@
+/**
+ * \file
+ *	K-d tree for nearest neighbor search over feature vectors
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "util.h"
+#include "kd-tree.h"
+
+#ifndef LOG_LEVEL_CONF_KDTREE
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_KDTREE */
+#define LOG_LEVEL LOG_LEVEL_CONF_KDTREE
+#endif /* LOG_LEVEL_CONF_KDTREE */
+
+/*------------------------------------------------------------------------------*/
+#define KDTREE_LEAF_SIZE    8
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    const fmat_t *fmat;	    /* rows being indexed */
+    uint32_t *rows;	    /* row of each point, reordered while building */
+    kdtree_t *tree;
+    uint32_t capacity;	    /* allocated nodes */
+} kdtree_builder_t;
+
+typedef struct {
+    int32_t index;	    /* original row, -1 if nothing found yet */
+    fmat_val_t distance;    /* squared distance */
+} kdtree_best_t;
+
+typedef struct {
+    uint32_t k;		    /* wanted neighbors */
+    uint32_t noe;	    /* found neighbors, at most k */
+    int32_t *indexes;	    /* original rows, nearest first */
+    fmat_val_t *distances;  /* squared distances, ascending */
+} kdtree_knn_t;
+
+/*------------------------------------------------------------------------------*/
+/* Compares points a and b by dimension dim, ties by row to keep the build stable */
+static int _kdtree_cmp(const fmat_t *fmat, uint32_t a, uint32_t b, uint32_t dim)
+{
+    fmat_val_t x = fmat_row(fmat, a)[dim], y = fmat_row(fmat, b)[dim];
+
+    if (x != y) return (x < y) ? -1 : 1;
+    return (a > b) - (a < b);
+}
+
+/*------------------------------------------------------------------------------*/
+/* Quickselect, after return rows[k] is in place and rows are partitioned around it */
+static void _kdtree_select(const fmat_t *fmat, uint32_t *rows, uint32_t begin, uint32_t end,
+	uint32_t k, uint32_t dim)
+{
+    uint32_t i = 0, store = 0, pivot = 0, tmp = 0;
+
+    while (end - begin > 1) {
+	/* median of three as pivot, moved to the end */
+	pivot = begin + (end - begin) / 2;
+	if (_kdtree_cmp(fmat, rows[pivot], rows[begin], dim) < 0) {
+	    tmp = rows[pivot]; rows[pivot] = rows[begin]; rows[begin] = tmp;
+	}
+	if (_kdtree_cmp(fmat, rows[end - 1], rows[begin], dim) < 0) {
+	    tmp = rows[end - 1]; rows[end - 1] = rows[begin]; rows[begin] = tmp;
+	}
+	if (_kdtree_cmp(fmat, rows[pivot], rows[end - 1], dim) < 0) {
+	    tmp = rows[pivot]; rows[pivot] = rows[end - 1]; rows[end - 1] = tmp;
+	}
+
+	store = begin;
+	for (i = begin; i < end - 1; i++) {
+	    if (_kdtree_cmp(fmat, rows[i], rows[end - 1], dim) < 0) {
+		tmp = rows[i]; rows[i] = rows[store]; rows[store] = tmp;
+		store++;
+	    }
+	}
+	tmp = rows[store]; rows[store] = rows[end - 1]; rows[end - 1] = tmp;
+
+	if (store == k) return;
+	if (k < store) end = store;
+	else begin = store + 1;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+static int32_t _kdtree_build(kdtree_builder_t *builder, uint32_t begin, uint32_t end)
+{
+    int32_t ret = 0, child = 0;
+    uint32_t i = 0, j = 0, dim = 0, mid = 0;
+    fmat_val_t spread = 0, min = 0, max = 0, val = 0;
+    kdtree_node_t *nodes = NULL;
+    const fmat_t *fmat = builder->fmat;
+
+    if (builder->tree->noe == builder->capacity) {
+	util_fite(((nodes = (kdtree_node_t *)realloc(builder->tree->nodes,
+			    (builder->capacity * 2 + 1) * sizeof(kdtree_node_t))) == NULL),
+		LOG_ERR("Nodes allocation failed!\n"));
+	builder->tree->nodes = nodes;
+	builder->capacity = builder->capacity * 2 + 1;
+    }
+    ret = builder->tree->noe++;
+    memset(&builder->tree->nodes[ret], 0, sizeof(kdtree_node_t));
+    builder->tree->nodes[ret].begin = begin;
+    builder->tree->nodes[ret].end = end;
+
+    util_sit((end - begin <= KDTREE_LEAF_SIZE));
+
+    /* split the dimension with the largest spread */
+    spread = 0;
+    for (j = 0; j < fmat->cols; j++) {
+	min = max = fmat_row(fmat, builder->rows[begin])[j];
+	for (i = begin + 1; i < end; i++) {
+	    val = fmat_row(fmat, builder->rows[i])[j];
+	    if (val < min) min = val;
+	    if (val > max) max = val;
+	}
+	if (max - min > spread) {
+	    spread = max - min;
+	    dim = j;
+	}
+    }
+    /* all points are the same, keep them in one leaf */
+    util_sit((spread == 0));
+
+    mid = begin + (end - begin) / 2;
+    _kdtree_select(fmat, builder->rows, begin, end, mid, dim);
+
+    builder->tree->nodes[ret].dim = dim;
+    builder->tree->nodes[ret].split = fmat_row(fmat, builder->rows[mid])[dim];
+
+    /* nodes may move while building the children, index them each time */
+    util_fit(((child = _kdtree_build(builder, begin, mid)) < 0));
+    builder->tree->nodes[ret].left = child;
+    util_fit(((child = _kdtree_build(builder, mid, end)) < 0));
+    builder->tree->nodes[ret].right = child;
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static void _kdtree_search(const kdtree_t *tree, uint32_t n, const fmat_val_t *point,
+	double slack, kdtree_best_t *best)
+{
+    uint32_t i = 0;
+    fmat_val_t diff = 0, distance = 0;
+    const kdtree_node_t *node = &tree->nodes[n];
+
+    if (node->left == 0 && node->right == 0) {
+	for (i = node->begin; i < node->end; i++) {
+	    distance = fmat_distance(point, fmat_row(tree->points, i), tree->points->stride);
+	    if (best->index < 0 || distance < best->distance ||
+		    (distance == best->distance && (int32_t)tree->index[i] < best->index)) {
+		best->distance = distance;
+		best->index = tree->index[i];
+	    }
+	}
+	return;
+    }
+
+    diff = point[node->dim] - node->split;
+    _kdtree_search(tree, (diff <= 0) ? node->left : node->right, point, slack, best);
+
+    /* Squared plane distance never exceeds the computed distance of a point
+     * behind the plane, so strict comparison keeps ties of the exact search. */
+    if (slack > 0) {
+	if (sqrt(diff * diff) + slack >= sqrt(best->distance)) return;
+    } else {
+	if (diff * diff > best->distance) return;
+    }
+    _kdtree_search(tree, (diff <= 0) ? node->right : node->left, point, slack, best);
+}
+
+/*------------------------------------------------------------------------------*/
+/* Inserts into the ascending (distance, row) list if it is among the k nearest */
+static void _kdtree_knn_insert(kdtree_knn_t *knn, int32_t index, fmat_val_t distance)
+{
+    uint32_t i = knn->noe;
+
+    if (knn->noe == knn->k) {
+	if (distance > knn->distances[knn->k - 1] || (distance == knn->distances[knn->k - 1] &&
+		    index > knn->indexes[knn->k - 1])) {
+	    return;
+	}
+	i--;
+    } else {
+	knn->noe++;
+    }
+
+    while (i > 0 && (knn->distances[i - 1] > distance ||
+		(knn->distances[i - 1] == distance && knn->indexes[i - 1] > index))) {
+	knn->distances[i] = knn->distances[i - 1];
+	knn->indexes[i] = knn->indexes[i - 1];
+	i--;
+    }
+    knn->distances[i] = distance;
+    knn->indexes[i] = index;
+}
+
+/*------------------------------------------------------------------------------*/
+static void _kdtree_knn_search(const kdtree_t *tree, uint32_t n, const fmat_val_t *point,
+	kdtree_knn_t *knn)
+{
+    uint32_t i = 0;
+    fmat_val_t diff = 0;
+    const kdtree_node_t *node = &tree->nodes[n];
+
+    if (node->left == 0 && node->right == 0) {
+	for (i = node->begin; i < node->end; i++) {
+	    _kdtree_knn_insert(knn, tree->index[i],
+		    fmat_distance(point, fmat_row(tree->points, i), tree->points->stride));
+	}
+	return;
+    }
+
+    diff = point[node->dim] - node->split;
+    _kdtree_knn_search(tree, (diff <= 0) ? node->left : node->right, point, knn);
+
+    /* Far side can only help while the list is not full or beats the worst one */
+    if (knn->noe == knn->k && diff * diff > knn->distances[knn->k - 1]) return;
+    _kdtree_knn_search(tree, (diff <= 0) ? node->right : node->left, point, knn);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Builds a tree over the rows of fmat, the rows are copied.
+ */
+kdtree_t* kdtree_build(const fmat_t *fmat)
+{
+    uint32_t i = 0;
+    kdtree_t *tree = NULL;
+    kdtree_builder_t builder = { .fmat = fmat, .rows = NULL, .tree = NULL, .capacity = 0 };
+
+    LOG_DBG("rows:%u cols:%u\n", fmat->rows, fmat->cols);
+
+    util_fite((fmat->rows == 0), LOG_ERR("There is nothing to index!\n"));
+
+    util_fite(((tree = (kdtree_t *)calloc(1, sizeof(kdtree_t))) == NULL),
+	    LOG_ERR("Tree allocation failed!\n"));
+    util_fite(((tree->index = (uint32_t *)malloc(fmat->rows * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Tree index allocation failed!\n"));
+    for (i = 0; i < fmat->rows; i++) {
+	tree->index[i] = i;
+    }
+
+    builder.rows = tree->index;
+    builder.tree = tree;
+    util_fit((_kdtree_build(&builder, 0, fmat->rows) < 0));
+
+    /* copy points in tree order so leaves are scanned contiguously */
+    util_fit(((tree->points = fmat_alloc(fmat->rows, fmat->cols)) == NULL));
+    for (i = 0; i < fmat->rows; i++) {
+	memcpy(fmat_row(tree->points, i), fmat_row(fmat, tree->index[i]),
+		fmat->stride * sizeof(fmat_val_t));
+    }
+
+    LOG_DBG("%u nodes built\n", tree->noe);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    kdtree_free(&tree);
+
+success:
+    return tree;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns the original row nearest to point (ties go to the smaller row) and
+ * stores the squared distance. With a positive slack the search is approximate:
+ * the returned point is at most slack farther than the nearest one.
+ */
+int32_t kdtree_nearest(const kdtree_t *tree, const fmat_val_t *point, double slack,
+	fmat_val_t *distance)
+{
+    kdtree_best_t best = { .index = -1, .distance = 0 };
+
+    _kdtree_search(tree, 0, point, slack, &best);
+    if (distance) *distance = best.distance;
+    return best.index;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Finds the k nearest original rows of point, nearest first (ties go to the
+ * smaller row), with their squared distances. Returns the number found, which
+ * is less than k only if the tree has less than k points.
+ */
+uint32_t kdtree_knn(const kdtree_t *tree, const fmat_val_t *point, uint32_t k,
+	int32_t *indexes, fmat_val_t *distances)
+{
+    kdtree_knn_t knn = { .k = k, .noe = 0, .indexes = indexes, .distances = distances };
+
+    if (k == 0) return 0;
+
+    _kdtree_knn_search(tree, 0, point, &knn);
+    return knn.noe;
+}
+
+/*------------------------------------------------------------------------------*/
+void kdtree_free(kdtree_t **tree)
+{
+    if (*tree == NULL) return;
+
+    sfree((*tree)->nodes);
+    sfree((*tree)->index);
+    sfree_fmat((*tree)->points);
+    sfree(*tree);
+}
@@ -0,0 +1,329 @@
+/**
+ * \file
+ *	Lookup table point operations
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "util.h"
+#include "lut.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LUT_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define LUT_HAVE_AVX2 0
+#endif
+
+#ifndef LOG_LEVEL_CONF_LUT
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_LUT */
+#define LOG_LEVEL LOG_LEVEL_CONF_LUT
+#endif /* LOG_LEVEL_CONF_LUT */
+
+/*------------------------------------------------------------------------------*/
+#define LUT_NAME_LEN	    32
+/* Part of the pixels clipped at each end by a plain 'stretch' */
+#define LUT_STRETCH_CLIP    0.01
+
+/*------------------------------------------------------------------------------*/
+typedef void (*lut_apply_fn_t)(const lut_t *, uint8_t *, const uint8_t *, size_t);
+
+static void _lut_apply_init(const lut_t *, uint8_t *, const uint8_t *, size_t);
+
+static lut_apply_fn_t lut_apply_fn = _lut_apply_init;
+
+/*------------------------------------------------------------------------------*/
+static void _lut_apply_scalar(const lut_t *lut, uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+
+    for (i = 0; i < n; i++) {
+	dst[i] = lut->map[src[i]];
+    }
+}
+
+#if LUT_HAVE_AVX2
+/*------------------------------------------------------------------------------*/
+/*
+ * 8 pixels a gather from the table widened to 32 bits, the four of a 32 pixel
+ * step are packed back to bytes. Byte shuffles need 16 lookups and blends per
+ * step, gathers are faster even without optimization.
+ */
+__attribute__((target("avx2")))
+static void _lut_apply_avx2(const lut_t *lut, uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    uint32_t v = 0;
+    int32_t table[LUT_SIZE];
+    __m128i low, high;
+    __m256i a, b, c, d;
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    if (n < 32) {
+	_lut_apply_scalar(lut, dst, src, n);
+	return;
+    }
+    for (v = 0; v < LUT_SIZE; v++) {
+	table[v] = lut->map[v];
+    }
+    for (i = 0; i + 32 <= n; i += 32) {
+	low = _mm_loadu_si128((const __m128i *)&src[i]);
+	high = _mm_loadu_si128((const __m128i *)&src[i + 16]);
+	a = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(low), 4);
+	b = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8)), 4);
+	c = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(high), 4);
+	d = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8)), 4);
+	/* packs work in 128 bit halves, order puts the 4 pixel groups back */
+	a = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+	_mm256_storeu_si256((__m256i *)&dst[i], _mm256_permutevar8x32_epi32(a, order));
+    }
+    _lut_apply_scalar(lut, &dst[i], &src[i], n - i);
+}
+#endif /* LUT_HAVE_AVX2 */
+
+/*------------------------------------------------------------------------------*/
+static void _lut_apply_init(const lut_t *lut, uint8_t *dst, const uint8_t *src, size_t n)
+{
+    lut_apply_fn_t fn = _lut_apply_scalar;
+
+#if LUT_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) fn = _lut_apply_avx2;
+#endif /* LUT_HAVE_AVX2 */
+
+    __atomic_store_n(&lut_apply_fn, fn, __ATOMIC_RELAXED);
+    fn(lut, dst, src, n);
+}
+
+/*------------------------------------------------------------------------------*/
+void lut_identity(lut_t *lut)
+{
+    uint32_t v = 0;
+
+    for (v = 0; v < LUT_SIZE; v++) {
+	lut->map[v] = v;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Values up to thold become below, the others above */
+void lut_threshold(lut_t *lut, uint8_t thold, uint8_t below, uint8_t above)
+{
+    uint32_t v = 0;
+
+    for (v = 0; v < LUT_SIZE; v++) {
+	lut->map[v] = (v > thold) ? above : below;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Products keep their low 8 bits as a uint8_t multiply does */
+void lut_multiply(lut_t *lut, uint32_t factor)
+{
+    uint32_t v = 0;
+
+    for (v = 0; v < LUT_SIZE; v++) {
+	lut->map[v] = (uint8_t)(v * factor);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+void lut_invert(lut_t *lut)
+{
+    uint32_t v = 0;
+
+    for (v = 0; v < LUT_SIZE; v++) {
+	lut->map[v] = UINT8_MAX - v;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* 255 * (v / 255) ^ gamma rounded, gamma below 1 brightens */
+int lut_gamma(lut_t *lut, double gamma)
+{
+    int ret = 0;
+    uint32_t v = 0;
+
+    util_fite((!(gamma > 0)), LOG_ERR("Gamma %g is not positive!\n", gamma));
+    for (v = 0; v < LUT_SIZE; v++) {
+	lut->map[v] = lround(UINT8_MAX * pow(v / (double)UINT8_MAX, gamma));
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Spreads the cumulative histogram over 0..255, the smallest value present
+ * becomes 0 and the biggest 255. An image of one value is not changed.
+ */
+void lut_equalize(lut_t *lut, const hist_t *hist)
+{
+    uint32_t v = 0;
+    uint64_t sum = 0, min = 0;
+
+    lut_identity(lut);
+    for (v = 0; v < LUT_SIZE && hist->bins[v] == 0; v++);
+    if (v == LUT_SIZE || (min = hist->bins[v]) == hist->total) return;
+
+    for (v = 0; v < LUT_SIZE; v++) {
+	sum += hist->bins[v];
+	lut->map[v] = (sum <= min) ? 0 :
+	    ((sum - min) * UINT8_MAX * 2 + (hist->total - min)) / ((hist->total - min) * 2);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Maps the values between the clip and 1 - clip percentiles linearly to
+ * 0..255, the ones out of them are saturated.
+ */
+void lut_stretch(lut_t *lut, const hist_t *hist, double clip)
+{
+    uint32_t v = 0, low = hist_percentile(hist, 0, clip),
+	     high = hist_percentile(hist, 0, 1 - clip);
+
+    lut_identity(lut);
+    if (high <= low) return;
+
+    for (v = 0; v < LUT_SIZE; v++) {
+	lut->map[v] = (v <= low) ? 0 : (v >= high) ? UINT8_MAX :
+	    ((v - low) * UINT8_MAX * 2 + (high - low)) / ((high - low) * 2);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* lut becomes lut followed by next, applying it is one lookup */
+void lut_compose(lut_t *lut, const lut_t *next)
+{
+    uint32_t v = 0;
+
+    for (v = 0; v < LUT_SIZE; v++) {
+	lut->map[v] = next->map[lut->map[v]];
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Histogram of the values mapped by lut, bins has LUT_SIZE entries */
+static void _lut_hist(const lut_t *lut, const hist_t *hist, uint32_t *bins)
+{
+    uint32_t v = 0;
+
+    memset(bins, 0, LUT_SIZE * sizeof(uint32_t));
+    for (v = 0; v < LUT_SIZE; v++) {
+	bins[lut->map[v]] += hist->bins[v];
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Appends the operation name to lut, hist is the one of the values lut gives */
+static int _lut_add(lut_t *lut, const char *name, const hist_t *hist)
+{
+    int ret = 0;
+    char *end = NULL;
+    const char *arg = strchr(name, ':');
+    double value = 0;
+    lut_t next;
+
+    if (arg) {
+	value = strtod(++arg, &end);
+	util_fite((end == arg || *end != '\0'), LOG_ERR("Invalid argument in '%s'!\n", name));
+    }
+
+    if (!strcmp("invert", name)) {
+	lut_invert(&next);
+    } else if (!strcmp("equalize", name)) {
+	lut_equalize(&next, hist);
+    } else if (!strcmp("stretch", name)) {
+	lut_stretch(&next, hist, LUT_STRETCH_CLIP);
+    } else if (!strncmp("stretch:", name, 8) && value >= 0 && value < 0.5) {
+	lut_stretch(&next, hist, value);
+    } else if (!strncmp("gamma:", name, 6)) {
+	util_fit((lut_gamma(&next, value) != 0));
+    } else if (!strncmp("threshold:", name, 10) && value >= 0 && value <= UINT8_MAX) {
+	lut_threshold(&next, value, 0, UINT8_MAX);
+    } else {
+	LOG_ERR("Point operation '%s' is not supported!\n", name);
+	goto fail;
+    }
+    lut_compose(lut, &next);
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Collapses a comma separated point operation list into one lut:
+ *   invert, gamma:<g>, equalize, stretch[:<clip>], threshold:<t>
+ * hist is the one of the image the lut is for, the operations that need a
+ * histogram get the one of the values the operations before them give.
+ */
+int lut_parse(lut_t *lut, const char *list, const hist_t *hist)
+{
+    int ret = 0;
+    size_t len = 0;
+    char name[LUT_NAME_LEN];
+    uint32_t bins[LUT_SIZE];
+    hist_t mapped = { .noe = LUT_SIZE, .bins = bins, .total = hist->total };
+
+    LOG_DBG("list:'%s'\n", list);
+
+    util_fite((hist->noe != LUT_SIZE), LOG_ERR("Histogram of %u bins!\n", hist->noe));
+    lut_identity(lut);
+    while (1) {
+	len = strcspn(list, ",");
+	util_fite((len == 0 || len >= LUT_NAME_LEN),
+		LOG_ERR("Invalid point operation in '%s'!\n", list));
+	memcpy(name, list, len);
+	name[len] = '\0';
+	_lut_hist(lut, hist, bins);
+	util_fit((_lut_add(lut, name, &mapped) != 0));
+
+	if (list[len] == '\0') break;
+	list += len + 1;
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/* dst[i] = map[src[i]] for n pixels, dst may be src */
+void lut_apply(const lut_t *lut, uint8_t *dst, const uint8_t *src, size_t n)
+{
+    lut_apply_fn_t fn = __atomic_load_n(&lut_apply_fn, __ATOMIC_RELAXED);
+
+    fn(lut, dst, src, n);
+}
+
+/*------------------------------------------------------------------------------*/
+void lut_apply_image(const lut_t *lut, image_t image)
+{
+    lut_apply(lut, image.buf, image.buf, image.size);
+}
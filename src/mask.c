@@ -9,10 +9,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "log.h"
 #include "util.h"
 #include "mask.h"
+#include "integral.h"
+#include "fft.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MASK_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define MASK_HAVE_AVX2 0
+#endif
 
 #ifndef LOG_LEVEL_CONF_MASK
 #define LOG_LEVEL LOG_LEVEL_ERR
@@ -21,25 +31,195 @@
 #endif /* LOG_LEVEL_CONF_MASK */
 
 /*------------------------------------------------------------------------------*/
-static int _get_sum(mask_t mask)
+#define MASK_KEYWORD_LEN    16
+#define MASK_KEYWORD_SF	    "%15s"
+
+/* Output pixels of a SIMD step */
+#define MASK_LANES	    8
+/* Constant masks bigger than this run as box sums, smaller ones are faster
+ * with the separable kernels */
+#define MASK_BOX_MIN_AREA   49
+/* Masks of this many values or more run on FFT tiles unless they are
+ * separable, see cv_mask_bench for the crossover */
+#define MASK_FFT_MIN_AREA   MASK_CONF_FFT_MIN_AREA
+/* FFT tile sides tried */
+#define MASK_FFT_MIN_TILE   32
+#define MASK_FFT_MAX_TILE   1024
+/* Median histograms, 16 coarse bins of the high nibble then 256 fine bins */
+#define MASK_MEDIAN_COARSE  16
+#define MASK_MEDIAN_BINS    (MASK_MEDIAN_COARSE + 256)
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Normalization of a mask sum, the output pixel is the sum over the mask
+ * divisor rounded half up and saturated to 0..255. It is the integer floor of
+ *   n = sum * sign + bias	  (sign is +-2, bias is |mask divisor|)
+ * over divisor, a shift if that is a power of two. n is clamped to the part
+ * that does not saturate, so products stay in int32 lanes.
+ */
+typedef struct {
+    int32_t sign;
+    int32_t bias;
+    int32_t divisor;	/* 2 * |mask divisor| */
+    uint8_t shift;	/* log2 of divisor if it is a power of two, else 0 */
+    float inverse;	/* 1 / divisor, SIMD quotient estimate */
+    int32_t lo;
+    int32_t hi;
+} mask_norm_t;
+
+typedef struct mask_conv mask_conv_t;
+
+/* Writes output columns first to last (not included) of row i into dst */
+typedef void (*mask_row_fn_t)(const mask_conv_t *, uint32_t, uint32_t, uint32_t, uint8_t *);
+/* Fills the line buffer for row i */
+typedef void (*mask_column_fn_t)(const mask_conv_t *, uint32_t);
+
+struct mask_conv {
+    const mask_t *mask;
+    mask_norm_t norm;
+    const uint8_t * const *rows; /* original pixels, indexed by image row */
+    uint32_t width;	/* of the image */
+    int32_t *line;	/* column pass sums of a row, separable masks only */
+    mask_row_fn_t row_fn;
+    mask_column_fn_t column_fn; /* separable masks only */
+};
+
+/* Adds the add histogram to the kernel histogram and subtracts sub */
+typedef void (*mask_median_fn_t)(uint16_t *, const uint16_t *, const uint16_t *);
+
+/* Masks an image a row at a time, rows may come from a rolling buffer */
+struct mask_stream {
+    mask_conv_t conv;
+    uint32_t height;	/* of the image */
+    uint8_t idle;	/* image is smaller than the mask, rows are copied */
+};
+
+/*------------------------------------------------------------------------------*/
+static inline uint8_t _mask_out(const mask_norm_t *norm, int32_t sum)
 {
-    uint32_t i = 0, j = 0;
-    uint16_t sum = 0;
+    int32_t n = sum * norm->sign + norm->bias, q = 0;
+
+    n = (n < norm->lo) ? norm->lo : (n > norm->hi) ? norm->hi : n;
+    if (norm->shift) {
+	q = n >> norm->shift;
+    } else {
+	q = n / norm->divisor;
+	q -= (n % norm->divisor < 0);
+    }
+    return (q < 0) ? 0 : (q > UINT8_MAX) ? UINT8_MAX : q;
+}
+
+/*------------------------------------------------------------------------------*/
+static int16_t _mask_gcd(int16_t a, int16_t b)
+{
+    int16_t t = 0;
+
+    a = abs(a);
+    b = abs(b);
+    while (b) {
+	t = a % b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Reads n values of the mask file into buf */
+static int _mask_read_values(FILE *file, int16_t *buf, uint32_t n)
+{
+    int ret = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < n; i++) {
+	util_fite((fscanf(file, "%hd", &buf[i]) != 1), LOG_ERR("Reading mask[%u] failed!\n", i));
+	LOG_DBG_("mask[%u]=%d\n", i, buf[i]);
+    }
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Finds integer factors of a rank-1 mask: every row is a multiple of the
+ * first non zero row divided by the gcd of its values. Factors are kept only
+ * if their outer product gives the mask back exactly.
+ */
+static int _mask_factorize(mask_t *mask)
+{
+    int ret = 0;
+    uint32_t i = 0, j = 0, r = 0, p = 0;
+    int16_t g = 0, pivot = 0;
+    const int16_t *buf = mask->buf;
+
+    /* First non zero row and its first non zero value */
+    for (r = 0; r < mask->height; r++) {
+	for (p = 0; p < mask->width && buf[r * mask->width + p] == 0; p++);
+	if (p < mask->width) break;
+    }
+    util_sit((r == mask->height));
+
+    for (j = 0; j < mask->width; j++) {
+	g = _mask_gcd(g, buf[r * mask->width + j]);
+    }
+    pivot = buf[r * mask->width + p] / g;
+
+    for (i = 0; i < mask->height; i++) {
+	util_sit((buf[i * mask->width + p] % pivot != 0));
+    }
 
-    for (i = 0; i < mask.height; i++) {
-	for (j = 0; j < mask.width; j++) {
-	    sum += mask.buf[i * mask.width + j];
+    util_fite(((mask->row = (int16_t *)malloc(mask->width * sizeof(int16_t))) == NULL),
+	    LOG_ERR("Mask row allocation failed!\n"));
+    util_fite(((mask->column = (int16_t *)malloc(mask->height * sizeof(int16_t))) == NULL),
+	    LOG_ERR("Mask column allocation failed!\n"));
+    for (j = 0; j < mask->width; j++) {
+	mask->row[j] = buf[r * mask->width + j] / g;
+    }
+    for (i = 0; i < mask->height; i++) {
+	mask->column[i] = buf[i * mask->width + p] / pivot;
+    }
+
+    for (i = 0; i < mask->height; i++) {
+	for (j = 0; j < mask->width; j++) {
+	    if ((int32_t)mask->column[i] * mask->row[j] != buf[i * mask->width + j]) {
+		sfree(mask->row);
+		sfree(mask->column);
+		goto success;
+	    }
 	}
     }
-    return sum;
+    LOG_DBG("%ux%u mask is separable\n", mask->width, mask->height);
+    goto success;
+
+fail:
+    sfree(mask->row);
+    sfree(mask->column);
+    ret = -1;
+
+success:
+    return ret;
 }
 
 /*------------------------------------------------------------------------------*/
+/*
+ * Reads a mask file, it is either the values of the mask
+ *   <width> <height> <height rows of width values>
+ * or its row and column factors
+ *   separable <width> <height> <width row values> <height column values>
+ * Masks given with their values are factorized if they are rank-1.
+ */
 mask_t* mask_read_from_file(const char *filename)
 {
     FILE *file = NULL;
     mask_t *mask = NULL;
     uint32_t i = 0, j = 0;
+    uint8_t separable = 0;
+    char keyword[MASK_KEYWORD_LEN];
 
     LOG_DBG("filename:'%s'\n", filename);
 
@@ -48,8 +228,16 @@ mask_t* mask_read_from_file(const char *filename)
     util_fite(((mask = (mask_t *)calloc(1, sizeof(mask_t))) == NULL),
 	    LOG_ERR("Mask allocation failed!\n"));
 
-    util_fite(((fscanf(file, "%u %u", &mask->width, &mask->height)) != 2),
-	    LOG_ERR("Reading width/height failed!\n"));
+    util_fite(((fscanf(file, MASK_KEYWORD_SF, keyword)) != 1), LOG_ERR("Reading mask failed!\n"));
+    separable = (strcmp(keyword, "separable") == 0);
+    if (separable) {
+	util_fite(((fscanf(file, "%u %u", &mask->width, &mask->height)) != 2),
+		LOG_ERR("Reading width/height failed!\n"));
+    } else {
+	util_fite(((sscanf(keyword, "%u", &mask->width)) != 1 ||
+		    (fscanf(file, "%u", &mask->height)) != 1),
+		LOG_ERR("Reading width/height failed!\n"));
+    }
 
     util_fite((mask->width == 0 || mask->height == 0),
 	    LOG_ERR("width/height can not be zero!\n"));
@@ -57,13 +245,21 @@ mask_t* mask_read_from_file(const char *filename)
     util_fite(((mask->buf = (int16_t *)malloc(mask->width * mask->height * sizeof(int16_t))) == NULL),
 	    LOG_ERR("Mask buf allocation failed!\n"));
 
-    for (i = 0; i < mask->height; i++) {
-	for (j = 0; j < mask->width; j++) {
-	    int16_t *ptr = &mask->buf[i * mask->width + j];
-	    util_fite((fscanf(file, "%hd", ptr) != 1),
-			LOG_ERR("Reading mask[%u][%u] failed!\n", i, j));
-	    LOG_DBG_("mask[%u][%u]=%d\n", i, j, *ptr);
+    if (separable) {
+	util_fite(((mask->row = (int16_t *)malloc(mask->width * sizeof(int16_t))) == NULL),
+		LOG_ERR("Mask row allocation failed!\n"));
+	util_fite(((mask->column = (int16_t *)malloc(mask->height * sizeof(int16_t))) == NULL),
+		LOG_ERR("Mask column allocation failed!\n"));
+	util_fit((_mask_read_values(file, mask->row, mask->width) != 0));
+	util_fit((_mask_read_values(file, mask->column, mask->height) != 0));
+	for (i = 0; i < mask->height; i++) {
+	    for (j = 0; j < mask->width; j++) {
+		mask->buf[i * mask->width + j] = mask->column[i] * mask->row[j];
+	    }
 	}
+    } else {
+	util_fit((_mask_read_values(file, mask->buf, mask->width * mask->height) != 0));
+	util_fit((_mask_factorize(mask) != 0));
     }
     goto success;
 
@@ -76,38 +272,533 @@ success:
 }
 
 /*------------------------------------------------------------------------------*/
-int mask_apply(image_t image, mask_t mask)
+/*
+ * Picks the normalization of the mask, sums are divided by the mask sum or by
+ * one if it is zero. Masks whose sums may overflow int32 are rejected.
+ */
+static int _mask_norm(const mask_t *mask, mask_norm_t *norm)
+{
+    int ret = 0;
+    uint32_t i = 0;
+    int64_t sum = 0, taps = 0;
+
+    for (i = 0; i < mask->width * mask->height; i++) {
+	sum += mask->buf[i];
+	taps += abs(mask->buf[i]);
+    }
+    /* Biggest n and the clamp bound */
+    util_fite((2 * (UINT8_MAX + 1) * taps > INT32_MAX),
+	    LOG_ERR("Mask sums do not fit in 32 bits!\n"));
+    sum = sum ? sum : 1;
+
+    norm->sign = (sum > 0) ? 2 : -2;
+    norm->bias = llabs(sum);
+    norm->divisor = 2 * norm->bias;
+    for (norm->shift = 0; (INT32_C(1) << norm->shift) < norm->divisor; norm->shift++);
+    if ((INT32_C(1) << norm->shift) != norm->divisor) norm->shift = 0;
+    norm->inverse = 1.0f / norm->divisor;
+    /* Quotients -1 to 256, the rest saturates */
+    norm->lo = -norm->divisor;
+    norm->hi = (UINT8_MAX + 1) * norm->divisor;
+    LOG_DBG("divisor:%ld shift:%u\n", (long)sum, norm->shift);
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static void _mask_full_row(const mask_conv_t *conv, uint32_t i, uint32_t first,
+	uint32_t last, uint8_t *dst)
+{
+    const mask_t *mask = conv->mask;
+    uint32_t j = 0, k = 0, l = 0;
+    int32_t sum = 0;
+    const uint8_t *src = NULL;
+
+    for (j = first; j < last; j++) {
+	sum = 0;
+	for (k = 0; k < mask->height; k++) {
+	    src = &conv->rows[i + k - mask->height / 2][j - mask->width / 2];
+	    for (l = 0; l < mask->width; l++) {
+		sum += mask->buf[k * mask->width + l] * src[l];
+	    }
+	}
+	dst[j] = _mask_out(&conv->norm, sum);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Column factor over whole rows into the line buffer */
+static void _mask_column_pass(const mask_conv_t *conv, uint32_t i)
+{
+    const mask_t *mask = conv->mask;
+    uint32_t j = 0, k = 0;
+    int32_t factor = 0;
+    const uint8_t *src = NULL;
+
+    memset(conv->line, 0, conv->width * sizeof(int32_t));
+    for (k = 0; k < mask->height; k++) {
+	if ((factor = mask->column[k]) == 0) continue;
+	src = conv->rows[i + k - mask->height / 2];
+	for (j = 0; j < conv->width; j++) {
+	    conv->line[j] += factor * src[j];
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/* Row factor along the line buffer */
+static void _mask_row_pass(const mask_conv_t *conv, uint32_t i, uint32_t first,
+	uint32_t last, uint8_t *dst)
+{
+    const mask_t *mask = conv->mask;
+    uint32_t j = 0, l = 0;
+    int32_t sum = 0;
+    const int32_t *line = NULL;
+
+    for (j = first; j < last; j++) {
+	sum = 0;
+	line = &conv->line[j - mask->width / 2];
+	for (l = 0; l < mask->width; l++) {
+	    sum += mask->row[l] * line[l];
+	}
+	dst[j] = _mask_out(&conv->norm, sum);
+    }
+}
+
+#if MASK_HAVE_AVX2
+/*------------------------------------------------------------------------------*/
+/*
+ * Normalizes eight sums and stores them as saturated bytes. Without a shift
+ * the float quotient is off by at most one, the remainder corrects it.
+ */
+__attribute__((target("avx2")))
+static inline void _mask_out_avx2(const mask_norm_t *norm, __m256i sum, uint8_t *dst)
+{
+    __m256i n, q, r, divisor = _mm256_set1_epi32(norm->divisor);
+    __m128i words;
+
+    n = _mm256_add_epi32(_mm256_mullo_epi32(sum, _mm256_set1_epi32(norm->sign)),
+	    _mm256_set1_epi32(norm->bias));
+    n = _mm256_min_epi32(_mm256_max_epi32(n, _mm256_set1_epi32(norm->lo)),
+	    _mm256_set1_epi32(norm->hi));
+    if (norm->shift) {
+	q = _mm256_sra_epi32(n, _mm_cvtsi32_si128(norm->shift));
+    } else {
+	q = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(n),
+			_mm256_set1_ps(norm->inverse))));
+	r = _mm256_sub_epi32(n, _mm256_mullo_epi32(q, divisor));
+	/* Compare masks are -1, r >= divisor adds one and r < 0 subtracts one */
+	q = _mm256_sub_epi32(q, _mm256_cmpgt_epi32(r, _mm256_sub_epi32(divisor,
+			_mm256_set1_epi32(1))));
+	q = _mm256_add_epi32(q, _mm256_cmpgt_epi32(_mm256_setzero_si256(), r));
+    }
+    words = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+    _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(words, words));
+}
+
+/*------------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static inline __m256i _mask_load_avx2(const uint8_t *src)
+{
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src));
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Eight output pixels per step, each tap is a broadcast weight times eight
+ * widened pixels. Sizes up to 7x7 keep their weights in registers.
+ */
+#define MASK_FULL_ROW_AVX2(_name, _size)						\
+__attribute__((target("avx2")))								\
+static void _name(const mask_conv_t *conv, uint32_t i, uint32_t first, uint32_t last,	\
+	uint8_t *dst)									\
+{											\
+    const mask_t *mask = conv->mask;							\
+    uint32_t j = first, k = 0, l = 0;							\
+    uint32_t width = (_size) ? (_size) : mask->width;					\
+    uint32_t height = (_size) ? (_size) : mask->height;					\
+    __m256i sum, weights[(_size) ? (_size) * (_size) : 1];				\
+    const uint8_t *src = NULL;								\
+											\
+    for (k = 0; k < (_size) * (_size); k++) {						\
+	weights[k] = _mm256_set1_epi32(mask->buf[k]);					\
+    }											\
+    for (; j + MASK_LANES <= last; j += MASK_LANES) {					\
+	sum = _mm256_setzero_si256();							\
+	for (k = 0; k < height; k++) {							\
+	    src = &conv->rows[i + k - height / 2][j - width / 2];			\
+	    for (l = 0; l < width; l++) {						\
+		sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(_mask_load_avx2(&src[l]),\
+			    (_size) ? weights[k * width + l] :				\
+			    _mm256_set1_epi32(mask->buf[k * width + l])));		\
+	    }										\
+	}										\
+	_mask_out_avx2(&conv->norm, sum, &dst[j]);					\
+    }											\
+    _mask_full_row(conv, i, j, last, dst);						\
+}
+
+MASK_FULL_ROW_AVX2(_mask_full_row_avx2, 0)
+MASK_FULL_ROW_AVX2(_mask_full_row_avx2_3, 3)
+MASK_FULL_ROW_AVX2(_mask_full_row_avx2_5, 5)
+MASK_FULL_ROW_AVX2(_mask_full_row_avx2_7, 7)
+
+/*------------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static void _mask_column_pass_avx2(const mask_conv_t *conv, uint32_t i)
+{
+    const mask_t *mask = conv->mask;
+    uint32_t j = 0, k = 0;
+    __m256i factor;
+    const uint8_t *src = NULL;
+
+    memset(conv->line, 0, conv->width * sizeof(int32_t));
+    for (k = 0; k < mask->height; k++) {
+	if (mask->column[k] == 0) continue;
+	src = conv->rows[i + k - mask->height / 2];
+	factor = _mm256_set1_epi32(mask->column[k]);
+	for (j = 0; j + MASK_LANES <= conv->width; j += MASK_LANES) {
+	    _mm256_storeu_si256((__m256i *)&conv->line[j], _mm256_add_epi32(
+			_mm256_loadu_si256((const __m256i *)&conv->line[j]),
+			_mm256_mullo_epi32(_mask_load_avx2(&src[j]), factor)));
+	}
+	for (; j < conv->width; j++) {
+	    conv->line[j] += mask->column[k] * src[j];
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static void _mask_row_pass_avx2(const mask_conv_t *conv, uint32_t i, uint32_t first,
+	uint32_t last, uint8_t *dst)
+{
+    const mask_t *mask = conv->mask;
+    uint32_t j = first, l = 0;
+    __m256i sum;
+    const int32_t *line = NULL;
+
+    for (; j + MASK_LANES <= last; j += MASK_LANES) {
+	sum = _mm256_setzero_si256();
+	line = &conv->line[j - mask->width / 2];
+	for (l = 0; l < mask->width; l++) {
+	    sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(
+			_mm256_loadu_si256((const __m256i *)&line[l]),
+			_mm256_set1_epi32(mask->row[l])));
+	}
+	_mask_out_avx2(&conv->norm, sum, &dst[j]);
+    }
+    _mask_row_pass(conv, i, j, last, dst);
+}
+#endif /* MASK_HAVE_AVX2 */
+
+/*------------------------------------------------------------------------------*/
+static uint8_t _mask_avx2(void)
+{
+    static int8_t avx2 = -1;
+    int8_t supported = __atomic_load_n(&avx2, __ATOMIC_RELAXED);
+
+    if (supported < 0) {
+	supported = 0;
+#if MASK_HAVE_AVX2
+	__builtin_cpu_init();
+	supported = __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif /* MASK_HAVE_AVX2 */
+	__atomic_store_n(&avx2, supported, __ATOMIC_RELAXED);
+    }
+    return supported;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Picks the normalization and the kernels of the mask for width wide rows */
+static int _mask_conv_init(mask_conv_t *conv, const mask_t *mask, uint32_t width)
+{
+    int ret = 0;
+    uint8_t separable = (mask->row && mask->column);
+
+    memset(conv, 0, sizeof(mask_conv_t));
+    conv->mask = mask;
+    conv->width = width;
+    conv->row_fn = separable ? _mask_row_pass : _mask_full_row;
+    conv->column_fn = _mask_column_pass;
+    util_fit((_mask_norm(mask, &conv->norm) != 0));
+
+#if MASK_HAVE_AVX2
+    if (_mask_avx2()) {
+	conv->column_fn = _mask_column_pass_avx2;
+	if (separable) {
+	    conv->row_fn = _mask_row_pass_avx2;
+	} else if (mask->width != mask->height) {
+	    conv->row_fn = _mask_full_row_avx2;
+	} else {
+	    conv->row_fn = (mask->width == 3) ? _mask_full_row_avx2_3 :
+		(mask->width == 5) ? _mask_full_row_avx2_5 :
+		(mask->width == 7) ? _mask_full_row_avx2_7 : _mask_full_row_avx2;
+	}
+    }
+#endif /* MASK_HAVE_AVX2 */
+
+    if (separable) {
+	util_fite(((conv->line = (int32_t *)malloc(width * sizeof(int32_t))) == NULL),
+		LOG_ERR("Mask line buffer allocation failed\n"));
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Writes the masked columns of row i, the mask center is on row i */
+static inline void _mask_conv_row(const mask_conv_t *conv, uint32_t i, uint8_t *dst)
+{
+    if (conv->line) conv->column_fn(conv, i);
+    conv->row_fn(conv, i, conv->mask->width / 2, conv->width - conv->mask->width / 2, dst);
+}
+
+/*------------------------------------------------------------------------------*/
+/* Value of a mask whose values are all the same, 0 if they are not */
+static int16_t _mask_constant(const mask_t *mask)
+{
+    uint32_t i = 0;
+
+    for (i = 1; i < mask->width * mask->height; i++) {
+	if (mask->buf[i] != mask->buf[0]) return 0;
+    }
+    return mask->buf[0];
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Constant masks are box means, every output pixel is a rectangle sum of the
+ * integral image whatever the mask size. Rounding is the same as the
+ * convolution gives.
+ */
+static int _mask_apply_box(image_t image, mask_t mask)
+{
+    int ret = 0;
+    uint32_t i = 0, j = 0, mask_center_i = mask.height / 2, mask_center_j = mask.width / 2;
+    uint32_t area = mask.width * mask.height, sum = 0;
+    const uint32_t *top = NULL, *bottom = NULL;
+    uint8_t *dst = NULL;
+    integral_t *integral = NULL;
+
+    /* 2 * sum + area fits in 32 bits */
+    util_fite(((uint64_t)mask.width * mask.height >= (UINT64_C(1) << 23)),
+	    LOG_ERR("%ux%u mask is too big!\n", mask.width, mask.height));
+    util_fit(((integral = integral_build(image, 0)) == NULL));
+
+    /* Rows of the table above and below the window, see integral_sum */
+    for (i = mask_center_i; i < image.height - mask_center_i; i++) {
+	top = &integral->sum[(i - mask_center_i) * integral->stride];
+	bottom = &integral->sum[(i - mask_center_i + mask.height) * integral->stride];
+	dst = &image.buf[i * image.width];
+	for (j = 0; j + mask_center_j < image.width - mask_center_j; j++) {
+	    sum = bottom[j + mask.width] - top[j + mask.width] - bottom[j] + top[j];
+	    dst[j + mask_center_j] = (2 * sum + area) / (2 * area);
+	}
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    integral_free(&integral);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Picks the tile side with the least transform work over the image, bigger
+ * tiles waste less on the overlaps but cost more per value.
+ */
+static uint32_t _mask_fft_tile(image_t image, const mask_t *mask)
+{
+    uint32_t size = MASK_FFT_MIN_TILE, best = 0, log2 = 0;
+    uint32_t kernel = (mask->width > mask->height) ? mask->width : mask->height;
+    double cost = 0, best_cost = 0;
+
+    while (size <= kernel) size <<= 1;
+    for (; size <= MASK_FFT_MAX_TILE; size <<= 1) {
+	for (log2 = 0; (UINT32_C(1) << log2) < size; log2++);
+	cost = (double)((image.height + size - mask->height) / (size - mask->height + 1)) *
+	    ((image.width + size - mask->width) / (size - mask->width + 1)) *
+	    size * size * log2;
+	if (best == 0 || cost < best_cost) {
+	    best = size;
+	    best_cost = cost;
+	}
+	/* A single tile covers the image */
+	if (size - mask->height + 1 >= image.height && size - mask->width + 1 >= image.width) break;
+    }
+    return best;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Overlap-add convolution on FFT tiles. Blocks of the image are zero padded
+ * to square tiles big enough to hold their whole linear convolution with the
+ * flipped mask, so the tiles overlap by the mask size minus one. Tiles are
+ * added into a band of rows, rows no later band reaches are written out and
+ * the rest moves up. Sums are integers, rounding them gives the same outputs
+ * as the direct kernels.
+ */
+static int _mask_apply_fft(image_t image, const mask_conv_t *conv)
+{
+    int ret = 0;
+    const mask_t *mask = conv->mask;
+    uint32_t size = 0, bins = 0, block_height = 0, block_width = 0,
+	     band_width = image.width + mask->width - 1, r0 = 0, c0 = 0, i = 0, j = 0, k = 0,
+	     rows = 0, columns = 0;
+    int64_t row = 0;
+    double *tile = NULL, *band = NULL;
+    double complex *spectrum = NULL, *kernel = NULL;
+    fft2_t *fft2 = NULL;
+
+    size = _mask_fft_tile(image, mask);
+    bins = FFT_BINS(size);
+    block_height = size - mask->height + 1;
+    block_width = size - mask->width + 1;
+    LOG_DBG("%ux%u mask on %ux%u tiles\n", mask->width, mask->height, size, size);
+
+    util_fit(((fft2 = fft2_plan(size)) == NULL));
+    util_fite(((tile = (double *)malloc(size * size * sizeof(double))) == NULL),
+	    LOG_ERR("FFT tile allocation failed\n"));
+    util_fite(((spectrum = (double complex *)malloc(size * bins *
+			    sizeof(double complex))) == NULL),
+	    LOG_ERR("FFT spectrum allocation failed\n"));
+    util_fite(((kernel = (double complex *)malloc(size * bins *
+			    sizeof(double complex))) == NULL),
+	    LOG_ERR("FFT kernel allocation failed\n"));
+    /* A block and the rows its tile spills into */
+    util_fite(((band = (double *)calloc((size_t)size * band_width, sizeof(double))) == NULL),
+	    LOG_ERR("FFT band allocation failed\n"));
+
+    /* Flipped mask, the convolution is then the correlation mask_apply does */
+    memset(tile, 0, size * size * sizeof(double));
+    for (k = 0; k < mask->height; k++) {
+	for (j = 0; j < mask->width; j++) {
+	    tile[k * size + j] = mask->buf[(mask->height - 1 - k) * mask->width +
+		mask->width - 1 - j];
+	}
+    }
+    fft2_forward(fft2, tile, kernel);
+
+    for (r0 = 0; r0 < image.height; r0 += block_height) {
+	rows = (image.height - r0 < block_height) ? image.height - r0 : block_height;
+
+	for (c0 = 0; c0 < image.width; c0 += block_width) {
+	    columns = (image.width - c0 < block_width) ? image.width - c0 : block_width;
+	    memset(tile, 0, size * size * sizeof(double));
+	    for (i = 0; i < rows; i++) {
+		for (j = 0; j < columns; j++) {
+		    tile[i * size + j] = conv->rows[r0 + i][c0 + j];
+		}
+	    }
+	    fft2_forward(fft2, tile, spectrum);
+	    for (k = 0; k < size * bins; k++) {
+		spectrum[k] *= kernel[k];
+	    }
+	    fft2_inverse(fft2, spectrum, tile);
+
+	    for (i = 0; i < rows + mask->height - 1; i++) {
+		for (j = 0; j < columns + mask->width - 1; j++) {
+		    band[i * band_width + c0 + j] += tile[i * size + j];
+		}
+	    }
+	}
+
+	/* Band row i is row r0 + i of the whole convolution, output row
+	 * r0 + i - (mask->height - 1 - mask->height / 2) */
+	for (i = 0; i < rows; i++) {
+	    row = (int64_t)r0 + i - (mask->height - 1 - mask->height / 2);
+	    if (row < mask->height / 2 || row >= image.height - mask->height / 2) continue;
+	    for (j = mask->width / 2; j < image.width - mask->width / 2; j++) {
+		image.buf[row * image.width + j] = _mask_out(&conv->norm,
+			llround(band[i * band_width + j - mask->width / 2 + mask->width - 1]));
+	    }
+	}
+	memmove(band, &band[rows * band_width], (mask->height - 1) * band_width * sizeof(double));
+	memset(&band[(mask->height - 1) * band_width], 0,
+		(size - mask->height + 1) * band_width * sizeof(double));
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    fft2_free(&fft2);
+    sfree(tile);
+    sfree(band);
+    sfree(spectrum);
+    sfree(kernel);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Convolves the image with the mask, border pixels the mask does not fit
+ * keep their values. Sums are signed 32 bit, outputs are rounded and saturate
+ * to 0..255.
+ * Rank-1 masks run as a column and a row pass over a line buffer, big
+ * constant masks as box sums of the integral image and other big masks on
+ * FFT tiles. path forces the direct kernels or the FFT tiles.
+ */
+int mask_apply_path(image_t image, mask_t mask, mask_path_t path)
 {
     int ret = 0;
-    uint8_t *temp_buf = NULL;
-    uint32_t i = 0, j = 0, k = 0, l = 0, mask_center_i = 0, mask_center_j = 0;
-    uint16_t new_val = 0, mask_divide_by = 0;
+    uint8_t *temp_buf = NULL, separable = (mask.row && mask.column);
+    const uint8_t **rows = NULL;
+    uint32_t i = 0, mask_center_i = mask.height / 2;
+    mask_conv_t conv;
 
     LOG_DBG("image:%p, mask:%p\n", &image, &mask);
 
+    memset(&conv, 0, sizeof(mask_conv_t));
+    util_sit((image.height < mask.height || image.width < mask.width));
+    if (path == MASK_PATH_AUTO && mask.width * mask.height > MASK_BOX_MIN_AREA &&
+	    _mask_constant(&mask)) {
+	util_fit((_mask_apply_box(image, mask) != 0));
+	goto success;
+    }
+    if (path == MASK_PATH_AUTO) {
+	path = (!separable && mask.width * mask.height >= MASK_FFT_MIN_AREA) ?
+	    MASK_PATH_FFT : MASK_PATH_DIRECT;
+    }
+    util_fit((_mask_conv_init(&conv, &mask, image.width) != 0));
+
     util_fite(((temp_buf = (uint8_t *)malloc(image.size * sizeof(uint8_t))) == NULL),
 	    LOG_ERR("Mask temp buffer allocation failed\n"));
+    util_fite(((rows = (const uint8_t **)malloc(image.height * sizeof(uint8_t *))) == NULL),
+	    LOG_ERR("Mask rows allocation failed\n"));
     /* duplicate image buffer for holding original values */
     memcpy(temp_buf, image.buf, image.size);
+    for (i = 0; i < image.height; i++) {
+	rows[i] = &temp_buf[i * image.width];
+    }
+    conv.rows = rows;
+    if (path == MASK_PATH_FFT) {
+	util_fit((_mask_apply_fft(image, &conv) != 0));
+	goto success;
+    }
 
-    mask_center_i = mask.height / 2;
-    mask_center_j = mask.width / 2;
-    /* get and make sure it doesnt contain zero */
-    mask_divide_by = _get_sum(mask);
-    mask_divide_by = mask_divide_by ? mask_divide_by : 1;
-
-    /* i and j points to the mask center */
+    /* i points to the mask center */
     for (i = mask_center_i; i < image.height - mask_center_i; i++) {
-	for (j = mask_center_j; j < image.width - mask_center_j; j++) {
-	    new_val = 0;
-	    for (k = 0; k < mask.height; k++) {
-		for (l = 0; l < mask.width; l++) {
-		    new_val += (mask.buf[k * mask.width + l] *
-			temp_buf[(i + k - mask_center_i) * image.width + j + l - mask_center_j]);
-		}
-	    }
-	    image.buf[i * image.width + j] = new_val / mask_divide_by;
-	}
+	_mask_conv_row(&conv, i, &image.buf[i * image.width]);
     }
 
     goto success;
@@ -116,7 +807,215 @@ fail:
     ret = -1;
 
 success:
+    sfree(conv.line);
+    sfree(rows);
     sfree(temp_buf);
     return ret;
 }
 
+/*------------------------------------------------------------------------------*/
+int mask_apply(image_t image, mask_t mask)
+{
+    return mask_apply_path(image, mask, MASK_PATH_AUTO);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Prepares masking of width x height images a row at a time with the direct
+ * kernels, rows give the same pixels as mask_apply does.
+ */
+mask_stream_t* mask_stream_new(const mask_t *mask, uint32_t width, uint32_t height)
+{
+    mask_stream_t *stream = NULL;
+
+    LOG_DBG("mask:%ux%u image:%ux%u\n", mask->width, mask->height, width, height);
+
+    util_fite(((stream = (mask_stream_t *)calloc(1, sizeof(mask_stream_t))) == NULL),
+	    LOG_ERR("Mask stream allocation failed!\n"));
+    stream->height = height;
+    stream->conv.mask = mask;
+    stream->idle = (height < mask->height || width < mask->width);
+    stream->conv.width = width;
+    if (!stream->idle) {
+	util_fit((_mask_conv_init(&stream->conv, mask, width) != 0));
+    }
+
+    goto success;
+
+fail:
+    mask_stream_free(&stream);
+
+success:
+    return stream;
+}
+
+/*------------------------------------------------------------------------------*/
+void mask_stream_free(mask_stream_t **stream)
+{
+    if (*stream == NULL) return;
+
+    sfree((*stream)->conv.line);
+    sfree(*stream);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Writes row i of the masked image into dst. rows are the input image rows,
+ * only the ones the mask covers around row i are read.
+ */
+void mask_stream_row(mask_stream_t *stream, const uint8_t * const *rows, uint32_t i,
+	uint8_t *dst)
+{
+    const mask_t *mask = stream->conv.mask;
+
+    memcpy(dst, rows[i], stream->conv.width);
+    if (stream->idle || i < mask->height / 2 || i >= stream->height - mask->height / 2) return;
+
+    stream->conv.rows = rows;
+    _mask_conv_row(&stream->conv, i, dst);
+}
+
+/*------------------------------------------------------------------------------*/
+static void _mask_median_update(uint16_t *kernel, const uint16_t *add, const uint16_t *sub)
+{
+    uint32_t k = 0;
+
+    for (k = 0; k < MASK_MEDIAN_BINS; k++) {
+	kernel[k] += add[k] - sub[k];
+    }
+}
+
+#if MASK_HAVE_AVX2
+/*------------------------------------------------------------------------------*/
+/* 16 bins a step, counts never wrap since a bin holds at most the window area */
+__attribute__((target("avx2")))
+static void _mask_median_update_avx2(uint16_t *kernel, const uint16_t *add,
+	const uint16_t *sub)
+{
+    uint32_t k = 0;
+    __m256i sum;
+
+    for (k = 0; k < MASK_MEDIAN_BINS; k += 16) {
+	sum = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)&kernel[k]),
+		_mm256_loadu_si256((const __m256i *)&add[k]));
+	_mm256_storeu_si256((__m256i *)&kernel[k],
+		_mm256_sub_epi16(sum, _mm256_loadu_si256((const __m256i *)&sub[k])));
+    }
+}
+#endif /* MASK_HAVE_AVX2 */
+
+/*------------------------------------------------------------------------------*/
+static inline void _mask_median_count(uint16_t *histogram, uint8_t value, int16_t n)
+{
+    histogram[value >> 4] += n;
+    histogram[MASK_MEDIAN_COARSE + value] += n;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Value of the rank th smallest pixel, the coarse bins find its fine segment */
+static inline uint8_t _mask_median_rank(const uint16_t *kernel, uint32_t rank)
+{
+    uint32_t c = 0, v = 0;
+
+    while (rank > kernel[c]) {
+	rank -= kernel[c++];
+    }
+    for (v = c << 4; rank > kernel[MASK_MEDIAN_COARSE + v]; v++) {
+	rank -= kernel[MASK_MEDIAN_COARSE + v];
+    }
+    return v;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Index clamped into [0, n), the edge pixels repeat outside of the image */
+static inline uint32_t _mask_median_clamp(int32_t index, uint32_t n)
+{
+    return (index < 0) ? 0 : ((uint32_t)index >= n) ? n - 1 : (uint32_t)index;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Counts the pixels of src row n times into their column histograms */
+static void _mask_median_count_row(uint16_t *columns, const uint8_t *src, uint32_t width,
+	int16_t n)
+{
+    uint32_t j = 0;
+
+    for (j = 0; j < width; j++) {
+	_mask_median_count(&columns[j * MASK_MEDIAN_BINS], src[j], n);
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Replaces every pixel with the median of the (2 * radius + 1) square around
+ * it, the windows at the borders see the edge pixels repeated outwards.
+ * Every column keeps the histogram of its window rows, moving down a row is
+ * one count out and one in per column. The window histogram moves along a row
+ * by adding the entering column histogram and subtracting the leaving one, so
+ * the work per pixel does not depend on the radius (Perreault and Hebert).
+ */
+int mask_median(image_t image, uint32_t radius)
+{
+    int ret = 0;
+    uint32_t i = 0, j = 0, side = 2 * radius + 1, rank = side * side / 2 + 1;
+    int32_t k = 0, r = (int32_t)radius;
+    uint8_t *temp_buf = NULL, *dst = NULL;
+    uint16_t *columns = NULL, kernel[MASK_MEDIAN_BINS];
+    static const uint16_t zero[MASK_MEDIAN_BINS];
+    mask_median_fn_t update = _mask_median_update;
+
+    LOG_DBG("image:%ux%u radius:%u\n", image.width, image.height, radius);
+
+    util_fite((radius > MASK_MEDIAN_MAX_RADIUS),
+	    LOG_ERR("Median radius %u, at most %u supported!\n", radius, MASK_MEDIAN_MAX_RADIUS));
+    util_sit((radius == 0 || image.height == 0 || image.width == 0));
+#if MASK_HAVE_AVX2
+    if (_mask_avx2()) update = _mask_median_update_avx2;
+#endif /* MASK_HAVE_AVX2 */
+
+    util_fite(((temp_buf = (uint8_t *)malloc(image.size * sizeof(uint8_t))) == NULL),
+	    LOG_ERR("Median temp buffer allocation failed\n"));
+    util_fite(((columns = (uint16_t *)calloc((size_t)image.width * MASK_MEDIAN_BINS,
+			sizeof(uint16_t))) == NULL),
+	    LOG_ERR("Median column histograms allocation failed\n"));
+    /* duplicate image buffer for holding original values */
+    memcpy(temp_buf, image.buf, image.size);
+
+    /* Window rows above the first center, row 0 repeats upwards */
+    for (k = -r; k < r; k++) {
+	_mask_median_count_row(columns,
+		&temp_buf[_mask_median_clamp(k, image.height) * image.width], image.width, 1);
+    }
+    /* i points to the window center */
+    for (i = 0; i < image.height; i++) {
+	_mask_median_count_row(columns,
+		&temp_buf[_mask_median_clamp(i + r, image.height) * image.width], image.width, 1);
+	if (i > 0) {
+	    _mask_median_count_row(columns,
+		    &temp_buf[_mask_median_clamp(i - r - 1, image.height) * image.width],
+		    image.width, -1);
+	}
+
+	memset(kernel, 0, sizeof(kernel));
+	for (k = -r; k <= r; k++) {
+	    update(kernel, &columns[_mask_median_clamp(k, image.width) * MASK_MEDIAN_BINS], zero);
+	}
+	dst = &image.buf[i * image.width];
+	dst[0] = _mask_median_rank(kernel, rank);
+	for (j = 1; j < image.width; j++) {
+	    update(kernel, &columns[_mask_median_clamp(j + r, image.width) * MASK_MEDIAN_BINS],
+		    &columns[_mask_median_clamp(j - r - 1, image.width) * MASK_MEDIAN_BINS]);
+	    dst[j] = _mask_median_rank(kernel, rank);
+	}
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    sfree(columns);
+    sfree(temp_buf);
+    return ret;
+}
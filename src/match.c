@@ -0,0 +1,725 @@
+/**
+ * \file
+ *	Region to class matching functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "util.h"
+#include "match.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATCH_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define MATCH_HAVE_AVX2 0
+#endif
+
+#ifndef LOG_LEVEL_CONF_MATCH
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_MATCH */
+#define LOG_LEVEL LOG_LEVEL_CONF_MATCH
+#endif /* LOG_LEVEL_CONF_MATCH */
+
+/*------------------------------------------------------------------------------*/
+/* Values in a 256 bit register */
+#define MATCH_LANES FMAT_LANES
+
+/*------------------------------------------------------------------------------*/
+typedef struct {
+    uint32_t index;	    /* nearest class */
+    fmat_val_t distance;    /* distance to nearest class */
+} match_nearest_t;
+
+typedef void (*match_nearest_fn_t)(const fmat_val_t *, uint32_t, fmat_val_t, match_nearest_t *);
+
+/*------------------------------------------------------------------------------*/
+static void _match_nearest_scalar(const fmat_val_t *, uint32_t, fmat_val_t, match_nearest_t *);
+
+static match_nearest_fn_t match_nearest = _match_nearest_scalar;
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Merges the per lane minimums (ties go to the smaller index) and continues
+ * with the values from c to noe that did not fill a whole register.
+ */
+static void _match_nearest_tail(const fmat_val_t *row, uint32_t c, uint32_t noe, fmat_val_t x,
+	const fmat_val_t *lane_min, const fmat_val_t *lane_index, match_nearest_t *nearest)
+{
+    uint32_t l = 0;
+    fmat_val_t val = 0;
+
+    nearest->index = 0;
+    nearest->distance = (c > 0) ? lane_min[0] : fabs(row[0] - x);
+    if (c > 0) nearest->index = lane_index[0];
+    for (l = 1; l < MATCH_LANES && c > 0; l++) {
+	if (lane_min[l] < nearest->distance ||
+		(lane_min[l] == nearest->distance && lane_index[l] < nearest->index)) {
+	    nearest->distance = lane_min[l];
+	    nearest->index = lane_index[l];
+	}
+    }
+    for (c = (c > 0) ? c : 1; c < noe; c++) {
+	val = fabs(row[c] - x);
+	if (val < nearest->distance) {
+	    nearest->distance = val;
+	    nearest->index = c;
+	}
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+static void _match_nearest_scalar(const fmat_val_t *row, uint32_t noe, fmat_val_t x,
+	match_nearest_t *nearest)
+{
+    _match_nearest_tail(row, 0, noe, x, NULL, NULL, nearest);
+}
+
+#if MATCH_HAVE_AVX2
+/*------------------------------------------------------------------------------*/
+/* row must be 32 byte aligned */
+__attribute__((target("avx2")))
+static void _match_nearest_avx2(const fmat_val_t *row, uint32_t noe, fmat_val_t x,
+	match_nearest_t *nearest)
+{
+    uint32_t c = 0;
+    fmat_val_t lane_min[MATCH_LANES] __attribute__((aligned(32)));
+    fmat_val_t lane_index[MATCH_LANES] __attribute__((aligned(32)));
+#if FE_CONF_FLOAT32
+    const __m256 sign = _mm256_set1_ps(-0.0f), step = _mm256_set1_ps(MATCH_LANES);
+    __m256 vx = _mm256_set1_ps(x), vmin = _mm256_set1_ps(INFINITY),
+	   vindex = _mm256_setzero_ps(), cur = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7),
+	   d, lt;
+
+    for (c = 0; c + MATCH_LANES <= noe; c += MATCH_LANES) {
+	d = _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_load_ps(row + c), vx));
+	lt = _mm256_cmp_ps(d, vmin, _CMP_LT_OQ);
+	vmin = _mm256_blendv_ps(vmin, d, lt);
+	vindex = _mm256_blendv_ps(vindex, cur, lt);
+	cur = _mm256_add_ps(cur, step);
+    }
+    _mm256_store_ps(lane_min, vmin);
+    _mm256_store_ps(lane_index, vindex);
+#else /* FE_CONF_FLOAT32 */
+    const __m256d sign = _mm256_set1_pd(-0.0), step = _mm256_set1_pd(MATCH_LANES);
+    __m256d vx = _mm256_set1_pd(x), vmin = _mm256_set1_pd(INFINITY),
+	    vindex = _mm256_setzero_pd(), cur = _mm256_setr_pd(0, 1, 2, 3), d, lt;
+
+    for (c = 0; c + MATCH_LANES <= noe; c += MATCH_LANES) {
+	d = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_load_pd(row + c), vx));
+	lt = _mm256_cmp_pd(d, vmin, _CMP_LT_OQ);
+	vmin = _mm256_blendv_pd(vmin, d, lt);
+	vindex = _mm256_blendv_pd(vindex, cur, lt);
+	cur = _mm256_add_pd(cur, step);
+    }
+    _mm256_store_pd(lane_min, vmin);
+    _mm256_store_pd(lane_index, vindex);
+#endif /* FE_CONF_FLOAT32 */
+
+    _match_nearest_tail(row, c, noe, x, lane_min, lane_index, nearest);
+}
+
+#endif /* MATCH_HAVE_AVX2 */
+
+/*------------------------------------------------------------------------------*/
+static void _match_init(void)
+{
+    static uint8_t initialized = 0;
+
+    if (initialized) return;
+    initialized = 1;
+
+#if MATCH_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	LOG_DBG("Using avx2 kernels\n");
+	match_nearest = _match_nearest_avx2;
+    }
+#endif /* MATCH_HAVE_AVX2 */
+}
+
+/*------------------------------------------------------------------------------*/
+static int _match_index_cmp(const void *a, const void *b)
+{
+    const match_nearest_t *x = (const match_nearest_t *)a, *y = (const match_nearest_t *)b;
+
+    /* distance holds the value while sorting */
+    if (x->distance != y->distance) return (x->distance < y->distance) ? -1 : 1;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Binary searches the sorted feature for x. Values at the same distance are next
+ * to each other on both sides of x, they are scanned for the smallest class to
+ * match the exhaustive search exactly.
+ */
+static void _match_index_nearest(const match_index_t *index, uint32_t j, fmat_val_t x,
+	match_nearest_t *nearest)
+{
+    uint32_t lo = 0, hi = index->noe, mid = 0, p = 0;
+    const fmat_val_t *sorted = &index->sorted[j * index->noe];
+    const uint32_t *order = &index->order[j * index->noe];
+    fmat_val_t val = 0;
+
+    /* first value not less than x */
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (sorted[mid] < x) lo = mid + 1;
+	else hi = mid;
+    }
+
+    nearest->distance = INFINITY;
+    if (lo < index->noe) nearest->distance = fabs(sorted[lo] - x);
+    if (lo > 0 && (val = fabs(sorted[lo - 1] - x)) < nearest->distance) {
+	nearest->distance = val;
+    }
+
+    nearest->index = UINT32_MAX;
+    for (p = lo; p < index->noe && fabs(sorted[p] - x) == nearest->distance; p++) {
+	if (order[p] < nearest->index) nearest->index = order[p];
+    }
+    for (p = lo; p > 0 && fabs(sorted[p - 1] - x) == nearest->distance; p--) {
+	if (order[p - 1] < nearest->index) nearest->index = order[p - 1];
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * For every feature of every region finds the nearest class by that feature only,
+ * the nearest class gets a vote if it is closer than epsilon. The class with the
+ * most votes wins, ties go to the smaller class index.
+ */
+static int _match_vote(const fmat_t *regions, const fmat_t *classes,
+	const match_index_t *index, double epsilon, match_t *matches)
+{
+    int ret = 0;
+    uint32_t r = 0, j = 0, c = 0, n = 0, best = 0;
+    uint32_t *voted = NULL, *votes = NULL;
+    fmat_t *transposed = NULL;
+    match_nearest_t *nearest = NULL, *current = NULL;
+
+    util_fite(((nearest = (match_nearest_t *)malloc(regions->rows * regions->cols *
+			sizeof(match_nearest_t))) == NULL),
+	    LOG_ERR("Nearest allocation failed!\n"));
+    util_fite(((voted = (uint32_t *)malloc(regions->cols * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Voted allocation failed!\n"));
+    util_fite(((votes = (uint32_t *)malloc(regions->cols * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Votes allocation failed!\n"));
+
+    if (index) {
+	for (j = 0; j < regions->cols; j++) {
+	    for (r = 0; r < regions->rows; r++) {
+		_match_index_nearest(index, j, fmat_row(regions, r)[j],
+			&nearest[r * regions->cols + j]);
+	    }
+	}
+    } else {
+	/* features x classes, so one feature of all classes is contiguous */
+	util_fit(((transposed = fmat_alloc(classes->cols, classes->rows)) == NULL));
+	for (c = 0; c < classes->rows; c++) {
+	    for (j = 0; j < classes->cols; j++) {
+		fmat_row(transposed, j)[c] = fmat_row(classes, c)[j];
+	    }
+	}
+
+	/* Feature outer loop keeps one transposed row in cache for all regions */
+	for (j = 0; j < regions->cols; j++) {
+	    for (r = 0; r < regions->rows; r++) {
+		match_nearest(fmat_row(transposed, j), classes->rows, fmat_row(regions, r)[j],
+			&nearest[r * regions->cols + j]);
+	    }
+	}
+    }
+
+    /* At most cols classes get a vote, tally them in a small array */
+    for (r = 0; r < regions->rows; r++) {
+	n = 0;
+	for (j = 0; j < regions->cols; j++) {
+	    current = &nearest[r * regions->cols + j];
+	    if (!(current->distance < epsilon)) continue;
+
+	    for (c = 0; c < n && voted[c] != current->index; c++);
+	    if (c == n) {
+		voted[n] = current->index;
+		votes[n++] = 0;
+	    }
+	    votes[c]++;
+	}
+
+	matches[r].index = -1;
+	matches[r].score = 0;
+	if (n == 0) continue;
+
+	best = 0;
+	for (c = 1; c < n; c++) {
+	    if (votes[c] > votes[best] ||
+		    (votes[c] == votes[best] && voted[c] < voted[best])) {
+		best = c;
+	    }
+	}
+	matches[r].index = voted[best];
+	matches[r].score = votes[best];
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree_fmat(transposed);
+    sfree(nearest);
+    sfree(voted);
+    sfree(votes);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Finds the nearest class by euclidean distance, the region is identified if
+ * the rms of the per feature differences is smaller than epsilon. With the index
+ * the approximate search may return a class at most one acceptance radius
+ * (epsilon * sqrt(cols)) farther than the nearest one.
+ */
+static int _match_distance(const fmat_t *regions, const fmat_t *classes,
+	const match_index_t *index, uint8_t approx, double epsilon, match_t *matches)
+{
+    uint32_t r = 0, c = 0, best = 0;
+    fmat_val_t min = 0, val = 0;
+    double slack = approx ? epsilon * sqrt(regions->cols) : 0;
+
+    for (r = 0; r < regions->rows; r++) {
+	if (index) {
+	    best = kdtree_nearest(index->tree, fmat_row(regions, r), slack, &min);
+	} else {
+	    best = 0;
+	    min = fmat_distance(fmat_row(regions, r), fmat_row(classes, 0), classes->stride);
+	    for (c = 1; c < classes->rows; c++) {
+		val = fmat_distance(fmat_row(regions, r), fmat_row(classes, c), classes->stride);
+		if (val < min) {
+		    min = val;
+		    best = c;
+		}
+	    }
+	}
+
+	matches[r].score = sqrt(min);
+	matches[r].index = (sqrt(min / regions->cols) < epsilon) ? (int32_t)best : -1;
+    }
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Builds the per feature sorted arrays for the vote mode and a k-d tree for the
+ * distance modes over the rows of classes.
+ */
+match_index_t* match_index_build(const fmat_t *classes)
+{
+    uint32_t c = 0, j = 0;
+    match_index_t *index = NULL;
+    match_nearest_t *column = NULL;
+
+    LOG_DBG("classes:%u\n", classes->rows);
+
+    util_fite(((index = (match_index_t *)calloc(1, sizeof(match_index_t))) == NULL),
+	    LOG_ERR("Index allocation failed!\n"));
+    index->noe = classes->rows;
+    index->cols = classes->cols;
+
+    util_fite(((index->sorted = (fmat_val_t *)malloc(index->noe * index->cols *
+			sizeof(fmat_val_t))) == NULL), LOG_ERR("Sorted allocation failed!\n"));
+    util_fite(((index->order = (uint32_t *)malloc(index->noe * index->cols *
+			sizeof(uint32_t))) == NULL), LOG_ERR("Order allocation failed!\n"));
+    util_fite(((column = (match_nearest_t *)malloc(index->noe * sizeof(match_nearest_t))) == NULL),
+	    LOG_ERR("Column allocation failed!\n"));
+
+    for (j = 0; j < index->cols; j++) {
+	for (c = 0; c < index->noe; c++) {
+	    column[c].distance = fmat_row(classes, c)[j];
+	    column[c].index = c;
+	}
+	qsort(column, index->noe, sizeof(match_nearest_t), _match_index_cmp);
+	for (c = 0; c < index->noe; c++) {
+	    index->sorted[j * index->noe + c] = column[c].distance;
+	    index->order[j * index->noe + c] = column[c].index;
+	}
+    }
+
+    util_fit(((index->tree = kdtree_build(classes)) == NULL));
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    match_index_free(&index);
+
+success:
+    sfree(column);
+    return index;
+}
+
+/*------------------------------------------------------------------------------*/
+void match_index_free(match_index_t **index)
+{
+    if (*index == NULL) return;
+
+    sfree((*index)->sorted);
+    sfree((*index)->order);
+    kdtree_free(&(*index)->tree);
+    sfree(*index);
+}
+
+/*------------------------------------------------------------------------------*/
+int match_mode_from_str(const char *str, match_mode_t *mode)
+{
+    int ret = 0;
+
+    if (!strcmp("vote", str)) {
+	*mode = MATCH_MODE_VOTE;
+    } else if (!strcmp("distance", str)) {
+	*mode = MATCH_MODE_DISTANCE;
+    } else if (!strcmp("approx", str)) {
+	*mode = MATCH_MODE_APPROX;
+    } else if (!strcmp("knn", str)) {
+	*mode = MATCH_MODE_KNN;
+    } else if (!strcmp("cascade", str)) {
+	*mode = MATCH_MODE_CASCADE;
+    } else {
+	LOG_ERR("Match mode '%s' is not supported!\n", str);
+	goto fail;
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Matches every row of regions against the rows of classes, matches must have
+ * room for regions->rows entries. The index of classes is optional, without it
+ * the classes are scanned exhaustively and the approximate mode is exact.
+ */
+int match_regions(const fmat_t *regions, const fmat_t *classes, const match_index_t *index,
+	match_mode_t mode, double epsilon, match_t *matches)
+{
+    int ret = 0;
+
+    LOG_DBG("regions:%u classes:%u mode:%d\n", regions->rows, classes->rows, mode);
+
+    util_fite((classes->rows == 0), LOG_ERR("There is no class!\n"));
+    util_fite((regions->cols != classes->cols || regions->stride != classes->stride),
+	    LOG_ERR("Region and class features mismatch! (%u != %u)\n",
+		regions->cols, classes->cols));
+    util_fite((index && index->noe != classes->rows),
+	    LOG_ERR("Index is not built for these classes!\n"));
+    util_fite((mode == MATCH_MODE_KNN), LOG_ERR("knn mode matches samples, not classes!\n"));
+    util_fite((mode == MATCH_MODE_CASCADE),
+	    LOG_ERR("cascade mode matches a region at a time, see match_cascade!\n"));
+
+    _match_init();
+
+    if (mode == MATCH_MODE_VOTE) {
+	util_fit((_match_vote(regions, classes, index, epsilon, matches) != 0));
+    } else {
+	util_fit((_match_distance(regions, classes, index, (mode == MATCH_MODE_APPROX),
+			epsilon, matches) != 0));
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns non zero if no class can reach the leader with remaining votes. Classes
+ * without a vote are represented by the smallest of them, it wins a tie against
+ * every other one.
+ */
+static uint8_t _match_cascade_decided(const uint32_t *voted, const uint32_t *votes, uint32_t n,
+	uint32_t leader, uint32_t remaining)
+{
+    uint32_t c = 0, unvoted = 0;
+
+    for (c = 0; c < n; c++) {
+	if (c == leader) continue;
+	if (votes[c] + remaining > votes[leader] ||
+		(votes[c] + remaining == votes[leader] && voted[c] < voted[leader])) {
+	    return 0;
+	}
+    }
+
+    if (remaining < votes[leader]) return 1;
+    if (remaining > votes[leader]) return 0;
+
+    /* smallest class index without a vote, voted holds at most n of them */
+    for (unvoted = 0; unvoted < voted[leader]; unvoted++) {
+	for (c = 0; c < n && voted[c] != unvoted; c++);
+	if (c == n) return 0;
+    }
+    return 1;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Vote mode for a single region whose features are calculated on demand. The
+ * features are asked in the given order (cheapest first) and the vote stops once
+ * the classes that could still win are down to the leading one. The class is
+ * the same as in the vote mode, the score counts the votes cast until the stop.
+ * evaluated is set to the number of features asked.
+ */
+int match_cascade(const match_index_t *index, const uint32_t *order, match_feature_fn_t feature,
+	void *arg, double epsilon, match_t *match, uint32_t *evaluated)
+{
+    int ret = 0;
+    uint32_t e = 0, c = 0, n = 0, leader = 0;
+    uint32_t *voted = NULL, *votes = NULL;
+    match_nearest_t nearest;
+
+    util_fite((index == NULL || index->noe == 0), LOG_ERR("There is no class index!\n"));
+    util_fite(((voted = (uint32_t *)malloc(index->cols * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Voted allocation failed!\n"));
+    util_fite(((votes = (uint32_t *)malloc(index->cols * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Votes allocation failed!\n"));
+
+    match->index = -1;
+    match->score = 0;
+
+    for (e = 0; e < index->cols; e++) {
+	/* A vote can only be decided by a leader, without one keep going */
+	if (n > 0 && _match_cascade_decided(voted, votes, n, leader, index->cols - e)) break;
+
+	_match_index_nearest(index, order[e], feature(arg, order[e]), &nearest);
+	if (!(nearest.distance < epsilon)) continue;
+
+	for (c = 0; c < n && voted[c] != nearest.index; c++);
+	if (c == n) {
+	    voted[n] = nearest.index;
+	    votes[n++] = 0;
+	}
+	votes[c]++;
+
+	if (votes[c] > votes[leader] || (votes[c] == votes[leader] && voted[c] < voted[leader])) {
+	    leader = c;
+	}
+    }
+    *evaluated = e;
+
+    if (n > 0) {
+	match->index = voted[leader];
+	match->score = votes[leader];
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree(voted);
+    sfree(votes);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Votes the found neighbors (nearest first) of a region. Only the samples that
+ * would be accepted by the distance mode vote, the class with the most votes
+ * wins and ties go to the class with the nearer sample. voted and votes must
+ * have room for found entries.
+ */
+static void _match_knn_vote(uint32_t cols, uint32_t found, const int32_t *indexes,
+	const fmat_val_t *distances, const uint32_t *labels, double epsilon,
+	uint32_t *voted, uint32_t *votes, match_t *match)
+{
+    uint32_t i = 0, c = 0, n = 0, best = 0;
+
+    /* Neighbors come nearest first, so classes are voted in that order */
+    for (i = 0; i < found; i++) {
+	if (!(sqrt(distances[i] / cols) < epsilon)) break;
+
+	for (c = 0; c < n && voted[c] != labels[indexes[i]]; c++);
+	if (c == n) {
+	    voted[n] = labels[indexes[i]];
+	    votes[n++] = 0;
+	}
+	votes[c]++;
+    }
+
+    match->index = -1;
+    match->score = 0;
+    if (n == 0) return;
+
+    for (c = 1; c < n; c++) {
+	if (votes[c] > votes[best]) best = c;
+    }
+    match->index = voted[best];
+    match->score = votes[best];
+}
+
+/*------------------------------------------------------------------------------*/
+/* Inserts into the ascending (distance, row) list of at most k entries */
+static void _match_knn_insert(uint32_t k, uint32_t *noe, int32_t *indexes,
+	fmat_val_t *distances, int32_t index, fmat_val_t distance)
+{
+    uint32_t i = *noe;
+
+    if (*noe == k) {
+	if (distance > distances[k - 1] ||
+		(distance == distances[k - 1] && index > indexes[k - 1])) {
+	    return;
+	}
+	i--;
+    } else {
+	(*noe)++;
+    }
+
+    while (i > 0 && (distances[i - 1] > distance ||
+		(distances[i - 1] == distance && indexes[i - 1] > index))) {
+	distances[i] = distances[i - 1];
+	indexes[i] = indexes[i - 1];
+	i--;
+    }
+    distances[i] = distance;
+    indexes[i] = index;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Matches every row of regions by a vote of its k nearest training samples,
+ * labels holds the class of every sample row. See _match_knn_vote.
+ */
+int match_knn(const fmat_t *regions, const kdtree_t *samples, const uint32_t *labels,
+	uint32_t k, double epsilon, match_t *matches)
+{
+    int ret = 0;
+    uint32_t r = 0, found = 0;
+    int32_t *indexes = NULL;
+    fmat_val_t *distances = NULL;
+    uint32_t *voted = NULL, *votes = NULL;
+
+    LOG_DBG("regions:%u k:%u\n", regions->rows, k);
+
+    util_fite((k == 0), LOG_ERR("k can not be zero!\n"));
+    util_fite((regions->cols != samples->points->cols),
+	    LOG_ERR("Region and sample features mismatch! (%u != %u)\n",
+		regions->cols, samples->points->cols));
+
+    util_fite(((indexes = (int32_t *)malloc(k * sizeof(int32_t))) == NULL),
+	    LOG_ERR("Indexes allocation failed!\n"));
+    util_fite(((distances = (fmat_val_t *)malloc(k * sizeof(fmat_val_t))) == NULL),
+	    LOG_ERR("Distances allocation failed!\n"));
+    util_fite(((voted = (uint32_t *)malloc(k * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Voted allocation failed!\n"));
+    util_fite(((votes = (uint32_t *)malloc(k * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Votes allocation failed!\n"));
+
+    _match_init();
+
+    for (r = 0; r < regions->rows; r++) {
+	found = kdtree_knn(samples, fmat_row(regions, r), k, indexes, distances);
+	_match_knn_vote(regions->cols, found, indexes, distances, labels, epsilon,
+		voted, votes, &matches[r]);
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree(indexes);
+    sfree(distances);
+    sfree(voted);
+    sfree(votes);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Same as match_knn, but the neighbors are searched over the quantized codes
+ * of the samples. k * MATCH_CONF_RERANK candidates are taken from the codes
+ * and re-ranked by their exact distances, only those rows of samples are read.
+ */
+int match_knn_quant(const fmat_t *regions, const qmat_t *codes, const fmat_t *samples,
+	const uint32_t *labels, uint32_t k, double epsilon, match_t *matches)
+{
+    int ret = 0;
+    uint32_t r = 0, i = 0, n = 0, found = 0, noe = 0;
+    int32_t *candidates = NULL, *indexes = NULL;
+    float *approx = NULL;
+    fmat_val_t *distances = NULL, *point = NULL;
+    uint32_t *voted = NULL, *votes = NULL;
+
+    LOG_DBG("regions:%u k:%u bits:%u\n", regions->rows, k, codes->bits);
+
+    util_fite((k == 0), LOG_ERR("k can not be zero!\n"));
+    util_fite((regions->cols != codes->cols || codes->rows != samples->rows),
+	    LOG_ERR("Quantized samples do not match the regions or the samples!\n"));
+
+    n = k * MATCH_CONF_RERANK;
+    util_fite(((candidates = (int32_t *)malloc(n * sizeof(int32_t))) == NULL),
+	    LOG_ERR("Candidates allocation failed!\n"));
+    util_fite(((approx = (float *)malloc(n * sizeof(float))) == NULL),
+	    LOG_ERR("Approximate distances allocation failed!\n"));
+    util_fite(((indexes = (int32_t *)malloc(k * sizeof(int32_t))) == NULL),
+	    LOG_ERR("Indexes allocation failed!\n"));
+    util_fite(((distances = (fmat_val_t *)malloc(k * sizeof(fmat_val_t))) == NULL),
+	    LOG_ERR("Distances allocation failed!\n"));
+    util_fite(((voted = (uint32_t *)malloc(k * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Voted allocation failed!\n"));
+    util_fite(((votes = (uint32_t *)malloc(k * sizeof(uint32_t))) == NULL),
+	    LOG_ERR("Votes allocation failed!\n"));
+
+    _match_init();
+
+    for (r = 0; r < regions->rows; r++) {
+	point = fmat_row(regions, r);
+	found = qmat_knn(codes, point, n, candidates, approx);
+
+	noe = 0;
+	for (i = 0; i < found; i++) {
+	    _match_knn_insert(k, &noe, indexes, distances, candidates[i],
+		    fmat_distance(point, fmat_row(samples, candidates[i]), samples->stride));
+	}
+	_match_knn_vote(regions->cols, noe, indexes, distances, labels, epsilon,
+		voted, votes, &matches[r]);
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    sfree(candidates);
+    sfree(approx);
+    sfree(indexes);
+    sfree(distances);
+    sfree(voted);
+    sfree(votes);
+    return ret;
+}
@@ -104,3 +104,69 @@ double moment_normalized_central(image_t image, region_t region, uint8_t p, uint
     return c_moment / pow(c_moment_zero, y);
 }
 
+/*------------------------------------------------------------------------------*/
+/*
+ * Calculates the area and the centroid sums of the region in one pass, the
+ * central moments are calculated around them.
+ */
+void moment_raw(image_t image, region_t region, moment_t *moment)
+{
+    uint32_t i = 0, j = 0;
+    rectangle_t *rect = &(region.rect);
+
+    moment->m00 = moment->m10 = moment->m01 = 0;
+    for (i = rect->x; i < rect->x + rect->height; i++) {
+	for (j = rect->y; j < rect->y + rect->width; j++) {
+	    if (image.buf[i * image.width + j] == region.label) {
+		moment->m00 += 1;
+		moment->m10 += i;
+		moment->m01 += j;
+	    }
+	}
+    }
+    moment->mu[0][0] = moment->m00;
+    moment->order = 0;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Calculates the central moments above the calculated order up to order in one
+ * pass, moment_raw must be called first. Every moment is summed in the same
+ * order as moment_normalized_central does, the results are the same bits.
+ */
+void moment_central(image_t image, region_t region, uint8_t order, moment_t *moment)
+{
+    uint32_t i = 0, j = 0;
+    uint8_t p = 0, q = 0;
+    double i_mean = moment->m10 / moment->m00, j_mean = moment->m01 / moment->m00;
+    rectangle_t *rect = &(region.rect);
+
+    if (order > MOMENT_MAX_ORDER) order = MOMENT_MAX_ORDER;
+    if (order <= moment->order) return;
+
+    for (p = 0; p <= order; p++) {
+	for (q = 0; p + q <= order; q++) {
+	    if (p + q > moment->order && p + q >= 2) moment->mu[p][q] = 0;
+	}
+    }
+
+    for (i = rect->x; i < rect->x + rect->height; i++) {
+	for (j = rect->y; j < rect->y + rect->width; j++) {
+	    if (image.buf[i * image.width + j] != region.label) continue;
+	    for (p = 0; p <= order; p++) {
+		for (q = 0; p + q <= order; q++) {
+		    if (p + q <= moment->order || p + q < 2) continue;
+		    moment->mu[p][q] += pow(i - i_mean, p) * pow(j - j_mean, q);
+		}
+	    }
+	}
+    }
+    moment->order = order;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Normalized central moment from the calculated ones, p + q must be calculated */
+double moment_normalized(const moment_t *moment, uint8_t p, uint8_t q)
+{
+    return moment->mu[p][q] / pow(moment->mu[0][0], ((p + q) / 2) + 1);
+}
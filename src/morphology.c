@@ -12,8 +12,8 @@
 
 #include "log.h"
 #include "util.h"
-#include "mask.h"
 #include "bmp.h"
+#include "lut.h"
 #include "morphology.h"
 
 #ifndef LOG_LEVEL_CONF_MORPHOLOGY
@@ -34,35 +34,58 @@ enum region_states {
 };
 
 /*------------------------------------------------------------------------------*/
-static int _morp_apply(image_t image, mask_t mask, uint8_t check_value)
+/*
+ * Writes row y of the dilated or eroded image into dst. A pixel whose lower
+ * right neighbor is not the background (the foreground for erosion) paints
+ * its 3x3 frame, so a pixel changes if one of rows y..y+2 has such a pixel
+ * near it. Border pixels do not paint.
+ */
+void morp_row(morp_op_t op, const uint8_t * const *rows, uint32_t width, uint32_t height,
+	uint32_t y, uint8_t *dst)
+{
+    uint32_t x = 0, r = 0, c = 2, r0 = 0, r1 = 0, painter = 0;
+    uint8_t check_value = (op == MORP_DILATION) ? COLOR_BG : COLOR_FG;
+    uint8_t value = (op == MORP_DILATION) ? COLOR_FG : COLOR_BG;
+
+    memcpy(dst, rows[y], width);
+    if (height < 3 || width < 3) return;
+
+    /* Painting pixels are the lower right neighbors of the non border ones */
+    r0 = (y > 2) ? y : 2;
+    r1 = (y + 2 < height - 1) ? y + 2 : height - 1;
+    if (r0 > r1) return;
+    /* Columns x..x+2 reach pixel x, painter is the last column seen painting */
+    for (x = 0; x < width; x++) {
+	for (; c <= x + 2 && c < width; c++) {
+	    for (r = r0; r <= r1 && rows[r][c] == check_value; r++);
+	    if (r <= r1) painter = c;
+	}
+	if (painter >= x && painter) dst[x] = value;
+    }
+}
+
+/*------------------------------------------------------------------------------*/
+static int _morp_apply(image_t image, morp_op_t op)
 {
     int ret = 0;
     uint8_t *temp_buf = NULL;
-    uint32_t i = 0, j = 0, k = 0, l = 0, mask_center_i = 0, mask_center_j = 0;
+    const uint8_t **rows = NULL;
+    uint32_t i = 0;
 
-    LOG_DBG("image:%p mask:%p, check_val:%u\n", &image, &mask, check_value);
+    LOG_DBG("image:%p op:%u\n", &image, op);
 
     util_fite(((temp_buf = (uint8_t *)malloc(image.size * sizeof(uint8_t))) == NULL),
 	    LOG_ERR("Temp buffer allocation failed\n"));
+    util_fite(((rows = (const uint8_t **)malloc(image.height * sizeof(uint8_t *))) == NULL),
+	    LOG_ERR("Rows allocation failed\n"));
     /* duplicate image buffer for holding original values */
     memcpy(temp_buf, image.buf, image.size);
+    for (i = 0; i < image.height; i++) {
+	rows[i] = &temp_buf[i * image.width];
+    }
 
-    mask_center_i = mask.height / 2;
-    mask_center_j = mask.width / 2;
-    /* Do not proceed the border pixels */
-    for (i = mask_center_i; i < image.height - mask_center_i; i++) {
-	for (j = mask_center_j; j < image.width - mask_center_j; j++) {
-	    /* If pixel in center of mask is equal to check_value then skip */
-	    if (temp_buf[(i + mask_center_i) * image.width +
-		    (j + mask_center_j)] == check_value) continue;
-
-	    for (k = 0; k < mask.height; k++) {
-		for (l = 0; l < mask.width; l++) {
-		    image.buf[(i + k - mask_center_i) * image.width +
-			(j + l - mask_center_j)] = mask.buf[k * mask.width + l];
-		}
-	    }
-	}
+    for (i = 0; i < image.height; i++) {
+	morp_row(op, rows, image.width, image.height, i, &image.buf[i * image.width]);
     }
 
     goto success;
@@ -71,6 +94,7 @@ fail:
     ret = -1;
 
 success:
+    sfree(rows);
     sfree(temp_buf);
     return ret;
 }
@@ -79,40 +103,14 @@ success:
 /* A + B */
 int morp_apply_dilation(image_t image)
 {
-    int ret = 0;
-    mask_t mask = { .buf = (int16_t []){ COLOR_FG, COLOR_FG, COLOR_FG,
-	COLOR_FG, COLOR_FG, COLOR_FG, COLOR_FG, COLOR_FG,
-	COLOR_FG }, .width = 3, .height = 3 };
-
-    util_fit((_morp_apply(image, mask, COLOR_BG) != 0));
-
-    goto success;
-
-fail:
-    ret = -1;
-
-success:
-    return ret;
+    return _morp_apply(image, MORP_DILATION);
 }
 
 /*------------------------------------------------------------------------------*/
 /* A - B */
 int morp_apply_erosion(image_t image)
 {
-    int ret = 0;
-    mask_t mask = { .buf = (int16_t []){ COLOR_BG, COLOR_BG, COLOR_BG,
-	COLOR_BG, COLOR_BG, COLOR_BG, COLOR_BG, COLOR_BG,
-	COLOR_BG }, .width = 3, .height = 3 };
-
-    util_fit((_morp_apply(image, mask, COLOR_FG) != 0));
-
-    goto success;
-
-fail:
-    ret = -1;
-
-success:
-    return ret;
+    return _morp_apply(image, MORP_EROSION);
 }
 
 /*------------------------------------------------------------------------------*/
@@ -185,11 +183,12 @@ success:
 /*------------------------------------------------------------------------------*/
 void morp_colorize_regions(image_t image, uint8_t region_noe)
 {
-    uint32_t i = 0;
-    for (i = 0; i < image.width * image.height; i++) {
-	/* image buf contain labels which starts 0 to n, scale with multiplying */
-	image.buf[i] *= (240 / region_noe);
-    }
+    lut_t lut;
+
+    if (region_noe == 0) return;
+    /* image buf contain labels which starts 0 to n, scale with multiplying */
+    lut_multiply(&lut, 240 / region_noe);
+    lut_apply_image(&lut, image);
 }
 
 /*------------------------------------------------------------------------------*/
@@ -0,0 +1,547 @@
+/**
+ * \file
+ *	In memory image pipelines
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+#include "bmp.h"
+#include "lut.h"
+#include "mask.h"
+#include "k-means.h"
+#include "morphology.h"
+#include "feature-extraction.h"
+#include "pipeline.h"
+
+#ifndef LOG_LEVEL_CONF_PIPE
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_PIPE */
+#define LOG_LEVEL LOG_LEVEL_CONF_PIPE
+#endif /* LOG_LEVEL_CONF_PIPE */
+
+/*------------------------------------------------------------------------------*/
+#define PIPE_NAME_SF	"%31s"
+#define PIPE_ARG_LEN	256
+#define PIPE_ARG_SF	"%255s"
+
+/*------------------------------------------------------------------------------*/
+typedef enum {
+    PIPE_VAL_NONE = 0,	/* save gives nothing, save reads any value */
+    PIPE_VAL_BMP,	/* bmp data, drawn into as it is */
+    PIPE_VAL_GRAY,	/* intensity image */
+    PIPE_VAL_REGIONS,	/* labelled image and its regions */
+    PIPE_VAL_FEATURES,	/* features of the regions */
+} pipe_val_t;
+
+typedef int (*pipe_run_fn_t)(pipeline_t *, pipe_node_t *);
+
+typedef struct {
+    const char *name;
+    uint8_t inputs;
+    pipe_val_t in[PIPE_MAX_INPUTS];
+    pipe_val_t out;
+    uint8_t arg;	/* reads an argument after the inputs */
+    pipe_run_fn_t run;
+} pipe_op_desc_t;
+
+/*------------------------------------------------------------------------------*/
+static inline pipe_node_t* _pipe_input(pipeline_t *pipe, pipe_node_t *node, uint32_t k)
+{
+    return &pipe->node[node->input[k]];
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Image of input k to be changed in place. The last user of a value takes its
+ * buffer, the others work on a copy.
+ */
+static image_t* _pipe_take_image(pipeline_t *pipe, pipe_node_t *node, uint32_t k)
+{
+    pipe_node_t *in = _pipe_input(pipe, node, k);
+    image_t *image = NULL;
+
+    if (in->pending == 1) {
+	image = in->image;
+	in->image = NULL;
+	goto success;
+    }
+
+    util_fite(((image = (image_t *)malloc(sizeof(image_t))) == NULL),
+	    LOG_ERR("Image allocation failed\n"));
+    memcpy(image, in->image, sizeof(image_t));
+    util_fite(((image->buf = (uint8_t *)malloc(image->size * sizeof(uint8_t))) == NULL),
+	    LOG_ERR("Image data allocation failed\n"));
+    memcpy(image->buf, in->image->buf, image->size);
+
+    goto success;
+
+fail:
+    if (image) image->buf = NULL;
+    sfree(image);
+
+success:
+    return image;
+}
+
+/*------------------------------------------------------------------------------*/
+static void _pipe_node_clear(pipe_node_t *node)
+{
+    sfree_image(node->image);
+    sfree(node->regions.region);
+    node->regions.noe = 0;
+    sfree_fmat(node->features);
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_load(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+    const char *filename = strcmp(node->arg, "-") ? node->arg : pipe->input;
+
+    util_fite((filename == NULL), LOG_ERR("'%s' needs an input image!\n", node->name));
+    util_fit(((node->image = bmp_load(filename)) == NULL));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_intensity(pipeline_t *pipe, pipe_node_t *node)
+{
+    node->image = bmp_convert_to_intensity(*_pipe_input(pipe, node, 0)->image);
+    return (node->image == NULL) ? -1 : 0;
+}
+
+/*------------------------------------------------------------------------------*/
+/* 'auto' thresholds with k-means as the cv_* functions do */
+static int _pipe_threshold(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+    long threshold = 0;
+    char *end = NULL;
+    lut_t lut;
+
+    util_fit(((node->image = _pipe_take_image(pipe, node, 0)) == NULL));
+    if (!strcmp(node->arg, "auto")) {
+	util_fit(((threshold = kmeans_get_thold(2, *node->image, rand())) < 0));
+    } else {
+	threshold = strtol(node->arg, &end, 10);
+	util_fite((*end != '\0' || threshold < 0 || threshold > UINT8_MAX),
+		LOG_ERR("Invalid threshold '%s'!\n", node->arg));
+    }
+    lut_threshold(&lut, threshold, COLOR_FG, COLOR_BG);
+    lut_apply_image(&lut, *node->image);
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_morph(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+
+    util_fit(((node->image = _pipe_take_image(pipe, node, 0)) == NULL));
+    util_fit((morp_apply(*node->image, node->arg) != 0));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_median(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+    long radius = 0;
+    char *end = NULL;
+
+    radius = strtol(node->arg, &end, 10);
+    util_fite((*end != '\0' || radius < 0 || radius > MASK_MEDIAN_MAX_RADIUS),
+	    LOG_ERR("Invalid median radius '%s'!\n", node->arg));
+    util_fit(((node->image = _pipe_take_image(pipe, node, 0)) == NULL));
+    util_fit((mask_median(*node->image, radius) != 0));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_mask(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+    mask_t *mask = NULL;
+
+    util_fit(((mask = mask_read_from_file(node->arg)) == NULL));
+    util_fit(((node->image = _pipe_take_image(pipe, node, 0)) == NULL));
+    util_fit((mask_apply(*node->image, *mask) != 0));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    sfree_mask(mask);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_label(pipeline_t *pipe, pipe_node_t *node)
+{
+    node->image = morp_identify_regions(*_pipe_input(pipe, node, 0)->image, &node->regions);
+    return (node->image == NULL) ? -1 : 0;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_features(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+    pipe_node_t *in = _pipe_input(pipe, node, 0);
+    freg_set_t set;
+
+    util_fit((fe_features_selected(&set) != 0));
+    util_fit(((node->features = fe_get_all(*in->image, in->regions, &set)) == NULL));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Marks the regions with the colors of their nearest classes in the db */
+static int _pipe_classify(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+    pipe_node_t *in = _pipe_input(pipe, node, 0);
+    classes_t *classes = NULL;
+    draw_format_t format;
+    fe_cascade_stats_t stats;
+
+    util_fit(((classes = fe_load_classes_with_features(node->arg)) == NULL));
+    util_fit((fe_classes_index(classes) != 0));
+    util_fit(((node->image = _pipe_take_image(pipe, node, 1)) == NULL));
+    bmp_draw_format(*node->image, &format);
+    util_fit((fe_test(*in->image, in->regions, *classes, *node->image, &format, &stats) != 0));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    fe_classes_free(&classes);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_draw(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+    draw_format_t format;
+
+    util_fit(((node->image = _pipe_take_image(pipe, node, 0)) == NULL));
+    bmp_draw_format(*node->image, &format);
+    util_fit((draw_multi_shapes(*node->image, &format, node->arg, 0) != 0));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+static int _pipe_save_image(const char *filename, image_t image, const lut_t *lut)
+{
+    int ret = 0;
+    image_t *bmp = NULL;
+
+    util_fit(((bmp = bmp_convert_from_intensity_lut(image, lut)) == NULL));
+    util_fit((bmp_save(filename, *bmp) != 0));
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    sfree_image(bmp);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Gray and labelled images are saved as bmp, the labels colorized. Features
+ * are saved as the average of the regions like '-f avg'.
+ */
+static int _pipe_save(pipeline_t *pipe, pipe_node_t *node)
+{
+    int ret = 0;
+    pipe_node_t *in = _pipe_input(pipe, node, 0);
+    fmat_t *avg = NULL;
+    lut_t lut;
+
+    switch (in->op) {
+	case PIPE_LOAD:
+	case PIPE_CLASSIFY:
+	case PIPE_DRAW:
+	    util_fit((bmp_save(node->arg, *in->image) != 0));
+	    break;
+	case PIPE_LABEL:
+	    /* see morp_colorize_regions */
+	    lut_multiply(&lut, 240 / in->regions.noe);
+	    util_fit((_pipe_save_image(node->arg, *in->image, &lut) != 0));
+	    break;
+	case PIPE_FEATURES:
+	    util_fit(((avg = fe_avg(in->features)) == NULL));
+	    util_fit((fe_save(node->arg, *avg) != 0));
+	    break;
+	default:
+	    util_fit((_pipe_save_image(node->arg, *in->image, NULL) != 0));
+	    break;
+    }
+    LOG_DBG("'%s' saved\n", node->arg);
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    sfree_fmat(avg);
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Indexed by pipe_op_t */
+static const pipe_op_desc_t pipe_ops[] = {
+    { "load", 0, { PIPE_VAL_NONE }, PIPE_VAL_BMP, 1, _pipe_load },
+    { "intensity", 1, { PIPE_VAL_BMP }, PIPE_VAL_GRAY, 0, _pipe_intensity },
+    { "threshold", 1, { PIPE_VAL_GRAY }, PIPE_VAL_GRAY, 1, _pipe_threshold },
+    { "morph", 1, { PIPE_VAL_GRAY }, PIPE_VAL_GRAY, 1, _pipe_morph },
+    { "median", 1, { PIPE_VAL_GRAY }, PIPE_VAL_GRAY, 1, _pipe_median },
+    { "mask", 1, { PIPE_VAL_GRAY }, PIPE_VAL_GRAY, 1, _pipe_mask },
+    { "label", 1, { PIPE_VAL_GRAY }, PIPE_VAL_REGIONS, 0, _pipe_label },
+    { "features", 1, { PIPE_VAL_REGIONS }, PIPE_VAL_FEATURES, 0, _pipe_features },
+    { "classify", 2, { PIPE_VAL_REGIONS, PIPE_VAL_BMP }, PIPE_VAL_BMP, 1, _pipe_classify },
+    { "draw", 1, { PIPE_VAL_BMP }, PIPE_VAL_BMP, 1, _pipe_draw },
+    { "save", 1, { PIPE_VAL_NONE }, PIPE_VAL_NONE, 1, _pipe_save },
+};
+
+#define PIPE_OPS_NOE	(sizeof(pipe_ops) / sizeof(pipe_ops[0]))
+
+/*------------------------------------------------------------------------------*/
+/* Index of the node with the name, noe if there is none */
+static uint32_t _pipe_find(const pipeline_t *pipe, const char *name)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < pipe->noe; i++) {
+	if (!strcmp(pipe->node[i].name, name)) break;
+    }
+    return i;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Reads the rest of a node line after its operation name */
+static int _pipe_read_node(pipeline_t *pipe, FILE *file, pipe_node_t *node)
+{
+    int ret = 0;
+    uint32_t k = 0, i = 0;
+    const pipe_op_desc_t *desc = &pipe_ops[node->op];
+    pipe_val_t val = PIPE_VAL_NONE;
+    char name[PIPE_NAME_LEN], arg[PIPE_ARG_LEN];
+
+    if (desc->out != PIPE_VAL_NONE) {
+	util_fite(((fscanf(file, PIPE_NAME_SF, node->name)) != 1),
+		LOG_ERR("Reading %s name failed!\n", desc->name));
+	util_fite((_pipe_find(pipe, node->name) != pipe->noe),
+		LOG_ERR("'%s' is defined twice!\n", node->name));
+    }
+
+    for (k = 0; k < desc->inputs; k++) {
+	util_fite(((fscanf(file, PIPE_NAME_SF, name)) != 1),
+		LOG_ERR("Reading %s inputs failed!\n", desc->name));
+	/* only the nodes above can be read, there can be no cycles */
+	util_fite(((i = _pipe_find(pipe, name)) == pipe->noe),
+		LOG_ERR("'%s' is not defined before %s!\n", name, desc->name));
+	val = pipe_ops[pipe->node[i].op].out;
+	util_fite((val == PIPE_VAL_NONE || (desc->in[k] != PIPE_VAL_NONE && desc->in[k] != val)),
+		LOG_ERR("'%s' can not be an input of %s!\n", name, desc->name));
+	node->input[k] = i;
+	pipe->node[i].users++;
+    }
+
+    if (desc->arg) {
+	util_fite(((fscanf(file, PIPE_ARG_SF, arg)) != 1),
+		LOG_ERR("Reading %s argument failed!\n", desc->name));
+	util_fite(((node->arg = strdup(arg)) == NULL),
+		LOG_ERR("Argument allocation failed!\n"));
+    }
+
+    goto success;
+
+fail:
+    ret = -1;
+
+success:
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Reads a pipeline file, a node a line in the order they run:
+ *   load <name> <file, '-' for the input image>
+ *   intensity <name> <bmp>
+ *   threshold <name> <gray> <0..255 or auto>
+ *   morph <name> <gray> <dilation|erosion|open|close>
+ *   median <name> <gray> <radius>
+ *   mask <name> <gray> <mask file>
+ *   label <name> <gray>
+ *   features <name> <regions>
+ *   classify <name> <regions> <bmp> <classes db>
+ *   draw <name> <bmp> <draw file>
+ *   save <value> <file, features are saved as the region average>
+ *   EOF
+ */
+pipeline_t* pipe_load(const char *filename)
+{
+    FILE *file = NULL;
+    uint32_t op = 0;
+    char op_name[PIPE_NAME_LEN];
+    pipe_node_t node, *nodes = NULL;
+    pipeline_t *pipe = NULL;
+
+    LOG_DBG("filename:'%s'\n", filename);
+
+    util_fite(((file = fopen(filename, "r")) == NULL), LOG_ERR("File open failed!\n"));
+    util_fite(((pipe = (pipeline_t *)calloc(1, sizeof(pipeline_t))) == NULL),
+	    LOG_ERR("Pipeline allocation failed!\n"));
+
+    while (1) {
+	util_fite(((fscanf(file, PIPE_NAME_SF, op_name)) != 1),
+		LOG_ERR("Reading operation name failed!\n"));
+	if (!strcmp("EOF", op_name)) break;
+
+	for (op = 0; op < PIPE_OPS_NOE; op++) {
+	    if (!strcmp(pipe_ops[op].name, op_name)) break;
+	}
+	util_fite((op == PIPE_OPS_NOE), LOG_ERR("Operation '%s' is not supported!\n", op_name));
+
+	if (pipe->noe == pipe->capacity) {
+	    util_fite(((nodes = (pipe_node_t *)realloc(pipe->node,
+				(pipe->capacity * 2 + 1) * sizeof(pipe_node_t))) == NULL),
+		    LOG_ERR("Pipeline nodes allocation failed!\n"));
+	    pipe->node = nodes;
+	    pipe->capacity = pipe->capacity * 2 + 1;
+	}
+	memset(&node, 0, sizeof(pipe_node_t));
+	node.op = op;
+	util_fit((_pipe_read_node(pipe, file, &node) != 0));
+	pipe->node[pipe->noe++] = node;
+    }
+
+    LOG_DBG("%u nodes read\n", pipe->noe);
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    pipe_free(&pipe);
+
+success:
+    if (file) fclose(file);
+    return pipe;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Runs the nodes in order on the input image, only save nodes write files.
+ * A value is freed as soon as its last user has run.
+ */
+int pipe_run(pipeline_t *pipe, const char *input_filename)
+{
+    int ret = 0;
+    uint32_t i = 0, k = 0;
+    pipe_node_t *node = NULL, *in = NULL;
+
+    LOG_DBG("pipe:%p input_filename:'%s'\n", pipe, input_filename);
+
+    pipe->input = input_filename;
+    for (i = 0; i < pipe->noe; i++) {
+	pipe->node[i].pending = pipe->node[i].users;
+    }
+
+    for (i = 0; i < pipe->noe; i++) {
+	node = &pipe->node[i];
+	LOG_DBG("%s '%s'\n", pipe_ops[node->op].name, node->name);
+	util_fite((pipe_ops[node->op].run(pipe, node) != 0),
+		LOG_ERR("%s '%s' failed!\n", pipe_ops[node->op].name, node->name));
+
+	for (k = 0; k < pipe_ops[node->op].inputs; k++) {
+	    in = _pipe_input(pipe, node, k);
+	    if (--in->pending == 0) _pipe_node_clear(in);
+	}
+	if (node->users == 0) _pipe_node_clear(node);
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+
+success:
+    for (i = 0; i < pipe->noe; i++) {
+	_pipe_node_clear(&pipe->node[i]);
+    }
+    pipe->input = NULL;
+    return ret;
+}
+
+/*------------------------------------------------------------------------------*/
+void pipe_free(pipeline_t **pipe)
+{
+    uint32_t i = 0;
+
+    if (*pipe == NULL) return;
+
+    for (i = 0; i < (*pipe)->noe; i++) {
+	_pipe_node_clear(&(*pipe)->node[i]);
+	sfree((*pipe)->node[i].arg);
+    }
+    sfree((*pipe)->node);
+    sfree(*pipe);
+}
@@ -0,0 +1,349 @@
+/**
+ * \file
+ *	Quantized feature matrix functions
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "util.h"
+#include "quantize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define QMAT_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define QMAT_HAVE_AVX2 0
+#endif
+
+#ifndef LOG_LEVEL_CONF_QMAT
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_QMAT */
+#define LOG_LEVEL LOG_LEVEL_CONF_QMAT
+#endif /* LOG_LEVEL_CONF_QMAT */
+
+/*------------------------------------------------------------------------------*/
+/* Rows handled by one kernel call */
+#define QMAT_BLOCK 8
+
+/*------------------------------------------------------------------------------*/
+/* Distances of QMAT_BLOCK rows starting from row to the converted point */
+typedef void (*qmat_block_fn_t)(const qmat_t *, uint32_t, const float *, float *);
+
+typedef struct {
+    uint32_t n;		    /* wanted neighbors */
+    uint32_t noe;	    /* found neighbors, at most n */
+    int32_t *indexes;	    /* rows, nearest first */
+    float *distances;	    /* approximate squared distances, ascending */
+} qmat_knn_t;
+
+/*------------------------------------------------------------------------------*/
+static void _qmat_block_init(const qmat_t *, uint32_t, const float *, float *);
+
+static qmat_block_fn_t qmat_block_fn = _qmat_block_init;
+
+/*------------------------------------------------------------------------------*/
+static inline float _qmat_code(const qmat_t *qmat, size_t i)
+{
+    if (qmat->bits == 8) return ((const uint8_t *)qmat->data)[i];
+    return ((const uint16_t *)qmat->data)[i];
+}
+
+/*------------------------------------------------------------------------------*/
+/* Sums the lanes in the order of the SIMD kernel, both paths give the same bits */
+static float _qmat_row_distance(const qmat_t *qmat, uint32_t row, const float *point)
+{
+    uint32_t j = 0, l = 0;
+    size_t base = (size_t)row * qmat->stride;
+    float lane[QMAT_CHUNK], d = 0;
+
+    memset(lane, 0, sizeof(lane));
+    for (j = 0; j < qmat->stride; j += QMAT_CHUNK) {
+	for (l = 0; l < QMAT_CHUNK; l++) {
+	    d = (_qmat_code(qmat, base + j + l) - point[j + l]) * qmat->weight[j + l];
+	    lane[l] += d * d;
+	}
+    }
+    return ((lane[0] + lane[1]) + (lane[2] + lane[3])) +
+	((lane[4] + lane[5]) + (lane[6] + lane[7]));
+}
+
+/*------------------------------------------------------------------------------*/
+static void _qmat_block_scalar(const qmat_t *qmat, uint32_t row, const float *point,
+	float *distances)
+{
+    uint32_t r = 0;
+
+    for (r = 0; r < QMAT_BLOCK; r++) {
+	distances[r] = _qmat_row_distance(qmat, row + r, point);
+    }
+}
+
+#if QMAT_HAVE_AVX2
+/*------------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static inline __m256 _qmat_row_avx2(const qmat_t *qmat, size_t base, const float *point)
+{
+    uint32_t j = 0;
+    __m256i codes;
+    __m256 acc = _mm256_setzero_ps(), d;
+
+    for (j = 0; j < qmat->stride; j += QMAT_CHUNK) {
+	if (qmat->bits == 8) {
+	    codes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+			(const __m128i *)&((const uint8_t *)qmat->data)[base + j]));
+	} else {
+	    codes = _mm256_cvtepu16_epi32(_mm_loadu_si128(
+			(const __m128i *)&((const uint16_t *)qmat->data)[base + j]));
+	}
+	d = _mm256_sub_ps(_mm256_cvtepi32_ps(codes), _mm256_loadu_ps(&point[j]));
+	d = _mm256_mul_ps(d, _mm256_loadu_ps(&qmat->weight[j]));
+	acc = _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+    }
+    return acc;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Codes are widened to 32 bit lanes, one row per register. The horizontal
+ * sums of eight rows are done together with hadd, lane i of the result is the
+ * distance of row i.
+ */
+__attribute__((target("avx2")))
+static void _qmat_block_avx2(const qmat_t *qmat, uint32_t row, const float *point,
+	float *distances)
+{
+    uint32_t r = 0;
+    size_t base = (size_t)row * qmat->stride;
+    __m256 acc[QMAT_BLOCK], h[4], lo, hi;
+
+    for (r = 0; r < QMAT_BLOCK; r++) {
+	acc[r] = _qmat_row_avx2(qmat, base + (size_t)r * qmat->stride, point);
+    }
+    for (r = 0; r < 4; r++) {
+	h[r] = _mm256_hadd_ps(acc[2 * r], acc[2 * r + 1]);
+    }
+    lo = _mm256_hadd_ps(h[0], h[1]);
+    hi = _mm256_hadd_ps(h[2], h[3]);
+    _mm256_storeu_ps(distances, _mm256_add_ps(_mm256_permute2f128_ps(lo, hi, 0x20),
+		_mm256_permute2f128_ps(lo, hi, 0x31)));
+}
+#endif /* QMAT_HAVE_AVX2 */
+
+/*------------------------------------------------------------------------------*/
+static void _qmat_block_init(const qmat_t *qmat, uint32_t row, const float *point,
+	float *distances)
+{
+    qmat_block_fn_t fn = _qmat_block_scalar;
+
+#if QMAT_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) fn = _qmat_block_avx2;
+#endif /* QMAT_HAVE_AVX2 */
+
+    __atomic_store_n(&qmat_block_fn, fn, __ATOMIC_RELAXED);
+    fn(qmat, row, point, distances);
+}
+
+/*------------------------------------------------------------------------------*/
+/* Inserts into the ascending (distance, row) list if it is among the n nearest */
+static void _qmat_knn_insert(qmat_knn_t *knn, int32_t index, float distance)
+{
+    uint32_t i = knn->noe;
+
+    if (knn->noe == knn->n) {
+	/* Rows come in ascending order, an equal distance never wins */
+	if (!(distance < knn->distances[knn->n - 1])) return;
+	i--;
+    } else {
+	knn->noe++;
+    }
+
+    while (i > 0 && knn->distances[i - 1] > distance) {
+	knn->distances[i] = knn->distances[i - 1];
+	knn->indexes[i] = knn->indexes[i - 1];
+	i--;
+    }
+    knn->distances[i] = distance;
+    knn->indexes[i] = index;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Quantizes the rows of fmat to bits (8 or 16) wide codes. Every column gets
+ * its own offset and scale, so narrow columns keep their resolution.
+ */
+qmat_t* qmat_build(const fmat_t *fmat, uint8_t bits)
+{
+    uint32_t i = 0, j = 0;
+    double levels = (bits == 8) ? UINT8_MAX : UINT16_MAX, min = 0, max = 0, code = 0;
+    fmat_val_t *row = NULL;
+    qmat_t *qmat = NULL;
+
+    LOG_DBG("rows:%u cols:%u bits:%u\n", fmat->rows, fmat->cols, bits);
+
+    util_fite((bits != 8 && bits != 16), LOG_ERR("%u bit codes are not supported!\n", bits));
+    util_fite((fmat->rows == 0), LOG_ERR("There is nothing to quantize!\n"));
+    util_fite((fmat->cols > QMAT_MAX_COLS),
+	    LOG_ERR("%u columns, at most %u supported!\n", fmat->cols, QMAT_MAX_COLS));
+
+    util_fite(((qmat = (qmat_t *)calloc(1, sizeof(qmat_t))) == NULL),
+	    LOG_ERR("Quantized matrix allocation failed!\n"));
+    qmat->rows = fmat->rows;
+    qmat->cols = fmat->cols;
+    qmat->stride = (fmat->cols + QMAT_CHUNK - 1) / QMAT_CHUNK * QMAT_CHUNK;
+    qmat->bits = bits;
+
+    util_fite(((qmat->offset = (double *)calloc(qmat->stride, sizeof(double))) == NULL),
+	    LOG_ERR("Offsets allocation failed!\n"));
+    util_fite(((qmat->scale = (double *)calloc(qmat->stride, sizeof(double))) == NULL),
+	    LOG_ERR("Scales allocation failed!\n"));
+    util_fite(((qmat->weight = (float *)calloc(qmat->stride, sizeof(float))) == NULL),
+	    LOG_ERR("Weights allocation failed!\n"));
+    /* Padding codes stay zero */
+    util_fite(((qmat->data = calloc((size_t)qmat->rows * qmat->stride, bits / 8)) == NULL),
+	    LOG_ERR("Codes allocation failed!\n"));
+
+    for (j = 0; j < fmat->cols; j++) {
+	min = max = fmat_row(fmat, 0)[j];
+	for (i = 1; i < fmat->rows; i++) {
+	    row = fmat_row(fmat, i);
+	    if (row[j] < min) min = row[j];
+	    if (row[j] > max) max = row[j];
+	}
+	qmat->offset[j] = min;
+	/* A constant column is all zero codes, any non zero scale does */
+	qmat->scale[j] = (max > min) ? (max - min) / levels : 1;
+	qmat->weight[j] = qmat->scale[j];
+    }
+
+    for (i = 0; i < fmat->rows; i++) {
+	row = fmat_row(fmat, i);
+	for (j = 0; j < fmat->cols; j++) {
+	    code = nearbyint((row[j] - qmat->offset[j]) / qmat->scale[j]);
+	    code = (code < 0) ? 0 : (code > levels) ? levels : code;
+	    if (bits == 8) {
+		((uint8_t *)qmat->data)[(size_t)i * qmat->stride + j] = code;
+	    } else {
+		((uint16_t *)qmat->data)[(size_t)i * qmat->stride + j] = code;
+	    }
+	}
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    qmat_free(&qmat);
+
+success:
+    return qmat;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Points a quantized matrix at codes, offsets and scales stored in a db
+ * mapping (see qmat_build for their layout), only the kernel weights are
+ * allocated.
+ */
+qmat_t* qmat_map(void *data, double *offset, double *scale, uint32_t rows, uint32_t cols,
+	uint8_t bits)
+{
+    uint32_t j = 0;
+    qmat_t *qmat = NULL;
+
+    LOG_DBG("rows:%u cols:%u bits:%u\n", rows, cols, bits);
+
+    util_fite((bits != 8 && bits != 16), LOG_ERR("%u bit codes are not supported!\n", bits));
+    util_fite((cols > QMAT_MAX_COLS),
+	    LOG_ERR("%u columns, at most %u supported!\n", cols, QMAT_MAX_COLS));
+
+    util_fite(((qmat = (qmat_t *)calloc(1, sizeof(qmat_t))) == NULL),
+	    LOG_ERR("Quantized matrix allocation failed!\n"));
+    qmat->rows = rows;
+    qmat->cols = cols;
+    qmat->stride = (cols + QMAT_CHUNK - 1) / QMAT_CHUNK * QMAT_CHUNK;
+    qmat->bits = bits;
+    qmat->mapped = 1;
+    qmat->data = data;
+    qmat->offset = offset;
+    qmat->scale = scale;
+
+    util_fite(((qmat->weight = (float *)calloc(qmat->stride, sizeof(float))) == NULL),
+	    LOG_ERR("Weights allocation failed!\n"));
+    for (j = 0; j < cols; j++) {
+	util_fite((!(scale[j] > 0)), LOG_ERR("Column %u scale is not positive!\n", j));
+	qmat->weight[j] = scale[j];
+    }
+
+    goto success;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    qmat_free(&qmat);
+
+success:
+    return qmat;
+}
+
+/*------------------------------------------------------------------------------*/
+void qmat_free(qmat_t **qmat)
+{
+    if (*qmat == NULL) return;
+
+    if (!(*qmat)->mapped) {
+	sfree((*qmat)->data);
+	sfree((*qmat)->offset);
+	sfree((*qmat)->scale);
+    }
+    sfree((*qmat)->weight);
+    sfree(*qmat);
+}
+
+/*------------------------------------------------------------------------------*/
+/* Bytes of the codes, the part scanned by every query */
+size_t qmat_size(const qmat_t *qmat)
+{
+    return (size_t)qmat->rows * qmat->stride * (qmat->bits / 8);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Scans all rows for the n nearest to point by the decoded values and stores
+ * them nearest first (ties go to the smaller row) with their approximate
+ * squared distances. Returns how many are found, at most n.
+ */
+uint32_t qmat_knn(const qmat_t *qmat, const fmat_val_t *point, uint32_t n, int32_t *indexes,
+	float *distances)
+{
+    uint32_t i = 0, r = 0, blocks = qmat->rows / QMAT_BLOCK * QMAT_BLOCK;
+    float converted[QMAT_MAX_COLS], block[QMAT_BLOCK];
+    qmat_knn_t knn = { .n = n, .noe = 0, .indexes = indexes, .distances = distances };
+    qmat_block_fn_t fn = __atomic_load_n(&qmat_block_fn, __ATOMIC_RELAXED);
+
+    if (n == 0) return 0;
+
+    /* Point in code units, the kernels only subtract and weight */
+    memset(converted, 0, sizeof(converted));
+    for (i = 0; i < qmat->cols; i++) {
+	converted[i] = (point[i] - qmat->offset[i]) / qmat->scale[i];
+    }
+
+    for (i = 0; i < blocks; i += QMAT_BLOCK) {
+	fn(qmat, i, converted, block);
+	for (r = 0; r < QMAT_BLOCK; r++) {
+	    _qmat_knn_insert(&knn, i + r, block[r]);
+	}
+    }
+    for (; i < qmat->rows; i++) {
+	_qmat_knn_insert(&knn, i, _qmat_row_distance(qmat, i, converted));
+    }
+
+    return knn.noe;
+}
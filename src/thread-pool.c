@@ -0,0 +1,257 @@
+/**
+ * \file
+ *	Thread pool with work stealing
+ *
+ * \author
+ *	Kadir Yanık <kdrynkk@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "util.h"
+#include "thread-pool.h"
+
+#ifndef LOG_LEVEL_CONF_TPOOL
+#define LOG_LEVEL LOG_LEVEL_ERR
+#else /* LOG_LEVEL_CONF_TPOOL */
+#define LOG_LEVEL LOG_LEVEL_CONF_TPOOL
+#endif /* LOG_LEVEL_CONF_TPOOL */
+
+/*------------------------------------------------------------------------------*/
+extern uint32_t tpool_threads; /* defined in test.c, zero means online cpu count */
+
+/*------------------------------------------------------------------------------*/
+/* Owner pops from the tail, thieves take from the head */
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t *tasks;	/* task indexes, sized for all tasks */
+    uint32_t head;	/* first valid task */
+    uint32_t tail;	/* one past the last valid task */
+} tpool_deque_t;
+
+typedef struct {
+    tpool_deque_t *deques;  /* one deque per worker */
+    uint32_t noe;	    /* number of workers */
+    tpool_job_t job;
+    void *arg;
+    int failed;		    /* set when any job fails */
+} tpool_t;
+
+typedef struct {
+    tpool_t *pool;
+    uint32_t id;
+} tpool_worker_t;
+
+typedef struct {
+    uint64_t cost;
+    uint32_t index;
+} tpool_task_t;
+
+/*------------------------------------------------------------------------------*/
+/* Nested runs (a job calling tpool_run) execute inline on the calling worker */
+static __thread uint8_t in_worker = 0;
+
+/*------------------------------------------------------------------------------*/
+static int _tpool_cmp_cost(const void *a, const void *b)
+{
+    const tpool_task_t *x = (const tpool_task_t *)a, *y = (const tpool_task_t *)b;
+
+    /* Descending cost, ascending index for equal costs */
+    if (x->cost != y->cost) return (x->cost < y->cost) ? 1 : -1;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/*------------------------------------------------------------------------------*/
+static uint8_t _tpool_pop(tpool_deque_t *deque, uint32_t *index)
+{
+    uint8_t found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+	*index = deque->tasks[--deque->tail];
+	found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/*------------------------------------------------------------------------------*/
+/* Moves half of the victim's tasks into the (empty) thief deque */
+static uint8_t _tpool_steal(tpool_t *pool, uint32_t thief)
+{
+    uint32_t i = 0, n = 0, victim = 0;
+    tpool_deque_t *from = NULL, *to = &pool->deques[thief];
+
+    for (i = 1; i < pool->noe; i++) {
+	victim = (thief + i) % pool->noe;
+	from = &pool->deques[victim];
+
+	/* Thief deque is empty so nobody reads its tasks, fill it before publishing */
+	pthread_mutex_lock(&from->lock);
+	n = (from->tail - from->head + 1) / 2;
+	if (n > 0) {
+	    memcpy(to->tasks, &from->tasks[from->head], n * sizeof(uint32_t));
+	    from->head += n;
+	}
+	pthread_mutex_unlock(&from->lock);
+
+	if (n > 0) {
+	    pthread_mutex_lock(&to->lock);
+	    to->head = 0;
+	    to->tail = n;
+	    pthread_mutex_unlock(&to->lock);
+
+	    LOG_DBG("worker %u stole %u tasks from %u\n", thief, n, victim);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/*------------------------------------------------------------------------------*/
+static void* _tpool_worker(void *arg)
+{
+    tpool_worker_t *worker = (tpool_worker_t *)arg;
+    tpool_t *pool = worker->pool;
+    uint32_t index = 0;
+
+    in_worker = 1;
+    do {
+	while (_tpool_pop(&pool->deques[worker->id], &index)) {
+	    if (pool->job(pool->arg, index) != 0) {
+		__atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+	    }
+	}
+    } while (_tpool_steal(pool, worker->id));
+    in_worker = 0;
+
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Returns 1 on a pool worker thread, jobs that run inline on the calling thread
+ * are not in a worker.
+ */
+uint8_t tpool_in_worker(void)
+{
+    return in_worker;
+}
+
+/*------------------------------------------------------------------------------*/
+uint32_t tpool_get_threads(void)
+{
+    long cpus = 0;
+
+    if (tpool_threads != 0) return tpool_threads;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0) ? (uint32_t)cpus : 1;
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+ * Runs job(arg, i) for every i in [0, noe). Tasks are dealt to the workers in
+ * descending cost order (costs may be NULL) and idle workers steal the rest, so
+ * a few large tasks do not leave the other workers waiting.
+ */
+int tpool_run(uint32_t noe, const uint64_t *costs, tpool_job_t job, void *arg)
+{
+    int ret = 0;
+    uint32_t i = 0, threads = 0, started = 0;
+    tpool_t pool;
+    tpool_task_t *tasks = NULL;
+    tpool_worker_t *workers = NULL;
+    pthread_t *tids = NULL;
+
+    memset(&pool, 0, sizeof(tpool_t));
+
+    threads = tpool_get_threads();
+    if (threads > noe) threads = noe;
+
+    /* Serial path, also taken for nested runs */
+    if (threads <= 1 || in_worker) {
+	for (i = 0; i < noe; i++) {
+	    util_fit((job(arg, i) != 0));
+	}
+	goto success;
+    }
+
+    LOG_DBG("noe:%u threads:%u\n", noe, threads);
+
+    util_fite(((tasks = (tpool_task_t *)malloc(noe * sizeof(tpool_task_t))) == NULL),
+	    LOG_ERR("Tasks allocation failed!\n"));
+    for (i = 0; i < noe; i++) {
+	tasks[i].cost = costs ? costs[i] : 0;
+	tasks[i].index = i;
+    }
+    if (costs) qsort(tasks, noe, sizeof(tpool_task_t), _tpool_cmp_cost);
+
+    util_fite(((pool.deques = (tpool_deque_t *)calloc(threads, sizeof(tpool_deque_t))) == NULL),
+	    LOG_ERR("Deques allocation failed!\n"));
+    pool.noe = threads;
+    pool.job = job;
+    pool.arg = arg;
+    for (i = 0; i < threads; i++) {
+	pthread_mutex_init(&pool.deques[i].lock, NULL);
+    }
+    for (i = 0; i < threads; i++) {
+	util_fite(((pool.deques[i].tasks = (uint32_t *)malloc(noe * sizeof(uint32_t))) == NULL),
+		LOG_ERR("Deque tasks allocation failed!\n"));
+    }
+
+    /* Deal round robin so every worker gets a mix of large and small tasks.
+     * Workers pop from the tail, push in reverse to start with the largest. */
+    for (i = noe; i > 0; i--) {
+	tpool_deque_t *deque = &pool.deques[(i - 1) % threads];
+	deque->tasks[deque->tail++] = tasks[i - 1].index;
+    }
+
+    util_fite(((workers = (tpool_worker_t *)calloc(threads, sizeof(tpool_worker_t))) == NULL),
+	    LOG_ERR("Workers allocation failed!\n"));
+    util_fite(((tids = (pthread_t *)calloc(threads, sizeof(pthread_t))) == NULL),
+	    LOG_ERR("Thread ids allocation failed!\n"));
+
+    /* Calling thread is worker 0 */
+    for (i = 0; i < threads; i++) {
+	workers[i].pool = &pool;
+	workers[i].id = i;
+    }
+    for (started = 1; started < threads; started++) {
+	util_fite((pthread_create(&tids[started], NULL, _tpool_worker, &workers[started]) != 0),
+		LOG_ERR("Thread %u creation failed!\n", started));
+    }
+    _tpool_worker(&workers[0]);
+
+    goto join;
+
+fail:
+    LOG_ERR("%s failed!\n", __func__);
+    ret = -1;
+    /* Already started workers still drain the deques */
+    if (started > 1) _tpool_worker(&workers[0]);
+
+join:
+    for (i = 1; i < started; i++) {
+	pthread_join(tids[i], NULL);
+    }
+    if (pool.failed) ret = -1;
+
+success:
+    if (pool.deques) {
+	for (i = 0; i < pool.noe; i++) {
+	    pthread_mutex_destroy(&pool.deques[i].lock);
+	    sfree(pool.deques[i].tasks);
+	}
+	sfree(pool.deques);
+    }
+    sfree(tasks);
+    sfree(workers);
+    sfree(tids);
+    return ret;
+}
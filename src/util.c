@@ -12,6 +12,7 @@
 
 #include "log.h"
 #include "util.h"
+#include "thread-pool.h"
 
 #ifndef LOG_LEVEL_CONF_UTIL
 #define LOG_LEVEL LOG_LEVEL_ERR
@@ -33,8 +34,8 @@ int plot_histogram(const uint32_t* const histogram)
     int ret = 0;
     FILE *file = NULL;
 
-    /* Check plot is needed */
-    util_sit((plot_with_python == 0));
+    /* Check plot is needed, concurrent pool workers would share the file */
+    util_sit((plot_with_python == 0 || tpool_in_worker()));
 
     util_fite(((file = fopen(HISTOGRAM_FILE_NAME, "w")) == NULL),
 	    LOG_ERR("File open failed\n"));
@@ -57,36 +58,37 @@ success:
 }
 
 /*------------------------------------------------------------------------------*/
-str_node_t* util_sl_insert(str_node_t **head, char *str)
+/*
+ * Appends str to the list, tail (may be NULL) tracks the last node so appends
+ * do not walk the list.
+ */
+str_node_t* util_sl_insert(str_node_t **head, str_node_t **tail, char *str)
 {
-    str_node_t *ptr = *head;
+    str_node_t *ptr = NULL, *last = NULL;
+
+    util_fite(((ptr = (str_node_t *)calloc(1, sizeof(str_node_t))) == NULL),
+	    LOG_ERR("String list new allocation failed\n"));
+    util_fite(((ptr->str = strdup(str)) == NULL),
+	    LOG_ERR("Duplicating class name failed\n"));
 
+    /* Linked only when complete, a failure leaves the list as it was */
     if (*head == NULL) {
-	util_fite(((*head = (str_node_t *)calloc(1, sizeof(str_node_t))) == NULL),
-		LOG_ERR("String list first allocation failed\n"));
-	ptr = *head;
+	*head = ptr;
     } else {
-	while (ptr->next != NULL) {
-	    ptr = ptr->next;
+	last = (tail && *tail) ? *tail : *head;
+	while (last->next != NULL) {
+	    last = last->next;
 	}
-	util_fite(((ptr->next = (str_node_t *)calloc(1, sizeof(str_node_t))) == NULL),
-		LOG_ERR("String list new allocation failed\n"));
-	ptr = ptr->next;
+	last->next = ptr;
     }
-    util_fite(((ptr->str = strdup(str)) == NULL),
-	    LOG_ERR("Duplicating class name failed\n"));
+    if (tail) *tail = ptr;
     LOG_DBG("String %p - '%s' added\n", ptr, str);
 
     goto success;
 
 fail:
     if (ptr) sfree(ptr->str);
-    if (ptr == *head) {
-	sfree(*head);
-	ptr = NULL;
-    } else {
-	sfree(ptr);
-    }
+    sfree(ptr);
 
 success:
     return ptr;
@@ -107,3 +109,19 @@ void util_sl_free(str_node_t **head)
     *head = NULL;
 }
 
+/*------------------------------------------------------------------------------*/
+/*
+ * 64 bit FNV-1a hash of len bytes, continues from hash so data can be hashed in
+ * chunks. Start with UTIL_FNV1A_INIT.
+ */
+uint64_t util_fnv1a(const void *data, size_t len, uint64_t hash)
+{
+    size_t i = 0;
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    for (i = 0; i < len; i++) {
+	hash ^= bytes[i];
+	hash *= UTIL_FNV1A_PRIME;
+    }
+    return hash;
+}
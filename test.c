@@ -18,6 +18,9 @@
 #include "log.h"
 #include "util.h"
 #include "draw.h"
+#include "match.h"
+#include "feature-registry.h"
+#include "mask.h"
 
 #ifndef LOG_LEVEL_CONF_TEST
 #define LOG_LEVEL LOG_LEVEL_ERR
@@ -35,13 +38,26 @@
 #define OPT_APPLY_MORP		(0x01 << 6)
 #define OPT_IDENTIFY_REGION	(0x01 << 7)
 #define OPT_FEATURE_EXT		(0x01 << 8)
+#define OPT_MASK_BENCH		(0x01 << 9)
+#define OPT_FILTER_CHAIN	(0x01 << 10)
+#define OPT_GRADIENT		(0x01 << 11)
+#define OPT_CANNY		(0x01 << 12)
+#define OPT_POINT_OP		(0x01 << 13)
+#define OPT_PIPELINE		(0x01 << 14)
 
 /*------------------------------------------------------------------------------*/
 int print_with_func_line = 0;		    /* accessed by log.h */
 int verbose_output_enabled = 0;		    /* accessed by log.h */
 int plot_with_python = 0;		    /* accessed by util.c */
 double fe_match_epsilon = FE_MATCH_EPSILON; /* accessed by feature-extraction.c */
+match_mode_t fe_match_mode = MATCH_MODE_VOTE; /* accessed by feature-extraction.c */
+uint8_t fe_keep_samples = 0;		    /* accessed by feature-extraction.c */
+uint32_t fe_knn_k = FE_CONF_KNN_K;	    /* accessed by feature-extraction.c */
+uint8_t fe_quant_bits = 0;		    /* accessed by feature-extraction.c */
+const char *fe_features = FE_CONF_FEATURES; /* accessed by feature-extraction.c */
 uint8_t nbr_hfl = NBR_CONF_HFL;		    /* accessed by morphology.c */
+uint8_t cv_median_radius = CV_CONF_MEDIAN_RADIUS; /* accessed by computer-vision.c */
+uint32_t tpool_threads = TPOOL_CONF_THREADS; /* accessed by thread-pool.c */
 
 /*------------------------------------------------------------------------------*/
 static void _usage(const char *);
@@ -52,12 +68,16 @@ int main(int argc, char *argv[])
 {
     int ret = 0;
     char c = 0, *input_file = NULL, *test_image_file = NULL, *output_file = NULL,
-	 *mask_filename = NULL, *morp = NULL, *draw_filename = NULL, *fe_type = NULL;
+	 *mask_filename = NULL, *morp = NULL, *draw_filename = NULL, *fe_type = NULL,
+	 *chain_list = NULL, *grad_norm = NULL, *point_list = NULL,
+	 *pipeline_file = NULL;
     uint16_t option_mask = 0;
     int8_t parser_index = 0;
+    long l = 0;
     rectangle_t crop_rect = { .x = 0, .y = 0, .width = 0, .height = 0 };
+    freg_set_t set;
 
-    while ((c = getopt(argc, argv, "i:o:tbgRd:c:m:M:f:T:e:N:vVPh")) != -1) {
+    while ((c = getopt(argc, argv, "i:o:tbgRBEd:c:m:C:G:L:M:f:T:e:N:j:A:k:q:F:D:p:SvVPh")) != -1) {
 	switch(c) {
 	    case 'i':
 		input_file = optarg;
@@ -77,6 +97,12 @@ int main(int argc, char *argv[])
 	    case 'R':
 		option_mask |= OPT_IDENTIFY_REGION;
 		break;
+	    case 'B':
+		option_mask |= OPT_MASK_BENCH;
+		break;
+	    case 'E':
+		option_mask |= OPT_CANNY;
+		break;
 	    case 'd':
 		option_mask |= OPT_DRAW;
 		draw_filename = optarg;
@@ -86,8 +112,6 @@ int main(int argc, char *argv[])
 		optind--;
 		parser_index = -1;
 		while ((++parser_index < 4) && optind < argc) {
-		    long l = 0;
-
 		    util_fit((_safe_strtol(argv[optind], &l) != 0));
 		    util_fite((l < 1),
 			    fprintf(stderr, "-c arguments can not be less than 1\n"));
@@ -104,6 +128,22 @@ int main(int argc, char *argv[])
 		option_mask |= OPT_APPLY_MASK;
 		mask_filename = optarg;
 		break;
+	    case 'C':
+		option_mask |= OPT_FILTER_CHAIN;
+		chain_list = optarg;
+		break;
+	    case 'G':
+		option_mask |= OPT_GRADIENT;
+		grad_norm = optarg;
+		break;
+	    case 'L':
+		option_mask |= OPT_POINT_OP;
+		point_list = optarg;
+		break;
+	    case 'p':
+		option_mask |= OPT_PIPELINE;
+		pipeline_file = optarg;
+		break;
 	    case 'M':
 		option_mask |= OPT_APPLY_MORP;
 		morp = optarg;
@@ -120,14 +160,52 @@ int main(int argc, char *argv[])
 		util_fite((fe_match_epsilon <= 0),
 			fprintf(stderr, "-e option MUST greater than zero\n"));
 		break;
+	    case 'A':
+		util_fite((match_mode_from_str(optarg, &fe_match_mode) != 0),
+			fprintf(stderr, "-A option MUST be one of [vote|distance|approx|knn|cascade]\n"));
+		break;
+	    case 'k':
+		util_fit((_safe_strtol(optarg, &l) != 0));
+		util_fite((l < 1 || l > 0xffff),
+			fprintf(stderr, "-k arguments failed, please select in [1,65535]\n"));
+		fe_knn_k = l;
+		break;
+	    case 'q':
+		util_fit((_safe_strtol(optarg, &l) != 0));
+		util_fite((l != 0 && l != 8 && l != 16),
+			fprintf(stderr, "-q arguments failed, please select one of [0|8|16]\n"));
+		fe_quant_bits = l;
+		break;
+	    case 'F':
+		util_fite((freg_set_parse(&set, optarg) != 0), {
+			fprintf(stderr, "-F arguments failed, please select from [");
+			freg_print(stderr);
+			fprintf(stderr, "]\n"); });
+		fe_features = optarg;
+		break;
+	    case 'S':
+		fe_keep_samples = 1;
+		break;
 	    case 'N':
 		option_mask |= OPT_FEATURE_EXT;
-		long l = 0;
 		util_fit((_safe_strtol(optarg, &l) != 0));
 		util_fite((l < 1 || l > 0x7f),
 			fprintf(stderr, "-N arguments failed, please select in [1,127]\n"));
 		nbr_hfl = l;
 		break;
+	    case 'D':
+		util_fit((_safe_strtol(optarg, &l) != 0));
+		util_fite((l < 0 || l > MASK_MEDIAN_MAX_RADIUS),
+			fprintf(stderr, "-D arguments failed, please select in [0,%u]\n",
+			    MASK_MEDIAN_MAX_RADIUS));
+		cv_median_radius = l;
+		break;
+	    case 'j':
+		util_fit((_safe_strtol(optarg, &l) != 0));
+		util_fite((l < 0 || l > 0xff),
+			fprintf(stderr, "-j arguments failed, please select in [0,255]\n"));
+		tpool_threads = l;
+		break;
 	    case 'v':
 		/* opens all log levels */
 		verbose_output_enabled = 1;
@@ -177,6 +255,24 @@ int main(int argc, char *argv[])
     if (option_mask & OPT_APPLY_MASK) {
 	util_fit((cv_apply_mask(input_file, output_file, mask_filename) != 0));
     }
+    if (option_mask & OPT_MASK_BENCH) {
+	util_fit((cv_mask_bench(input_file) != 0));
+    }
+    if (option_mask & OPT_FILTER_CHAIN) {
+	util_fit((cv_apply_chain(input_file, output_file, chain_list) != 0));
+    }
+    if (option_mask & OPT_GRADIENT) {
+	util_fit((cv_gradient(input_file, output_file, grad_norm) != 0));
+    }
+    if (option_mask & OPT_CANNY) {
+	util_fit((cv_canny(input_file, output_file) != 0));
+    }
+    if (option_mask & OPT_POINT_OP) {
+	util_fit((cv_point_operation(input_file, output_file, point_list) != 0));
+    }
+    if (option_mask & OPT_PIPELINE) {
+	util_fit((cv_pipeline(input_file, pipeline_file) != 0));
+    }
     if (option_mask & OPT_APPLY_MORP) {
 	util_fit((cv_apply_morphology(input_file, output_file, morp) != 0));
     }
@@ -204,13 +300,17 @@ success:
 static void _usage(const char *name)
 {
     fprintf(stderr, "\nUsage: %s [-i <file>] [-o <file>] [-d <file>] [-c <x> <y> <width> <height>] "
-		    "[-m <file>] [-M [dilation|erosion|open|close]] [-N <n>] [-f [avg|learn]] "
-		    "[-T <file>] [-tbgRvVPh]\n"
+		    "[-m <file>] [-C <list>] [-G [l1|l2]] [-L <list>] [-p <file>] [-M [dilation|erosion|open|close]] [-N <n>] [-D <n>] [-f [avg|learn|update|test|convert|bench]] "
+		    "[-T <file>] [-A [vote|distance|approx|knn|cascade]] [-k <n>] [-q <bits>] [-F <list>] [-j <n>] "
+		    "[-tbgRBESvVPh]\n"
 		    "\t\b\bOptions with no arguments\n"
 		    "\t-t\ttest the input bmp file readability\n"
 		    "\t-b\tconvert input image to binary image\n"
 		    "\t-g\tconvert input image to gray scale image\n"
 		    "\t-R\tconvert input image to gray scale image where regions identified with color\n"
+		    "\t-B\ttime the direct and the FFT masking of input image with growing random masks\n"
+		    "\t-E\tdetect the edges of input image with Canny, thresholds come from the\n"
+		    "\t\t  histogram of the edge strengths\n"
 		    "\t-v\tenable verbose output\n"
 		    "\t-V\tadd function name and line into current log level\n"
 		    "\t-P\tplot graphics with python\n"
@@ -224,22 +324,64 @@ static void _usage(const char *name)
 		    "\t-c\tcropping arguments\n"
 		    "\t-m\tapply the mask in the given file which contain the mask\n"
 		    "\t\tformat=<width height <array-members-in-order>>\n"
+		    "\t\t  or=<separable width height <row-members> <column-members>>\n"
 		    "\t\t  for more details please check examples in the masks folder\n"
+		    "\t-C\tapply the comma separated mask files and morphology operations in order\n"
+		    "\t\t  in one pass over the gray scale image, intermediate images are not kept.\n"
+		    "\t\t  morphology paints every pixel that is not the background\n"
+		    "\t-G\tsave the Sobel gradient magnitude of the gray scale image, computed with\n"
+		    "\t\t  the given norm (|gx| + |gy| or sqrt(gx^2 + gy^2))\n"
+		    "\t-L\tapply the comma separated point operations to the gray scale image, they\n"
+		    "\t\t  are collapsed into one lookup table applied while the image is saved\n"
+		    "\t\t  invert, gamma:<g>, equalize, stretch[:<clip>], threshold:<t>\n"
+		    "\t-p\trun the operations of the pipeline file on input image in memory, only its\n"
+		    "\t\t  save operations write files, for more details check the pipelines folder\n"
 		    "\t-M\tapply morphology\n"
 		    "\t-N\tset neighbor (half) frame length while selecting regions\n"
 		    "\t\tincreasing this will increase performance\n"
 		    "\t\t  if the regions are too close to each other in image, you need to decrease\n"
+		    "\t-D\tremove the noise with a median of the given radius instead of open while\n"
+		    "\t\tselecting regions, keeps thin strokes open erodes, 0 applies open (default)\n"
 		    "\t-f\tfeature extraction\n"
 		    "\t\t  avg   : gets image as input file and calculate features for regions and writes calculated\n"
 		    "\t\t          average to the output file\n"
 		    "\t\t  learn : gets 'class & image-path' formatted input file and writes the calculated averages\n"
 		    "\t\t          for classes to the output file. Check db folder for more example\n"
+		    "\t\t  update: like learn, but folds the images into the existing db in the output\n"
+		    "\t\t          file. Images learned before are skipped unless they are changed, the ones\n"
+		    "\t\t          not listed anymore are forgotten\n"
 		    "\t\t  test  : gets 'class & features' formatted input file and test-image file with -T option.\n"
 		    "\t\t          Tries to classification image content with given classes db. Marks objects with\n"
 		    "\t\t          nearest class and save as image to the output file. You can use output file of 'learn'\n"
 		    "\t\t          option as input of this option.\n"
+		    "\t\t  convert: converts the classes db given with -i to the output file. Output is a\n"
+		    "\t\t          binary db if its extension is '.fdb', text otherwise. Binary dbs are\n"
+		    "\t\t          detected while loading, 'learn' writes binary for '.fdb' outputs too\n"
+		    "\t\t  bench : like 'test' on a db learned with -S, times the exact and the quantized\n"
+		    "\t\t          knn matching and reports their sizes and how many decisions agree\n"
 		    "\t-T\ttest input image file, meanful with only '-f test' option\n"
 		    "\t-e\tmatching epsilon value, meanful with only '-f test' option\n"
+		    "\t-A\tmatching algorithm, meanful with only '-f test' option\n"
+		    "\t\t  vote     : each feature votes for its nearest class (default)\n"
+		    "\t\t  distance : nearest class by the whole feature vector, matches if the rms\n"
+		    "\t\t             of the feature differences is smaller than epsilon\n"
+		    "\t\t  approx   : distance with approximate search, the found class may be at\n"
+		    "\t\t             most one acceptance radius farther than the nearest one\n"
+		    "\t\t  knn      : k nearest training samples vote, needs a db learned with -S\n"
+		    "\t\t  cascade  : vote with the features calculated cheapest first, stops once\n"
+		    "\t\t             no other class can win and reports the features evaluated\n"
+		    "\t-k\tneighbor count of the knn matching (default %u)\n"
+		    "\t-q\tscan 8 or 16 bit quantized samples in the knn matching, the candidates\n"
+		    "\t\t  are re-ranked by their exact distances. 0 disables (default). With -S,\n"
+		    "\t\t  'learn|update' keep the codes in binary dbs and knn scans them without -q\n"
+		    "\t-F\tcomma separated features to learn, meanful with only '-f avg|learn' options.\n"
+		    "\t\t  dbs keep their features, 'update' and 'test' use the ones of the db\n"
+		    "\t\t  hu1..hu7    : Hu moment invariants (default %s)\n"
+		    "\t\t  aspect      : shorter side of the region frame over the longer one\n"
+		    "\t\t  extent      : region area over its frame area\n"
+		    "\t\t  compactness : 4 pi area over squared perimeter\n"
+		    "\t-S\tkeep every training region as a sample, meanful with only '-f learn|update' options\n"
+		    "\t-j\tworker thread count, 0 uses all online cpus (default)\n"
 		    "Example:\n"
 		    "\t%s -t -i image.bmp\n"
 		    "\t%s -gi image.bmp\n"
@@ -248,14 +390,29 @@ static void _usage(const char *name)
 		    "\t%s -i image.bmp -d face.txt\n"
 		    "\t%s -i image.bmp -c 220 210 180 250\n"
 		    "\t%s -i image.bmp -m mask.txt\n"
+		    "\t%s -Bi image.bmp\n"
+		    "\t%s -i image.bmp -C masks/gaussian-5x5.txt,masks/edge-vertical.txt,close\n"
+		    "\t%s -i image.bmp -G l2\n"
+		    "\t%s -Ei image.bmp\n"
+		    "\t%s -i image.bmp -L equalize,gamma:0.8\n"
+		    "\t%s -i mixed.bmp -p pipelines/classify.txt\n"
 		    "\t%s -i shape.bmp -M open\n"
 		    "\t%s -N 4 -Ri shape.bmp\n"
+		    "\t%s -D 1 -Ri images/backup/shapes.bmp\n"
 		    "\t%s -f avg -i shape.bmp -o result.txt\n"
 		    "\t%s -f learn -i class-image-db.txt\n"
+		    "\t%s -f update -i class-image-db.txt -o features-db.fdb\n"
 		    "\t%s -f test -i features-db.txt -T mixed.bmp\n"
+		    "\t%s -S -f learn -i class-image-db.txt -o samples-db.txt\n"
+		    "\t%s -A knn -k 7 -f test -i samples-db.txt -T mixed.bmp\n"
+		    "\t%s -A knn -q 8 -f test -i samples-db.txt -T mixed.bmp\n"
+		    "\t%s -F hu1,hu2,aspect,extent,compactness -f learn -i class-image-db.txt\n"
+		    "\t%s -f bench -i samples-db.txt -T mixed.bmp\n"
+		    "\t%s -f convert -i features-db.txt -o features-db.fdb\n"
 		    "\t%s -vVPbgi image.bmp\n",
-		    name, name, name, name, name, name, name, name, name, name,
-		    name, name, name, name);
+		    name, FE_CONF_KNN_K, FE_CONF_FEATURES, name, name, name, name, name, name, name,
+		    name, name, name, name, name, name, name, name, name, name, name, name, name, name,
+		    name, name, name, name, name, name);
 }
 
 /*------------------------------------------------------------------------------*/